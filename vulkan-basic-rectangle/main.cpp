@@ -6,12 +6,77 @@
 #include <tuple>
 #include <bitset>
 #include <span>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <array>
+#include <random>
 //#include "glsl2spv.h"
 
 typedef unsigned int uint;
 
 const uint32_t WIDTH = 1600;
 const uint32_t HEIGHT = 1200;
+const uint32_t VERTEX_RING_FRAMES = 2;          // the frame the GPU may still be drawing + the one being written
+const uint32_t STATS_REPORT_INTERVAL = 120;     // frames
+
+enum VertexFormat {
+    VERTEX_FORMAT_RECTANGLE,    // x, y, r, g, b as fp32 (20 bytes), the rectangle and --stream
+    VERTEX_FORMAT_MESH_FULL,    // --mesh: fp32 position, normal and color (36 bytes)
+    VERTEX_FORMAT_MESH_PACKED,  // --mesh: snorm16 position, octahedral snorm16 normal, rgba8 color (16 bytes)
+    VERTEX_FORMAT_COUNT,
+};
+const char* VERTEX_FORMAT_NAMES[VERTEX_FORMAT_COUNT] = { "rectangle", "full", "packed" };
+
+enum MeshOrder {
+    MESH_ORDER_SOURCE,          // as generated or loaded
+    MESH_ORDER_OPTIMIZED,       // --optimize-mesh: vertex cache, overdraw and vertex fetch order
+    MESH_ORDER_COUNT,
+};
+const char* MESH_ORDER_NAMES[MESH_ORDER_COUNT] = { "source", "optimized" };
+
+const uint32_t VERTEX_CACHE_SIZE = 16;          // post-transform FIFO entries, simulated and targeted by Tipsify
+const uint32_t VERTEX_FETCH_LINE = 64;          // bytes
+const uint32_t VERTEX_FETCH_LINES = 256;        // simulated vertex fetch cache, 16 KB FIFO
+const float OVERDRAW_THRESHOLD = 1.05f;         // ACMR the overdraw clusters may cost, relative to the Tipsify order
+
+enum MeshletPath {
+    MESHLET_PATH_NONE,          // the whole index buffer in one draw
+    MESHLET_PATH_COMPUTE,       // a compute pass culls the meshlets into indirect draws
+    MESHLET_PATH_MESH_SHADER,   // VK_EXT_mesh_shader, a task shader culls the meshlets
+    MESHLET_PATH_COUNT,
+};
+const char* MESHLET_PATH_NAMES[MESHLET_PATH_COUNT] = { "indexed", "compute", "mesh" };
+
+const uint32_t MESHLET_MAX_VERTICES = 64;       // max_vertices of meshlet_ms.glsl
+const uint32_t MESHLET_MAX_TRIANGLES = 124;     // max_primitives of meshlet_ms.glsl
+const uint32_t MESHLET_TASK_GROUP = 32;         // meshlets per task workgroup, local_size_x of meshlet_ts.glsl
+
+enum DepthMode {
+    DEPTH_MODE_OFF,             // no depth test, the last triangle drawn wins
+    DEPTH_MODE_TEST,            // depth test and writes in the color pass
+    DEPTH_MODE_PREPASS,         // a depth only pass first, then the color pass shades only the EQUAL fragments
+    DEPTH_MODE_COUNT,
+};
+const char* DEPTH_MODE_NAMES[DEPTH_MODE_COUNT] = { "off", "test", "prepass" };
+
+// Pipeline variants of each vertex format
+enum DepthPass {
+    DEPTH_PASS_NONE,            // color, no depth test
+    DEPTH_PASS_TEST,            // color, LESS with depth writes
+    DEPTH_PASS_PREPASS,         // depth only: LESS with depth writes, no fragment shader and no color writes
+    DEPTH_PASS_EQUAL,           // color after DEPTH_PASS_PREPASS: EQUAL without depth writes
+    DEPTH_PASS_COUNT,
+};
+
+// Passes of each depth mode, in draw order
+const std::vector<DepthPass> DEPTH_MODE_PASSES[DEPTH_MODE_COUNT] = {
+    { DEPTH_PASS_NONE },
+    { DEPTH_PASS_TEST },
+    { DEPTH_PASS_PREPASS, DEPTH_PASS_EQUAL },
+};
 
 #ifdef NDEBUG
 const bool ON_DEBUG = false;
@@ -31,17 +96,28 @@ struct Global {
     VkQueue graphicsQueue; // assume allowing graphics and present
     uint queueFamilyIndex;
 
+    bool meshShader = false;        // VK_EXT_mesh_shader with task shaders, enabled for --meshlets
+    bool multiDrawIndirect = false; // MESHLET_PATH_COMPUTE needs it
+    bool drawIndirectCount = false; // and uses the count when present
+    PFN_vkCmdDrawMeshTasksEXT vkCmdDrawMeshTasksEXT;
+    bool pipelineStatistics = false;// fragment shader invocations per depth mode, enabled for --depth
+
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
     std::vector<VkImageView> swapChainImageViews;
     const VkFormat swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;    // intentionally chosen to match a specific format
     const VkExtent2D swapChainImageExtent = { .width = WIDTH, .height = HEIGHT };
 
+    VkFormat depthFormat;           // picked by findDepthFormat()
+    VkImage depthImage;             // one for every framebuffer, a single frame is in flight
+    VkDeviceMemory depthImageMemory;
+    VkImageView depthImageView;
+
     VkRenderPass renderPass;
     std::vector<VkFramebuffer> framebuffers;
 
     VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    VkPipeline graphicsPipelines[DEPTH_PASS_COUNT][VERTEX_FORMAT_COUNT];
 
     VkCommandPool commandPool;
     VkCommandBuffer commandBuffer;
@@ -50,12 +126,80 @@ struct Global {
     VkSemaphore renderFinishedSemaphore;
     VkFence inFlightFence;
 
-    VkBuffer vertexBuffer;
+    VkBuffer vertexBuffer;          // ring of VERTEX_RING_FRAMES slots, rewritten every frame
     VkDeviceMemory vertexBufferMemory;
+    uint8_t* vertexRing;            // persistently mapped
+    VkDeviceSize vertexRingSlotSize;
+    uint vertexRingSlot = 0;
+    VkDeviceSize vertexOffset = 0;  // slot of the frame being recorded, for vkCmdBindVertexBuffers
+    VkBuffer meshVertexBuffers[MESH_ORDER_COUNT][VERTEX_FORMAT_COUNT];    // VERTEX_FORMAT_MESH_*, uploaded once
+    VkDeviceMemory meshVertexBufferMemories[MESH_ORDER_COUNT][VERTEX_FORMAT_COUNT];
+    VkBuffer meshIndexBuffers[MESH_ORDER_COUNT];
+    VkDeviceMemory meshIndexBufferMemories[MESH_ORDER_COUNT];
     VkBuffer indexBuffer;
     VkDeviceMemory indexBufferMemory;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT16;   // UINT32 only for a mesh of more than 65536 vertices
+    uint indexCount;
+
+    // --meshlets
+    VkDescriptorSetLayout meshletSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet meshletSet;
+    VkPipelineLayout meshletPipelineLayout;     // shared by the cull, the task and the mesh shader
+    VkShaderStageFlags meshletStages;
+    VkPipeline meshletCullPipeline;             // MESHLET_PATH_COMPUTE
+    VkPipeline meshletPipeline;                 // MESHLET_PATH_MESH_SHADER
+    VkBuffer meshletBuffer;
+    VkDeviceMemory meshletBufferMemory;
+    VkBuffer meshletVertexBuffer;
+    VkDeviceMemory meshletVertexBufferMemory;
+    VkBuffer meshletTriangleBuffer;
+    VkDeviceMemory meshletTriangleBufferMemory;
+    VkBuffer meshletIndexBuffer;
+    VkDeviceMemory meshletIndexBufferMemory;
+    VkBuffer drawBuffer;                        // VkDrawIndexedIndirectCommand of each visible meshlet
+    VkDeviceMemory drawBufferMemory;
+    VkBuffer drawCountBuffer;                   // visible meshlets, counted by the cull or the task shader
+    VkDeviceMemory drawCountBufferMemory;
+    VkBuffer visibleCountBuffer;                // drawCountBuffer copied back for the report
+    VkDeviceMemory visibleCountBufferMemory;
+    uint32_t* visibleCount;
+
+    VkQueryPool timestampPool;
+    VkQueryPool statisticsPool;     // fragment shader invocations of the render pass, if pipelineStatistics
+    float timestampPeriod;          // nanoseconds per tick
+    VertexFormat lastFormat;        // format and order of the frame whose timestamps are read next
+    MeshOrder lastOrder;
+    MeshletPath lastPath;
+    DepthMode lastDepth;
+    bool timestampsPending = false;
 
     ~Global() {
+        vkDestroyQueryPool(device, timestampPool, nullptr);
+        vkDestroyQueryPool(device, statisticsPool, nullptr);
+        vkDestroyBuffer(device, meshletBuffer, nullptr);
+        vkFreeMemory(device, meshletBufferMemory, nullptr);
+        vkDestroyBuffer(device, meshletVertexBuffer, nullptr);
+        vkFreeMemory(device, meshletVertexBufferMemory, nullptr);
+        vkDestroyBuffer(device, meshletTriangleBuffer, nullptr);
+        vkFreeMemory(device, meshletTriangleBufferMemory, nullptr);
+        vkDestroyBuffer(device, meshletIndexBuffer, nullptr);
+        vkFreeMemory(device, meshletIndexBufferMemory, nullptr);
+        vkDestroyBuffer(device, drawBuffer, nullptr);
+        vkFreeMemory(device, drawBufferMemory, nullptr);
+        vkDestroyBuffer(device, drawCountBuffer, nullptr);
+        vkFreeMemory(device, drawCountBufferMemory, nullptr);
+        vkDestroyBuffer(device, visibleCountBuffer, nullptr);
+        vkFreeMemory(device, visibleCountBufferMemory, nullptr);
+        for (uint order = 0; order < MESH_ORDER_COUNT; ++order) {
+            for (uint i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+                vkDestroyBuffer(device, meshVertexBuffers[order][i], nullptr);
+                vkFreeMemory(device, meshVertexBufferMemories[order][i], nullptr);
+            }
+            vkDestroyBuffer(device, meshIndexBuffers[order], nullptr);
+            vkFreeMemory(device, meshIndexBufferMemories[order], nullptr);
+        }
+
         vkDestroyBuffer(device, vertexBuffer, nullptr);
         vkFreeMemory(device, vertexBufferMemory, nullptr);
         vkDestroyBuffer(device, indexBuffer, nullptr);
@@ -71,10 +215,23 @@ struct Global {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
         }
 
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        for (auto& pipelines : graphicsPipelines) {
+            for (auto pipeline : pipelines) {
+                vkDestroyPipeline(device, pipeline, nullptr);
+            }
+        }
+        vkDestroyPipeline(device, meshletCullPipeline, nullptr);
+        vkDestroyPipeline(device, meshletPipeline, nullptr);
+        vkDestroyPipelineLayout(device, meshletPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, meshletSetLayout, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
         vkDestroyRenderPass(device, renderPass, nullptr);
 
+        vkDestroyImageView(device, depthImageView, nullptr);
+        vkDestroyImage(device, depthImage, nullptr);
+        vkFreeMemory(device, depthImageMemory, nullptr);
+
         for (auto imageView : swapChainImageViews) {
             vkDestroyImageView(device, imageView, nullptr);
         }
@@ -89,6 +246,230 @@ struct Global {
     }
 } vk;
 
+struct Options {
+    uint streamVertices = 0;        // stream this many vertices (tiny triangles) per frame instead of the rectangle
+    uint meshSize = 0;              // draw a static n x n cell mesh instead of the rectangle
+    std::string meshFile;           // or load the mesh written by --pack-mesh
+    std::string packPath;           // quantize the --mesh mesh into this file and exit
+    VertexFormat vertexFormat = VERTEX_FORMAT_MESH_PACKED;
+    bool compareFormats = false;    // alternate the full and packed mesh every frame
+    bool shuffleMesh = false;       // scramble the source triangle and vertex order first
+    bool optimizeMesh = false;      // draw (or --pack-mesh) the optimized order
+    bool compareOrders = false;     // alternate the source and optimized order every frame
+    MeshletPath meshletPath = MESHLET_PATH_NONE;
+    bool meshletAuto = false;       // --meshlets auto: mesh shaders when the device has them, the compute path otherwise
+    bool compareMeshlets = false;   // alternate the whole index buffer and the meshlet path every frame
+    float zoom = 1.0f;              // of the mesh around the window center, so culling has something to do
+    DepthMode depthMode = DEPTH_MODE_OFF;
+    bool compareDepth = false;      // rotate through every depth mode, one per frame
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED; // tried before the default candidates of findDepthFormat()
+    uint layers = 1;                // copies of the mesh stacked back to front, one instance each
+} options;
+
+struct FormatStats {
+    uint frames = 0;
+    double gpuMs = 0.0;             // the render pass, from timestamps
+} formatStats[MESH_ORDER_COUNT][VERTEX_FORMAT_COUNT];
+
+struct MeshletStats {
+    uint frames = 0;
+    double gpuMs = 0.0;             // culling and the render pass, from timestamps
+    double visible = 0.0;           // meshlets that survived culling, summed over the frames
+} meshletStats[MESHLET_PATH_COUNT];
+
+struct DepthStats {
+    uint frames = 0;
+    double gpuMs = 0.0;             // the render pass, both passes of DEPTH_MODE_PREPASS
+    double fragments = 0.0;         // fragment shader invocations, summed over the frames
+} depthStats[DEPTH_MODE_COUNT];
+
+bool meshMode()
+{
+    return options.meshSize > 0 || !options.meshFile.empty();
+}
+
+bool drawsOrder(MeshOrder order)
+{
+    return options.compareOrders || (order == MESH_ORDER_OPTIMIZED) == options.optimizeMesh;
+}
+
+void parseOptions(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--stream") {
+            options.streamVertices = std::max(0, std::atoi(next())) / 3 * 3;
+        } else if (arg == "--mesh") {
+            options.meshSize = std::max(0, std::atoi(next()));
+        } else if (arg == "--mesh-file") {
+            options.meshFile = next();
+        } else if (arg == "--pack-mesh") {
+            options.packPath = next();
+        } else if (arg == "--vertex-format") {
+            std::string name = next();
+            if (name == "full") {
+                options.vertexFormat = VERTEX_FORMAT_MESH_FULL;
+            } else if (name == "packed") {
+                options.vertexFormat = VERTEX_FORMAT_MESH_PACKED;
+            } else {
+                throw std::runtime_error("unknown vertex format: " + name);
+            }
+        } else if (arg == "--compare-formats") {
+            options.compareFormats = true;
+        } else if (arg == "--shuffle-mesh") {
+            options.shuffleMesh = true;
+        } else if (arg == "--optimize-mesh") {
+            options.optimizeMesh = true;
+        } else if (arg == "--compare-orders") {
+            options.compareOrders = true;
+        } else if (arg == "--meshlets") {
+            std::string name = next();
+            if (name == "auto") {
+                options.meshletAuto = true;
+                options.meshletPath = MESHLET_PATH_COMPUTE;     // until createVkDevice() finds mesh shaders
+            } else if (name == "compute") {
+                options.meshletPath = MESHLET_PATH_COMPUTE;
+            } else if (name == "mesh") {
+                options.meshletPath = MESHLET_PATH_MESH_SHADER;
+            } else {
+                throw std::runtime_error("unknown meshlet path: " + name);
+            }
+        } else if (arg == "--compare-meshlets") {
+            options.compareMeshlets = true;
+        } else if (arg == "--zoom") {
+            options.zoom = std::max(0.01f, (float)std::atof(next()));
+        } else if (arg == "--depth") {
+            std::string name = next();
+            auto found = std::find(DEPTH_MODE_NAMES, DEPTH_MODE_NAMES + DEPTH_MODE_COUNT, name);
+            if (found == DEPTH_MODE_NAMES + DEPTH_MODE_COUNT) {
+                throw std::runtime_error("unknown depth mode: " + name);
+            }
+            options.depthMode = (DepthMode)(found - DEPTH_MODE_NAMES);
+        } else if (arg == "--compare-depth") {
+            options.compareDepth = true;
+        } else if (arg == "--depth-format") {
+            std::string name = next();
+            if (name == "d16") {
+                options.depthFormat = VK_FORMAT_D16_UNORM;
+            } else if (name == "d24") {
+                options.depthFormat = VK_FORMAT_X8_D24_UNORM_PACK32;
+            } else if (name == "d32") {
+                options.depthFormat = VK_FORMAT_D32_SFLOAT;
+            } else {
+                throw std::runtime_error("unknown depth format: " + name);
+            }
+        } else if (arg == "--layers") {
+            options.layers = std::max(1, std::atoi(next()));
+        } else {
+            throw std::runtime_error("unknown option: " + arg);
+        }
+    }
+
+    if (meshMode() && options.streamVertices > 0) {
+        throw std::runtime_error("--stream and a mesh cannot be drawn together");
+    }
+    if (!options.packPath.empty() && options.meshSize == 0) {
+        throw std::runtime_error("--pack-mesh needs --mesh");
+    }
+    if (options.compareMeshlets && options.meshletPath == MESHLET_PATH_NONE) {
+        throw std::runtime_error("--compare-meshlets needs --meshlets");
+    }
+    if (options.meshletPath != MESHLET_PATH_NONE) {
+        if (!meshMode()) {
+            throw std::runtime_error("--meshlets needs --mesh or --mesh-file");
+        }
+        // Both paths read the packed vertices of one order
+        if (options.compareOrders || options.compareFormats || options.vertexFormat != VERTEX_FORMAT_MESH_PACKED) {
+            throw std::runtime_error("--meshlets draws the packed format of one order");
+        }
+    }
+    if (options.depthMode != DEPTH_MODE_OFF || options.compareDepth || options.layers > 1) {
+        if (!meshMode()) {
+            throw std::runtime_error("--depth, --compare-depth and --layers need --mesh or --mesh-file");
+        }
+        if (options.meshletPath != MESHLET_PATH_NONE) {
+            throw std::runtime_error("--meshlets draws one layer without depth");
+        }
+    }
+    if (options.compareDepth && (options.compareFormats || options.compareOrders)) {
+        throw std::runtime_error("--compare-depth cannot alternate with other comparisons");
+    }
+}
+
+// --mesh, full precision
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+    float color[3];
+};
+
+// --mesh, quantized. position = snorm * PackedMesh::scale + PackedMesh::offset
+struct PackedVertex {
+    int16_t position[4];    // x, y, z, unused
+    int16_t normal[2];      // octahedral
+    uint8_t color[4];       // r, g, b, unused
+};
+
+struct Mesh {
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+struct PackedMesh {
+    float scale[4];         // per-mesh dequantization, vec4 for the push constant block
+    float offset[4];
+    std::vector<PackedVertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+// push_constant block of mesh_vs.glsl and mesh_packed_vs.glsl
+struct MeshPushConstants {
+    float scale[4];
+    float offset[4];
+    float view[4];          // zoom, center x, center y, --layers
+};
+
+// std430 layout of Meshlet in meshlet_*.glsl. Bounds are in mesh space, before the view.
+struct Meshlet {
+    float center[3];
+    float radius;
+    float coneAxis[3];      // every triangle is back facing to a view direction d with dot(coneAxis, d) > coneCutoff
+    float coneCutoff;
+    uint32_t vertexOffset;  // into MeshletMesh::vertices
+    uint32_t triangleOffset;// into MeshletMesh::triangles, and / 3 into MeshletMesh::indices
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+};
+
+struct MeshletMesh {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices;     // mesh vertex of each meshlet vertex
+    std::vector<uint32_t> triangles;    // three 8 bit meshlet vertex indices each
+    std::vector<uint32_t> indices;      // the same triangles with mesh vertex indices, for the compute path
+};
+
+// push_constant block of meshlet_*.glsl
+struct MeshletPushConstants {
+    MeshPushConstants mesh;
+    uint32_t meshletCount;
+};
+
+Mesh meshes[MESH_ORDER_COUNT];
+PackedMesh packedMeshes[MESH_ORDER_COUNT];
+MeshletMesh meshletMesh;    // of the drawn order, --meshlets
+
+MeshOrder drawnOrder()
+{
+    return options.optimizeMesh ? MESH_ORDER_OPTIMIZED : MESH_ORDER_SOURCE;
+}
+
 
 struct Geometry {
     static const uint vertexBytesSize = 20;
@@ -105,6 +486,28 @@ struct Geometry {
         return { data, sizeof(data) };
     }
 
+    // count / 3 tiny triangles on a grid over the whole viewport, same vertex layout as getVertices()
+    static std::tuple<float*, size_t> getStreamVertices(uint count) {
+        static std::vector<float> data;
+        if (data.empty()) {
+            const uint triangles = count / 3;
+            const uint columns = (uint)std::ceil(std::sqrt(triangles * (float)WIDTH / HEIGHT));
+            const uint rows = (triangles + columns - 1) / columns;
+            const float w = 2.0f / columns, h = 2.0f / rows;
+            data.reserve(count * 5);
+            for (uint i = 0; i < triangles; ++i) {
+                const float x = -1.0f + w * (i % columns), y = -1.0f + h * (i / columns);
+                const float r = 0.5f + 0.5f * x, g = 0.5f + 0.5f * y;
+                data.insert(data.end(), {
+                    x, y, r, g, 1,                      // clockwise on screen like the rectangle
+                    x + 0.8f * w, y, r, g, 0,
+                    x, y + 0.8f * h, r, g, 0,
+                });
+            }
+        }
+        return { data.data(), data.size() * sizeof(float) };
+    }
+
     static std::tuple<uint16_t*, size_t> getIndices() {
         static uint16_t data[] = {
             0, 1, 2, 2, 3, 0
@@ -112,31 +515,47 @@ struct Geometry {
         return { data, sizeof(data) };
     }
 
-    static VkVertexInputBindingDescription getBindingDescription() {
+    static VkVertexInputBindingDescription getBindingDescription(VertexFormat format = VERTEX_FORMAT_RECTANGLE) {
+        const uint strides[VERTEX_FORMAT_COUNT] = { vertexBytesSize, sizeof(MeshVertex), sizeof(PackedVertex) };
         return {
             .binding = 0,
-            .stride = vertexBytesSize,
+            .stride = strides[format],
         };
     }
 
-    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
-        return {
-            {
-                .location = 0,
-                .binding = 0,
-                .format = VK_FORMAT_R32G32_SFLOAT,      // x, y
-                .offset = vertexPositionOffset,
-            }, {
-                .location = 1,
-                .binding = 0,
-                .format = VK_FORMAT_R32G32B32_SFLOAT,   // r, g, b
-                .offset = vertexColorOffset,
-            }
-        };
+    // The packed formats are widened to float by the vertex fetch, the shaders only add the dequantization.
+    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(VertexFormat format = VERTEX_FORMAT_RECTANGLE) {
+        switch (format) {
+        case VERTEX_FORMAT_MESH_FULL:
+            return {
+                { .location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = offsetof(MeshVertex, position) },
+                { .location = 1, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = offsetof(MeshVertex, normal) },
+                { .location = 2, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = offsetof(MeshVertex, color) },
+            };
+        case VERTEX_FORMAT_MESH_PACKED:
+            return {
+                { .location = 0, .binding = 0, .format = VK_FORMAT_R16G16B16A16_SNORM, .offset = offsetof(PackedVertex, position) },
+                { .location = 1, .binding = 0, .format = VK_FORMAT_R16G16_SNORM, .offset = offsetof(PackedVertex, normal) },
+                { .location = 2, .binding = 0, .format = VK_FORMAT_R8G8B8A8_UNORM, .offset = offsetof(PackedVertex, color) },
+            };
+        default:
+            return {
+                {
+                    .location = 0,
+                    .binding = 0,
+                    .format = VK_FORMAT_R32G32_SFLOAT,      // x, y
+                    .offset = vertexPositionOffset,
+                }, {
+                    .location = 1,
+                    .binding = 0,
+                    .format = VK_FORMAT_R32G32B32_SFLOAT,   // r, g, b
+                    .offset = vertexColorOffset,
+                }
+            };
+        }
     }
 };
 
-
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, 
     VkDebugUtilsMessageTypeFlagsEXT messageType, 
@@ -225,6 +644,654 @@ static std::vector<char> readFile(const std::string& filename) {
     return buffer;
 }
 
+/*
+--mesh: a (n + 1) x (n + 1) vertex height field over most of the window. Its triangles are a couple of pixels wide
+at a few hundred cells, so drawing it is bound by vertex fetch and shading rather than by fragments.
+*/
+Mesh generateMesh(uint n)
+{
+    Mesh result;
+    result.vertices.reserve((size_t)(n + 1) * (n + 1));
+    result.indices.reserve((size_t)n * n * 6);
+
+    const float k = 12.0f, amplitude = 0.08f;
+    for (uint j = 0; j <= n; ++j) {
+        for (uint i = 0; i <= n; ++i) {
+            const float x = -0.9f + 1.8f * i / n, y = -0.9f + 1.8f * j / n;
+            const float h = amplitude * std::sin(k * x) * std::cos(k * y);
+            const float dhdx = amplitude * k * std::cos(k * x) * std::cos(k * y);
+            const float dhdy = -amplitude * k * std::sin(k * x) * std::sin(k * y);
+            const float length = std::sqrt(dhdx * dhdx + dhdy * dhdy + 1.0f);
+            result.vertices.push_back({
+                .position = { x, y, h },
+                .normal = { -dhdx / length, -dhdy / length, 1.0f / length },
+                .color = { 0.5f + 0.5f * x, 0.5f + 0.5f * y, 0.5f + 0.5f * h / amplitude },
+            });
+        }
+    }
+
+    // Clockwise on screen like the rectangle
+    for (uint j = 0; j < n; ++j) {
+        for (uint i = 0; i < n; ++i) {
+            const uint32_t a = j * (n + 1) + i, b = a + 1, c = a + n + 2, d = a + n + 1;
+            result.indices.insert(result.indices.end(), { a, b, c, c, d, a });
+        }
+    }
+    return result;
+}
+
+int16_t toSnorm16(float v)
+{
+    return (int16_t)std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+float fromSnorm16(int16_t v)
+{
+    return std::max(v / 32767.0f, -1.0f);   // as VK_FORMAT_*_SNORM does
+}
+
+// Unit normal -> [-1, 1]^2 through the octahedron, the lower half folded over the diagonals
+void encodeOctahedral(const float n[3], int16_t e[2])
+{
+    const float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+    float x = n[0] / l1, y = n[1] / l1;
+    if (n[2] < 0.0f) {
+        const float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    e[0] = toSnorm16(x);
+    e[1] = toSnorm16(y);
+}
+
+// Same as octahedralDecode() in mesh_packed_vs.glsl
+void decodeOctahedral(const int16_t e[2], float n[3])
+{
+    float x = fromSnorm16(e[0]), y = fromSnorm16(e[1]);
+    const float z = 1.0f - std::abs(x) - std::abs(y);
+    const float t = std::max(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    const float length = std::sqrt(x * x + y * y + z * z);
+    n[0] = x / length;
+    n[1] = y / length;
+    n[2] = z / length;
+}
+
+// Positions relative to the mesh bounds, so the 16 bits cover the mesh and not the whole float range.
+PackedMesh packMesh(const Mesh& source)
+{
+    PackedMesh result{};
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (auto& v : source.vertices) {
+        for (uint c = 0; c < 3; ++c) {
+            lo[c] = std::min(lo[c], v.position[c]);
+            hi[c] = std::max(hi[c], v.position[c]);
+        }
+    }
+    for (uint c = 0; c < 3; ++c) {
+        result.offset[c] = 0.5f * (lo[c] + hi[c]);
+        result.scale[c] = hi[c] > lo[c] ? 0.5f * (hi[c] - lo[c]) : 1.0f;
+    }
+
+    result.vertices.resize(source.vertices.size());
+    for (size_t i = 0; i < source.vertices.size(); ++i) {
+        const MeshVertex& v = source.vertices[i];
+        PackedVertex& packed = result.vertices[i];
+        for (uint c = 0; c < 3; ++c) {
+            packed.position[c] = toSnorm16((v.position[c] - result.offset[c]) / result.scale[c]);
+            packed.color[c] = (uint8_t)std::lround(std::clamp(v.color[c], 0.0f, 1.0f) * 255.0f);
+        }
+        encodeOctahedral(v.normal, packed.normal);
+    }
+    result.indices = source.indices;
+    return result;
+}
+
+// What the packed vertex fetch and mesh_packed_vs.glsl reconstruct, for --mesh-file and the error report
+Mesh unpackMesh(const PackedMesh& source)
+{
+    Mesh result;
+    result.vertices.resize(source.vertices.size());
+    for (size_t i = 0; i < source.vertices.size(); ++i) {
+        const PackedVertex& packed = source.vertices[i];
+        MeshVertex& v = result.vertices[i];
+        for (uint c = 0; c < 3; ++c) {
+            v.position[c] = fromSnorm16(packed.position[c]) * source.scale[c] + source.offset[c];
+            v.color[c] = packed.color[c] / 255.0f;
+        }
+        decodeOctahedral(packed.normal, v.normal);
+    }
+    result.indices = source.indices;
+    return result;
+}
+
+// File layout of --pack-mesh: this header, the vertices, then the indices
+struct PackedMeshHeader {
+    char magic[4];          // "PMSH"
+    uint32_t version;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    float scale[4];
+    float offset[4];
+};
+
+const uint32_t PACKED_MESH_VERSION = 1;
+
+void writePackedMesh(const std::string& path, const PackedMesh& source)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path + " for writing!");
+    }
+
+    PackedMeshHeader header{
+        .magic = { 'P', 'M', 'S', 'H' },
+        .version = PACKED_MESH_VERSION,
+        .vertexCount = (uint32_t)source.vertices.size(),
+        .indexCount = (uint32_t)source.indices.size(),
+    };
+    std::copy(source.scale, source.scale + 4, header.scale);
+    std::copy(source.offset, source.offset + 4, header.offset);
+
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)source.vertices.data(), source.vertices.size() * sizeof(PackedVertex));
+    file.write((const char*)source.indices.data(), source.indices.size() * sizeof(uint32_t));
+}
+
+PackedMesh readPackedMesh(const std::string& path)
+{
+    std::vector<char> data = readFile(path);
+    PackedMeshHeader header;
+    if (data.size() < sizeof(header)) {
+        throw std::runtime_error(path + " is not a packed mesh!");
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    const size_t verticesSize = (size_t)header.vertexCount * sizeof(PackedVertex);
+    const size_t indicesSize = (size_t)header.indexCount * sizeof(uint32_t);
+    if (memcmp(header.magic, "PMSH", 4) != 0 || header.version != PACKED_MESH_VERSION ||
+        data.size() != sizeof(header) + verticesSize + indicesSize) {
+        throw std::runtime_error(path + " is not a packed mesh!");
+    }
+
+    PackedMesh result{};
+    std::copy(header.scale, header.scale + 4, result.scale);
+    std::copy(header.offset, header.offset + 4, result.offset);
+    result.vertices.resize(header.vertexCount);
+    result.indices.resize(header.indexCount);
+    memcpy(result.vertices.data(), data.data() + sizeof(header), verticesSize);
+    memcpy(result.indices.data(), data.data() + sizeof(header) + verticesSize, indicesSize);
+    return result;
+}
+
+// New vertex i is vertices[remap[i]]
+template <typename Vertex>
+std::vector<Vertex> remapVertices(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& remap)
+{
+    std::vector<Vertex> result(remap.size());
+    for (size_t i = 0; i < remap.size(); ++i) {
+        result[i] = vertices[remap[i]];
+    }
+    return result;
+}
+
+// --shuffle-mesh: random triangle and vertex order, what an exporter that does not care about either hands over
+void shuffleMesh(Mesh& mesh, PackedMesh& packedMesh)
+{
+    std::mt19937 rng(1);
+    const size_t vertexCount = mesh.vertices.size(), triangleCount = mesh.indices.size() / 3;
+
+    std::vector<uint32_t> remap(vertexCount), inverse(vertexCount), triangles(triangleCount);
+    std::iota(remap.begin(), remap.end(), 0);
+    std::iota(triangles.begin(), triangles.end(), 0);
+    std::shuffle(remap.begin(), remap.end(), rng);
+    std::shuffle(triangles.begin(), triangles.end(), rng);
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        inverse[remap[i]] = i;
+    }
+
+    std::vector<uint32_t> indices(mesh.indices.size());
+    for (size_t t = 0; t < triangleCount; ++t) {
+        for (uint c = 0; c < 3; ++c) {
+            indices[t * 3 + c] = inverse[mesh.indices[triangles[t] * 3 + c]];
+        }
+    }
+
+    mesh.vertices = remapVertices(mesh.vertices, remap);
+    packedMesh.vertices = remapVertices(packedMesh.vertices, remap);
+    mesh.indices = packedMesh.indices = indices;
+}
+
+struct MeshStats {
+    float acmr;         // post-transform cache misses per triangle, 0.5 at best for a regular grid
+    float atvr;         // misses per vertex, 1 at best
+    float overfetch;    // bytes read by the vertex fetch per vertex byte, 1 at best
+};
+
+/*
+Replays indices through a VERTEX_CACHE_SIZE entry FIFO post-transform cache and, on each miss, a
+VERTEX_FETCH_LINES x VERTEX_FETCH_LINE FIFO vertex fetch cache over vertices of the given stride.
+Both caches keep a per-entry insertion time instead of a queue: an entry is in the cache while fewer than
+size insertions happened after it.
+*/
+MeshStats analyzeMesh(const std::vector<uint32_t>& indices, size_t vertexCount, uint stride)
+{
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<uint32_t> lineTime((vertexCount * stride + VERTEX_FETCH_LINE - 1) / VERTEX_FETCH_LINE, 0);
+    uint32_t time = VERTEX_CACHE_SIZE + 1, lineClock = VERTEX_FETCH_LINES + 1;
+    size_t misses = 0, lines = 0;
+
+    for (uint32_t v : indices) {
+        if (time - cacheTime[v] <= VERTEX_CACHE_SIZE) {
+            continue;
+        }
+        cacheTime[v] = time++;
+        ++misses;
+
+        const size_t first = (size_t)v * stride / VERTEX_FETCH_LINE, last = ((size_t)v * stride + stride - 1) / VERTEX_FETCH_LINE;
+        for (size_t line = first; line <= last; ++line) {
+            if (lineClock - lineTime[line] > VERTEX_FETCH_LINES) {
+                lineTime[line] = lineClock++;
+                ++lines;
+            }
+        }
+    }
+
+    return {
+        .acmr = (float)misses / (indices.size() / 3),
+        .atvr = (float)misses / vertexCount,
+        .overfetch = (float)(lines * VERTEX_FETCH_LINE) / (vertexCount * stride),
+    };
+}
+
+/*
+Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007).
+Emits every remaining triangle around a fanning vertex, then fans next around the triangle vertex that will still
+be in the cache after its own remaining triangles, preferring the oldest. With none left it backtracks through
+the recently emitted vertices (dead ends) and only then scans for any vertex with triangles left.
+hardBoundaries gets the first triangle of each run that began at such a dead end.
+*/
+std::vector<uint32_t> tipsify(const std::vector<uint32_t>& indices, size_t vertexCount, std::vector<uint32_t>& hardBoundaries)
+{
+    // Triangles around each vertex: adjacency[offsets[v] .. offsets[v + 1]]
+    std::vector<uint32_t> offsets(vertexCount + 1, 0), adjacency(indices.size());
+    for (uint32_t v : indices) {
+        ++offsets[v + 1];
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    {
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+        }
+    }
+
+    std::vector<uint32_t> live(vertexCount), cacheTime(vertexCount, 0);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        live[v] = offsets[v + 1] - offsets[v];
+    }
+    std::vector<bool> emitted(indices.size() / 3, false);
+    std::vector<uint32_t> deadEnds, candidates, result;
+    result.reserve(indices.size());
+    uint32_t time = VERTEX_CACHE_SIZE + 1;
+    size_t cursor = 0;
+
+    auto skipDeadEnd = [&]() -> int64_t {
+        while (!deadEnds.empty()) {
+            const uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[v] > 0) {
+                return v;
+            }
+        }
+        for (; cursor < vertexCount; ++cursor) {
+            if (live[cursor] > 0) {
+                return (int64_t)cursor;
+            }
+        }
+        return -1;
+    };
+
+    hardBoundaries.clear();
+    int64_t fanning = skipDeadEnd();
+    if (fanning >= 0) {
+        hardBoundaries.push_back(0);
+    }
+    while (fanning >= 0) {
+        candidates.clear();
+        for (uint32_t k = offsets[fanning]; k < offsets[fanning + 1]; ++k) {
+            const uint32_t t = adjacency[k];
+            if (emitted[t]) {
+                continue;
+            }
+            for (uint c = 0; c < 3; ++c) {
+                const uint32_t v = indices[t * 3 + c];
+                result.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cacheTime[v] > VERTEX_CACHE_SIZE) {
+                    cacheTime[v] = time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        int64_t next = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0) {
+                continue;
+            }
+            const int64_t age = time - cacheTime[v];
+            const int64_t priority = age + 2 * live[v] <= VERTEX_CACHE_SIZE ? age : 0;
+            if (priority > bestPriority) {
+                next = v;
+                bestPriority = priority;
+            }
+        }
+        if (next < 0) {
+            next = skipDeadEnd();
+            if (next >= 0) {
+                hardBoundaries.push_back((uint32_t)(result.size() / 3));
+            }
+        }
+        fanning = next;
+    }
+    return result;
+}
+
+/*
+Overdraw half of Tipsify: splits each hard cluster wherever its own ACMR, with a cold cache, has come down to
+threshold times the ACMR of the whole order, so reordering the clusters costs at most about threshold. Then
+draws the clusters whose average normal points most away from the mesh center first: on a closed mesh those are
+the front-most surfaces and occlude the rest once the depth test is on.
+*/
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<uint32_t>& hardBoundaries, const Mesh& mesh, float threshold)
+{
+    const size_t triangleCount = indices.size() / 3;
+    const float targetAcmr = threshold * analyzeMesh(indices, mesh.vertices.size(), sizeof(PackedVertex)).acmr;
+
+    std::vector<uint32_t> clusters;
+    std::vector<uint32_t> cacheTime(mesh.vertices.size(), 0);
+    uint32_t time = VERTEX_CACHE_SIZE + 1;
+    for (size_t h = 0; h < hardBoundaries.size(); ++h) {
+        const uint32_t end = h + 1 < hardBoundaries.size() ? hardBoundaries[h + 1] : (uint32_t)triangleCount;
+        uint32_t start = hardBoundaries[h], misses = 0;
+        clusters.push_back(start);
+        time += VERTEX_CACHE_SIZE + 1;      // cold cache
+
+        for (uint32_t t = start; t < end; ++t) {
+            for (uint c = 0; c < 3; ++c) {
+                const uint32_t v = indices[t * 3 + c];
+                if (time - cacheTime[v] > VERTEX_CACHE_SIZE) {
+                    cacheTime[v] = time++;
+                    ++misses;
+                }
+            }
+            if (t + 1 < end && misses <= targetAcmr * (t + 1 - start)) {
+                start = t + 1;
+                misses = 0;
+                clusters.push_back(start);
+                time += VERTEX_CACHE_SIZE + 1;
+            }
+        }
+    }
+
+    auto position = [&](uint32_t i) { return mesh.vertices[indices[i]].position; };
+
+    float center[3] = {};
+    for (auto& v : mesh.vertices) {
+        for (uint c = 0; c < 3; ++c) {
+            center[c] += v.position[c] / mesh.vertices.size();
+        }
+    }
+
+    // dot(area weighted cluster centroid - center, area weighted cluster normal)
+    std::vector<float> sortKeys(clusters.size());
+    for (size_t k = 0; k < clusters.size(); ++k) {
+        const uint32_t end = k + 1 < clusters.size() ? clusters[k + 1] : (uint32_t)triangleCount;
+        float centroid[3] = {}, normal[3] = {}, area = 0.0f;
+        for (uint32_t t = clusters[k]; t < end; ++t) {
+            const float* a = position(t * 3), * b = position(t * 3 + 1), * c = position(t * 3 + 2);
+            const float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            const float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+            const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            const float doubleArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (uint i = 0; i < 3; ++i) {
+                centroid[i] += (a[i] + b[i] + c[i]) / 3.0f * doubleArea;
+                normal[i] += n[i];
+            }
+            area += doubleArea;
+        }
+        float key = 0.0f;
+        for (uint i = 0; i < 3 && area > 0.0f; ++i) {
+            key += (centroid[i] / area - center[i]) * normal[i];
+        }
+        sortKeys[k] = key;
+    }
+
+    std::vector<uint32_t> order(clusters.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t k : order) {
+        const uint32_t end = k + 1 < clusters.size() ? clusters[k + 1] : (uint32_t)triangleCount;
+        result.insert(result.end(), indices.begin() + clusters[k] * 3, indices.begin() + end * 3);
+    }
+    indices = std::move(result);
+}
+
+// Numbers the vertices in the order the indices first use them and returns the remap, unused vertices are dropped.
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    std::vector<uint32_t> remap, renumbered(vertexCount, UINT32_MAX);
+    remap.reserve(vertexCount);
+    for (uint32_t& v : indices) {
+        if (renumbered[v] == UINT32_MAX) {
+            renumbered[v] = (uint32_t)remap.size();
+            remap.push_back(v);
+        }
+        v = renumbered[v];
+    }
+    return remap;
+}
+
+// --optimize-mesh: vertex cache order, then overdraw order of its clusters, then vertex fetch order of the result
+void optimizeMesh(Mesh& mesh, PackedMesh& packedMesh)
+{
+    std::vector<uint32_t> hardBoundaries;
+    std::vector<uint32_t> indices = tipsify(mesh.indices, mesh.vertices.size(), hardBoundaries);
+    optimizeOverdraw(indices, hardBoundaries, mesh, OVERDRAW_THRESHOLD);
+    const std::vector<uint32_t> remap = optimizeVertexFetch(indices, mesh.vertices.size());
+
+    mesh.vertices = remapVertices(mesh.vertices, remap);
+    packedMesh.vertices = remapVertices(packedMesh.vertices, remap);
+    mesh.indices = packedMesh.indices = indices;
+}
+
+// Sphere around the meshlet's vertices and cone around its triangle normals
+void computeMeshletBounds(const Mesh& mesh, const MeshletMesh& result, Meshlet& meshlet)
+{
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+        const float* p = mesh.vertices[result.vertices[meshlet.vertexOffset + i]].position;
+        for (uint c = 0; c < 3; ++c) {
+            lo[c] = std::min(lo[c], p[c]);
+            hi[c] = std::max(hi[c], p[c]);
+        }
+    }
+    meshlet.radius = 0.0f;
+    for (uint c = 0; c < 3; ++c) {
+        meshlet.center[c] = 0.5f * (lo[c] + hi[c]);
+    }
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+        const float* p = mesh.vertices[result.vertices[meshlet.vertexOffset + i]].position;
+        const float d[3] = { p[0] - meshlet.center[0], p[1] - meshlet.center[1], p[2] - meshlet.center[2] };
+        meshlet.radius = std::max(meshlet.radius, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+    }
+
+    std::vector<std::array<float, 3>> normals;
+    float axis[3] = {};
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+        const uint32_t* triangle = &result.indices[(meshlet.triangleOffset + t) * 3];
+        const float* a = mesh.vertices[triangle[0]].position, * b = mesh.vertices[triangle[1]].position, * c = mesh.vertices[triangle[2]].position;
+        const float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        const float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0f) {
+            continue;   // degenerate, faces nowhere
+        }
+        normals.push_back({ n[0] / length, n[1] / length, n[2] / length });
+        for (uint i = 0; i < 3; ++i) {
+            axis[i] += normals.back()[i];
+        }
+    }
+
+    const float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float minDot = length > 0.0f ? 1.0f : -1.0f;
+    for (uint i = 0; i < 3; ++i) {
+        meshlet.coneAxis[i] = length > 0.0f ? axis[i] / length : 0.0f;
+    }
+    for (auto& n : normals) {
+        minDot = std::min(minDot, n[0] * meshlet.coneAxis[0] + n[1] * meshlet.coneAxis[1] + n[2] * meshlet.coneAxis[2]);
+    }
+    // All normals within acos(minDot) of the axis. They all face away from d when the angle between d and the
+    // axis is below 90 degrees minus that, i.e. dot(axis, d) > sin(acos(minDot)). A cone of 90 degrees or more never culls.
+    meshlet.coneCutoff = minDot > 0.0f ? std::sqrt(1.0f - minDot * minDot) : 1.0f;
+}
+
+/*
+--meshlets: greedy, in index order, so a cache optimized order (--optimize-mesh) gives compact meshlets. A meshlet
+ends when the next triangle would bring it over MESHLET_MAX_VERTICES or MESHLET_MAX_TRIANGLES.
+*/
+MeshletMesh buildMeshlets(const Mesh& mesh)
+{
+    MeshletMesh result;
+    std::vector<uint8_t> local(mesh.vertices.size(), 0xff);    // meshlet vertex index of a mesh vertex, 0xff if none
+    Meshlet meshlet{};
+
+    auto finish = [&]() {
+        if (meshlet.triangleCount == 0) {
+            return;
+        }
+        computeMeshletBounds(mesh, result, meshlet);
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+            local[result.vertices[meshlet.vertexOffset + i]] = 0xff;
+        }
+        result.meshlets.push_back(meshlet);
+        meshlet = {
+            .vertexOffset = (uint32_t)result.vertices.size(),
+            .triangleOffset = (uint32_t)result.triangles.size(),
+        };
+    };
+
+    for (size_t t = 0; t < mesh.indices.size(); t += 3) {
+        const uint32_t* triangle = &mesh.indices[t];
+        uint32_t added = 0;
+        for (uint c = 0; c < 3; ++c) {
+            const bool repeated = (c > 0 && triangle[c] == triangle[0]) || (c > 1 && triangle[c] == triangle[1]);
+            added += local[triangle[c]] == 0xff && !repeated;
+        }
+        if (meshlet.vertexCount + added > MESHLET_MAX_VERTICES || meshlet.triangleCount + 1 > MESHLET_MAX_TRIANGLES) {
+            finish();
+        }
+
+        uint32_t packed = 0;
+        for (uint c = 0; c < 3; ++c) {
+            if (local[triangle[c]] == 0xff) {
+                local[triangle[c]] = (uint8_t)meshlet.vertexCount++;
+                result.vertices.push_back(triangle[c]);
+            }
+            packed |= (uint32_t)local[triangle[c]] << (8 * c);
+        }
+        result.triangles.push_back(packed);
+        result.indices.insert(result.indices.end(), triangle, triangle + 3);
+        ++meshlet.triangleCount;
+    }
+    finish();
+    return result;
+}
+
+/*
+Fills the source mesh from --mesh or --mesh-file, and the optimized one when it is drawn or packed. A loaded file
+has only the packed form, the full one is what the packed one decodes to. Prints the memory of both formats, the
+quantization error and the cache statistics of each order.
+*/
+void loadMesh()
+{
+    Mesh& mesh = meshes[MESH_ORDER_SOURCE];
+    PackedMesh& packedMesh = packedMeshes[MESH_ORDER_SOURCE];
+    if (!options.meshFile.empty()) {
+        packedMesh = readPackedMesh(options.meshFile);
+        mesh = unpackMesh(packedMesh);
+    } else {
+        mesh = generateMesh(options.meshSize);
+        packedMesh = packMesh(mesh);
+    }
+    if (options.shuffleMesh) {
+        shuffleMesh(mesh, packedMesh);
+    }
+    const Mesh decoded = unpackMesh(packedMesh);
+    float positionError = 0.0f, normalError = 0.0f;
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        const MeshVertex& a = mesh.vertices[i];
+        const MeshVertex& b = decoded.vertices[i];
+        float cosine = 0.0f;
+        for (uint c = 0; c < 3; ++c) {
+            positionError = std::max(positionError, std::abs(a.position[c] - b.position[c]));
+            cosine += a.normal[c] * b.normal[c];
+        }
+        normalError = std::max(normalError, std::acos(std::min(cosine, 1.0f)));
+    }
+
+    const double fullMB = mesh.vertices.size() * sizeof(MeshVertex) / (1024.0 * 1024.0);
+    const double packedMB = packedMesh.vertices.size() * sizeof(PackedVertex) / (1024.0 * 1024.0);
+    printf("[mesh] %zu vertices, %zu triangles, vertices full %.1f MB (%zu B) -> packed %.1f MB (%zu B), %.2fx smaller\n",
+        mesh.vertices.size(), mesh.indices.size() / 3,
+        fullMB, sizeof(MeshVertex), packedMB, sizeof(PackedVertex), fullMB / packedMB);
+    printf("[mesh] max error: position %.6f, normal %.3f degrees\n", positionError, normalError * 180.0f / 3.14159265f);
+
+    if (options.optimizeMesh || options.compareOrders) {
+        auto begin = std::chrono::steady_clock::now();
+        meshes[MESH_ORDER_OPTIMIZED] = mesh;
+        packedMeshes[MESH_ORDER_OPTIMIZED] = packedMesh;
+        optimizeMesh(meshes[MESH_ORDER_OPTIMIZED], packedMeshes[MESH_ORDER_OPTIMIZED]);
+        printf("[optimize] %.1f ms\n", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    }
+
+    for (uint order = 0; order < MESH_ORDER_COUNT; ++order) {
+        const Mesh& m = meshes[order];
+        if (m.indices.empty()) {
+            continue;
+        }
+        const MeshStats full = analyzeMesh(m.indices, m.vertices.size(), sizeof(MeshVertex));
+        const MeshStats packed = analyzeMesh(m.indices, m.vertices.size(), sizeof(PackedVertex));
+        printf("[optimize] %-9s ACMR %.3f, ATVR %.3f, overfetch full %.2fx, packed %.2fx\n",
+            MESH_ORDER_NAMES[order], full.acmr, full.atvr, full.overfetch, packed.overfetch);
+    }
+
+    const bool fits16 = mesh.vertices.size() <= 65536;
+    printf("[optimize] %s indices, %.1f MB\n", fits16 ? "16-bit" : "32-bit",
+        mesh.indices.size() * (fits16 ? sizeof(uint16_t) : sizeof(uint32_t)) / (1024.0 * 1024.0));
+
+    if (options.meshletPath != MESHLET_PATH_NONE) {
+        auto begin = std::chrono::steady_clock::now();
+        meshletMesh = buildMeshlets(meshes[drawnOrder()]);
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+        const size_t count = meshletMesh.meshlets.size();
+        printf("[meshlet] %zu meshlets of %.1f vertices (%u at most) and %.1f triangles (%u at most), built in %.1f ms\n",
+            count, (double)meshletMesh.vertices.size() / count, MESHLET_MAX_VERTICES,
+            (double)meshletMesh.triangles.size() / count, MESHLET_MAX_TRIANGLES, ms);
+    }
+}
+
 GLFWwindow* createWindow()
 {
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -237,7 +1304,7 @@ void createVkInstance(GLFWwindow* window)
     VkApplicationInfo appInfo{
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
         .pApplicationName = "Hello Triangle",
-        .apiVersion = VK_API_VERSION_1_0
+        .apiVersion = VK_API_VERSION_1_2
     };
 
     uint32_t glfwExtensionCount = 0;
@@ -329,6 +1396,47 @@ void createVkDevice()
     }
     float queuePriority = 1.0f;
 
+    // --meshlets: mesh shaders when present, the compute path needs multiDrawIndirect and uses drawIndirectCount
+    // when present. Nothing is enabled without --meshlets.
+    const bool meshlets = options.meshletPath != MESHLET_PATH_NONE;
+    std::vector<const char*> meshShaderExtensions = { VK_EXT_MESH_SHADER_EXTENSION_NAME };
+    const bool meshShaderExtension = meshlets && checkDeviceExtensionSupport(vk.physicalDevice, meshShaderExtensions);
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT supportedMeshShader{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT };
+    VkPhysicalDeviceVulkan12Features supported12{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = meshShaderExtension ? &supportedMeshShader : nullptr,
+    };
+    VkPhysicalDeviceFeatures2 supported{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported12,
+    };
+    vkGetPhysicalDeviceFeatures2(vk.physicalDevice, &supported);
+    vk.meshShader = meshShaderExtension && supportedMeshShader.taskShader && supportedMeshShader.meshShader;
+    vk.multiDrawIndirect = meshlets && supported.features.multiDrawIndirect;
+    vk.drawIndirectCount = meshlets && supported12.drawIndirectCount;
+
+    if (vk.meshShader) {
+        extentions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    }
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+        .taskShader = vk.meshShader,
+        .meshShader = vk.meshShader,
+    };
+    VkPhysicalDeviceVulkan12Features features12{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = vk.meshShader ? &meshShaderFeatures : nullptr,
+        .drawIndirectCount = vk.drawIndirectCount,
+    };
+    vk.pipelineStatistics = (options.depthMode != DEPTH_MODE_OFF || options.compareDepth) && supported.features.pipelineStatisticsQuery;
+
+    VkPhysicalDeviceFeatures features{
+        .multiDrawIndirect = vk.multiDrawIndirect,
+        .pipelineStatisticsQuery = vk.pipelineStatistics,
+    };
+
     VkDeviceQueueCreateInfo queueCreateInfo{
         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
         .queueFamilyIndex = vk.queueFamilyIndex,
@@ -338,10 +1446,12 @@ void createVkDevice()
 
     VkDeviceCreateInfo createInfo{
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &features12,
         .queueCreateInfoCount = 1,
         .pQueueCreateInfos = &queueCreateInfo,
         .enabledExtensionCount = (uint)extentions.size(),
         .ppEnabledExtensionNames = extentions.data(),
+        .pEnabledFeatures = &features,
     };
 
     if (vkCreateDevice(vk.physicalDevice, &createInfo, nullptr, &vk.device) != VK_SUCCESS) {
@@ -349,6 +1459,25 @@ void createVkDevice()
     }
 
     vkGetDeviceQueue(vk.device, vk.queueFamilyIndex, 0, &vk.graphicsQueue);
+
+    if (vk.meshShader) {
+        vk.vkCmdDrawMeshTasksEXT = (PFN_vkCmdDrawMeshTasksEXT)(vkGetDeviceProcAddr(vk.device, "vkCmdDrawMeshTasksEXT"));
+    }
+
+    // Software ICDs and older GPUs have no mesh shaders, --meshlets auto falls back to the compute path there.
+    if (options.meshletAuto) {
+        options.meshletPath = vk.meshShader ? MESHLET_PATH_MESH_SHADER : MESHLET_PATH_COMPUTE;
+    }
+    if (options.meshletPath == MESHLET_PATH_MESH_SHADER && !vk.meshShader) {
+        throw std::runtime_error("--meshlets mesh needs VK_EXT_mesh_shader with task shaders!");
+    }
+    if (options.meshletPath == MESHLET_PATH_COMPUTE && !vk.multiDrawIndirect) {
+        throw std::runtime_error("--meshlets compute needs multiDrawIndirect!");
+    }
+    if (meshlets) {
+        printf("[meshlet] %s path%s\n", MESHLET_PATH_NAMES[options.meshletPath],
+            options.meshletPath == MESHLET_PATH_COMPUTE && !vk.drawIndirectCount ? ", without drawIndirectCount" : "");
+    }
 }
 
 void createSwapChain()
@@ -411,40 +1540,161 @@ void createSwapChain()
         throw std::runtime_error("failed to create swap chain!");
     }
 
-    vkGetSwapchainImagesKHR(vk.device, vk.swapChain, &imageCount, nullptr);
-    vk.swapChainImages.resize(imageCount);
-    vkGetSwapchainImagesKHR(vk.device, vk.swapChain, &imageCount, vk.swapChainImages.data());
+    vkGetSwapchainImagesKHR(vk.device, vk.swapChain, &imageCount, nullptr);
+    vk.swapChainImages.resize(imageCount);
+    vkGetSwapchainImagesKHR(vk.device, vk.swapChain, &imageCount, vk.swapChainImages.data());
+
+    for (const auto& image : vk.swapChainImages) {
+        VkImageViewCreateInfo createInfo{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = vk.swapChainImageFormat,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .levelCount = 1,
+                .layerCount = 1,
+            },
+        };
+
+        VkImageView imageView;
+        if (vkCreateImageView(vk.device, &createInfo, nullptr, &imageView) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image views!");
+        }
+        vk.swapChainImageViews.push_back(imageView);
+    }
+}
+
+// --depth-format first, then the precise formats before the small ones. Stencil is never used.
+VkFormat findDepthFormat()
+{
+    std::vector<VkFormat> candidates = {
+        VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_X8_D24_UNORM_PACK32,
+        VK_FORMAT_D24_UNORM_S8_UINT,
+        VK_FORMAT_D32_SFLOAT_S8_UINT,
+        VK_FORMAT_D16_UNORM,
+    };
+    if (options.depthFormat != VK_FORMAT_UNDEFINED) {
+        candidates.insert(candidates.begin(), options.depthFormat);
+    }
+
+    for (VkFormat format : candidates) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(vk.physicalDevice, format, &props);
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            return format;
+        }
+    }
+    throw std::runtime_error("failed to find a depth format!");
+}
+
+const char* depthFormatName(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_D32_SFLOAT: return "D32_SFLOAT";
+    case VK_FORMAT_X8_D24_UNORM_PACK32: return "X8_D24_UNORM_PACK32";
+    case VK_FORMAT_D24_UNORM_S8_UINT: return "D24_UNORM_S8_UINT";
+    case VK_FORMAT_D32_SFLOAT_S8_UINT: return "D32_SFLOAT_S8_UINT";
+    case VK_FORMAT_D16_UNORM: return "D16_UNORM";
+    default: return "unknown";
+    }
+}
+
+void createDepthImage()
+{
+    vk.depthFormat = findDepthFormat();
+    const bool stencil = vk.depthFormat == VK_FORMAT_D24_UNORM_S8_UINT || vk.depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT;
+
+    VkImageCreateInfo imageInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = vk.depthFormat,
+        .extent = { .width = WIDTH, .height = HEIGHT, .depth = 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    if (vkCreateImage(vk.device, &imageInfo, nullptr, &vk.depthImage) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(vk.device, vk.depthImage, &memRequirements);
+
+    uint memTypeIndex = 0;
+    {
+        std::bitset<32> isSuppoted(memRequirements.memoryTypeBits);
+
+        VkPhysicalDeviceMemoryProperties spec;
+        vkGetPhysicalDeviceMemoryProperties(vk.physicalDevice, &spec);
+
+        for (auto& [props, _] : std::span<VkMemoryType>(spec.memoryTypes, spec.memoryTypeCount)) {
+            if (isSuppoted[memTypeIndex] && (props & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+                break;
+            }
+            ++memTypeIndex;
+        }
+    }
+
+    VkMemoryAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memRequirements.size,
+        .memoryTypeIndex = memTypeIndex,
+    };
+    if (vkAllocateMemory(vk.device, &allocInfo, nullptr, &vk.depthImageMemory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate depth image memory!");
+    }
+
+    vkBindImageMemory(vk.device, vk.depthImage, vk.depthImageMemory, 0);
+
+    VkImageViewCreateInfo viewInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = vk.depthImage,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = vk.depthFormat,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | (stencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0u),
+            .levelCount = 1,
+            .layerCount = 1,
+        },
+    };
 
-    for (const auto& image : vk.swapChainImages) {
-        VkImageViewCreateInfo createInfo{
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .image = image,
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = vk.swapChainImageFormat,
-            .subresourceRange = {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .levelCount = 1,
-                .layerCount = 1,
-            },
-        };
+    if (vkCreateImageView(vk.device, &viewInfo, nullptr, &vk.depthImageView) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth image view!");
+    }
 
-        VkImageView imageView;
-        if (vkCreateImageView(vk.device, &createInfo, nullptr, &imageView) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create image views!");
-        }
-        vk.swapChainImageViews.push_back(imageView);
+    if (meshMode()) {
+        printf("[depth] %s attachment\n", depthFormatName(vk.depthFormat));
     }
 }
 
 void createRenderPass()
 {
-    VkAttachmentDescription colorAttachment{
-        .format = vk.swapChainImageFormat,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    VkAttachmentDescription attachments[] = {
+        {
+            .format = vk.swapChainImageFormat,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        },
+        {
+            // Only lives through the render pass, nothing reads it afterwards.
+            .format = vk.depthFormat,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        },
     };
 
     VkAttachmentReference colorAttachmentRef0{
@@ -452,17 +1702,35 @@ void createRenderPass()
         .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
     };
 
+    VkAttachmentReference depthAttachmentRef{
+        .attachment = 1,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
     VkSubpassDescription subpass{
         .colorAttachmentCount = 1,
         .pColorAttachments = &colorAttachmentRef0,
+        .pDepthStencilAttachment = &depthAttachmentRef,
+    };
+
+    // The previous frame's depth tests are done before this frame's clear writes the same image.
+    VkSubpassDependency dependency{
+        .srcSubpass = VK_SUBPASS_EXTERNAL,
+        .dstSubpass = 0,
+        .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
     };
 
     VkRenderPassCreateInfo renderPassInfo{
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .attachmentCount = 1,
-        .pAttachments = &colorAttachment,
+        .attachmentCount = 2,
+        .pAttachments = attachments,
         .subpassCount = 1,
         .pSubpasses = &subpass,
+        .dependencyCount = 1,
+        .pDependencies = &dependency,
     };
 
     if (vkCreateRenderPass(vk.device, &renderPassInfo, nullptr, &vk.renderPass) != VK_SUCCESS) {
@@ -470,11 +1738,12 @@ void createRenderPass()
     }
 
     for (const auto& view : vk.swapChainImageViews) {
+        VkImageView views[] = { view, vk.depthImageView };
         VkFramebufferCreateInfo framebufferInfo{
             .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
             .renderPass = vk.renderPass,
-            .attachmentCount = 1,
-            .pAttachments = &view,
+            .attachmentCount = 2,
+            .pAttachments = views,
             .width = WIDTH,
             .height = HEIGHT,
             .layers = 1,
@@ -489,28 +1758,36 @@ void createRenderPass()
     }
 }
 
-void createGraphicsPipeline() 
+VkShaderModule spv2shaderModule(const char* filename)
 {
-    auto spv2shaderModule = [](const char* filename) {
-        auto vsSpv = readFile(filename);
-        VkShaderModuleCreateInfo createInfo{
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = vsSpv.size(),
-            .pCode = (uint*)vsSpv.data(),
-        };
-
-        VkShaderModule shaderModule;
-        if (vkCreateShaderModule(vk.device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create shader module!");
-        }
-        return shaderModule;
+    auto spv = readFile(filename);
+    VkShaderModuleCreateInfo createInfo{
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = spv.size(),
+        .pCode = (uint*)spv.data(),
     };
-    VkShaderModule vsModule = spv2shaderModule("vertex_input_vs.spv");
+
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(vk.device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shader module!");
+    }
+    return shaderModule;
+}
+
+/*
+With a task shader, vsFile is the mesh shader: there is no vertex input or input assembly and the pipeline uses
+the meshlet layout. Everything after the geometry stages is the same for both. The depth pass decides the depth
+state, and DEPTH_PASS_PREPASS has no fragment shader at all.
+*/
+VkPipeline createPipeline(const char* vsFile, VertexFormat format, DepthPass pass, const char* tsFile = nullptr)
+{
+    VkShaderModule vsModule = spv2shaderModule(vsFile);
     VkShaderModule fsModule = spv2shaderModule("vertex_input_fs.spv");
+    VkShaderModule tsModule = tsFile ? spv2shaderModule(tsFile) : VK_NULL_HANDLE;
 
     VkPipelineShaderStageCreateInfo vsStageInfo{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .stage = tsFile ? VK_SHADER_STAGE_MESH_BIT_EXT : VK_SHADER_STAGE_VERTEX_BIT,
         .module = vsModule,
         .pName = "main",
     };
@@ -520,11 +1797,23 @@ void createGraphicsPipeline()
         .module = fsModule,
         .pName = "main",
     };
+    VkPipelineShaderStageCreateInfo tsStageInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_TASK_BIT_EXT,
+        .module = tsModule,
+        .pName = "main",
+    };
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = { vsStageInfo, fsStageInfo };
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages = { vsStageInfo };
+    if (pass != DEPTH_PASS_PREPASS) {
+        shaderStages.push_back(fsStageInfo);
+    }
+    if (tsFile) {
+        shaderStages.insert(shaderStages.begin(), tsStageInfo);
+    }
 
-    auto bindingDescription = Geometry::getBindingDescription();
-    auto attributeDescriptions = Geometry::getAttributeDescriptions();
+    auto bindingDescription = Geometry::getBindingDescription(format);
+    auto attributeDescriptions = Geometry::getAttributeDescriptions(format);
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
@@ -557,9 +1846,17 @@ void createGraphicsPipeline()
         .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
     };
 
+    VkPipelineDepthStencilStateCreateInfo depthStencil{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = pass != DEPTH_PASS_NONE,
+        .depthWriteEnable = pass == DEPTH_PASS_TEST || pass == DEPTH_PASS_PREPASS,
+        .depthCompareOp = pass == DEPTH_PASS_EQUAL ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS,
+    };
+
     VkPipelineColorBlendAttachmentState colorBlendAttachment{
         .blendEnable = VK_FALSE,
-        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+        .colorWriteMask = pass == DEPTH_PASS_PREPASS ? 0u :
+            VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
     };
 
     VkPipelineColorBlendStateCreateInfo colorBlending{
@@ -579,36 +1876,197 @@ void createGraphicsPipeline()
         .pDynamicStates = dynamicStates.data(),
     };
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-    };
-
-    if (vkCreatePipelineLayout(vk.device, &pipelineLayoutInfo, nullptr, &vk.pipelineLayout) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create pipeline layout!");
-    }
-
     VkGraphicsPipelineCreateInfo pipelineInfo{
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = 2,
-        .pStages = shaderStages,
-        .pVertexInputState = &vertexInputInfo,
-        .pInputAssemblyState = &inputAssembly,
+        .stageCount = (uint)shaderStages.size(),
+        .pStages = shaderStages.data(),
+        .pVertexInputState = tsFile ? nullptr : &vertexInputInfo,
+        .pInputAssemblyState = tsFile ? nullptr : &inputAssembly,
         .pViewportState = &viewportState,
         .pRasterizationState = &rasterizer,
         .pMultisampleState = &multisampling,
+        .pDepthStencilState = &depthStencil,
         .pColorBlendState = &colorBlending,
         .pDynamicState = &dynamicState,
-        .layout = vk.pipelineLayout,
+        .layout = tsFile ? vk.meshletPipelineLayout : vk.pipelineLayout,
         .renderPass = vk.renderPass,
         .subpass = 0,
     };
 
-    if (vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &vk.graphicsPipeline) != VK_SUCCESS) {
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
     
     vkDestroyShaderModule(vk.device, vsModule, nullptr);
     vkDestroyShaderModule(vk.device, fsModule, nullptr);
+    vkDestroyShaderModule(vk.device, tsModule, nullptr);
+    return pipeline;
+}
+
+// One layout for every format: the rectangle shader ignores the dequantization push constants of the mesh shaders.
+void createGraphicsPipeline()
+{
+    VkPushConstantRange pushConstantRange{
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .size = sizeof(MeshPushConstants),
+    };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
+    };
+
+    if (vkCreatePipelineLayout(vk.device, &pipelineLayoutInfo, nullptr, &vk.pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    // Depth modes are for the mesh, the rectangle and --stream draw without depth test.
+    if (meshMode()) {
+        for (uint pass = 0; pass < DEPTH_PASS_COUNT; ++pass) {
+            vk.graphicsPipelines[pass][VERTEX_FORMAT_MESH_FULL] =
+                createPipeline("mesh_vs.spv", VERTEX_FORMAT_MESH_FULL, (DepthPass)pass);
+            vk.graphicsPipelines[pass][VERTEX_FORMAT_MESH_PACKED] =
+                createPipeline("mesh_packed_vs.spv", VERTEX_FORMAT_MESH_PACKED, (DepthPass)pass);
+        }
+    } else {
+        vk.graphicsPipelines[DEPTH_PASS_NONE][VERTEX_FORMAT_RECTANGLE] =
+            createPipeline("vertex_input_vs.spv", VERTEX_FORMAT_RECTANGLE, DEPTH_PASS_NONE);
+    }
+}
+
+/*
+--meshlets: one set for the cull, the task and the mesh shader. Only the stages the device has are named, without
+mesh shaders that is the compute cull alone.
+*/
+void createMeshletPipelines()
+{
+    vk.meshletStages = VK_SHADER_STAGE_COMPUTE_BIT;
+    if (vk.meshShader) {
+        vk.meshletStages |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+    }
+
+    // Meshlets, meshlet vertices, meshlet triangles, packed vertices, draws, draw count
+    VkDescriptorSetLayoutBinding bindings[6];
+    for (uint binding = 0; binding < 6; ++binding) {
+        bindings[binding] = {
+            .binding = binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = vk.meshletStages,
+        };
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 6,
+        .pBindings = bindings,
+    };
+
+    if (vkCreateDescriptorSetLayout(vk.device, &layoutInfo, nullptr, &vk.meshletSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+
+    VkDescriptorPoolSize poolSize{
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 6,
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &poolSize,
+    };
+
+    if (vkCreateDescriptorPool(vk.device, &poolInfo, nullptr, &vk.descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = vk.descriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &vk.meshletSetLayout,
+    };
+
+    if (vkAllocateDescriptorSets(vk.device, &allocInfo, &vk.meshletSet) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+
+    VkPushConstantRange pushConstantRange{
+        .stageFlags = vk.meshletStages,
+        .size = sizeof(MeshletPushConstants),
+    };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &vk.meshletSetLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
+    };
+
+    if (vkCreatePipelineLayout(vk.device, &pipelineLayoutInfo, nullptr, &vk.meshletPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    if (options.meshletPath == MESHLET_PATH_MESH_SHADER) {
+        vk.meshletPipeline = createPipeline("meshlet_ms.spv", VERTEX_FORMAT_MESH_PACKED, DEPTH_PASS_NONE, "meshlet_ts.spv");
+        return;
+    }
+
+    VkShaderModule csModule = spv2shaderModule("meshlet_cull_cs.spv");
+
+    VkComputePipelineCreateInfo cullPipelineInfo{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = csModule,
+            .pName = "main",
+        },
+        .layout = vk.meshletPipelineLayout,
+    };
+
+    if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &cullPipelineInfo, nullptr, &vk.meshletCullPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+
+    vkDestroyShaderModule(vk.device, csModule, nullptr);
+}
+
+void createQueryPool()
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vk.physicalDevice, &props);
+    vk.timestampPeriod = props.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo ci{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2,    // render pass begin, end
+    };
+
+    if (vkCreateQueryPool(vk.device, &ci, nullptr, &vk.timestampPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
+
+    if (!vk.pipelineStatistics) {
+        return;
+    }
+
+    VkQueryPoolCreateInfo statisticsInfo{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = 1,
+        .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+    };
+
+    if (vkCreateQueryPool(vk.device, &statisticsInfo, nullptr, &vk.statisticsPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
 }
 
 void createCommandCenter() 
@@ -727,33 +2185,57 @@ void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
 
 void createVertexBuffer()
 {
-    auto [data, size] = Geometry::getVertices();
+    const size_t size = options.streamVertices > 0 ? 
+        std::get<1>(Geometry::getStreamVertices(options.streamVertices)) : std::get<1>(Geometry::getVertices());
+    vk.vertexRingSlotSize = (size + 255) & ~VkDeviceSize(255);
 
     std::tie(vk.vertexBuffer, vk.vertexBufferMemory) = createBuffer(
-        size,
+        vk.vertexRingSlotSize * VERTEX_RING_FRAMES,
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    void* dst;
-    vkMapMemory(vk.device, vk.vertexBufferMemory, 0, size, 0, &dst);
-    memcpy(dst, data, size);  
-    vkUnmapMemory(vk.device, vk.vertexBufferMemory);
+    // Mapped for the whole run, vkFreeMemory unmaps it.
+    vkMapMemory(vk.device, vk.vertexBufferMemory, 0, VK_WHOLE_SIZE, 0, (void**)&vk.vertexRing);
 }
 
+/*
+Writes this frame's vertices into the next ring slot and points vk.vertexOffset at it.
+It runs before render() waits for the fence: the previous frame may still be drawing from the other slot, and the
+frame before it, the last reader of this slot, finished before the previous frame was submitted.
+The mapping is usually write-combined, so vertices are written in order and never read back.
+*/
 void updateVertexBuffer(float t)
 {
-    size_t size = std::get<1>(Geometry::getVertices());
+    vk.vertexRingSlot = (vk.vertexRingSlot + 1) % VERTEX_RING_FRAMES;
+    vk.vertexOffset = vk.vertexRingSlot * vk.vertexRingSlotSize;
+    float* dst = (float*)(vk.vertexRing + vk.vertexOffset);
+
+    if (options.streamVertices > 0) {
+        auto [data, size] = Geometry::getStreamVertices(options.streamVertices);
+        const float dx = 0.02f * std::cos(t * 1000.0f), dy = 0.02f * std::sin(t * 1000.0f);
+        for (size_t i = 0; i < size / sizeof(float); i += 5) {
+            dst[i + 0] = data[i + 0] + dx;
+            dst[i + 1] = data[i + 1] + dy;
+            dst[i + 2] = data[i + 2];
+            dst[i + 3] = data[i + 3];
+            dst[i + 4] = data[i + 4];
+        }
+        return;
+    }
+
+    // The rectangle drifts as before, now from the source data instead of a read-modify-write of the mapping.
+    static float translation = 0.0f;
+    translation += t;
+    auto [data, size] = Geometry::getVertices();
     uint count = (uint)size / sizeof(float);
-    void* dst;
-    vkMapMemory(vk.device, vk.vertexBufferMemory, 0, size, 0, &dst);
-    for (uint i = 0; i < count; i+=5)
-        ((float*)dst)[i] += t;
-    vkUnmapMemory(vk.device, vk.vertexBufferMemory);
+    for (uint i = 0; i < count; ++i)
+        dst[i] = data[i] + (i % 5 == 0 ? translation : 0.0f);
 }
 
 void createIndexBuffer()
 {
     auto [data, size] = Geometry::getIndices();
+    vk.indexCount = (uint)(size / sizeof(uint16_t));
 
     auto [stagingBuffer, stagingBufferMemory] = createBuffer(
         size,
@@ -776,15 +2258,280 @@ void createIndexBuffer()
     vkFreeMemory(vk.device, stagingBufferMemory, nullptr);
 }
 
-void render()
+// Device local copy of data through a staging buffer, as createIndexBuffer() does
+std::tuple<VkBuffer, VkDeviceMemory> createStaticBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    auto [stagingBuffer, stagingBufferMemory] = createBuffer(
+        size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    auto result = createBuffer(
+        size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    void* dst;
+    vkMapMemory(vk.device, stagingBufferMemory, 0, size, 0, &dst);
+    memcpy(dst, data, size);
+    vkUnmapMemory(vk.device, stagingBufferMemory);
+
+    copyBuffer(stagingBuffer, std::get<0>(result), size);
+
+    vkDestroyBuffer(vk.device, stagingBuffer, nullptr);
+    vkFreeMemory(vk.device, stagingBufferMemory, nullptr);
+    return result;
+}
+
+/*
+Both mesh formats of every drawn order, device local, so the comparisons are of vertex fetch and not of PCIe
+traffic. Indices are 16-bit whenever the mesh has at most 65536 vertices, like the rectangle's.
+*/
+void createMeshBuffers()
+{
+    const bool fits16 = meshes[MESH_ORDER_SOURCE].vertices.size() <= 65536;
+    vk.indexType = fits16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    vk.indexCount = (uint)meshes[MESH_ORDER_SOURCE].indices.size();
+
+    for (uint order = 0; order < MESH_ORDER_COUNT; ++order) {
+        if (!drawsOrder((MeshOrder)order)) {
+            continue;
+        }
+        const Mesh& mesh = meshes[order];
+        const PackedMesh& packedMesh = packedMeshes[order];
+
+        std::tie(vk.meshVertexBuffers[order][VERTEX_FORMAT_MESH_FULL], vk.meshVertexBufferMemories[order][VERTEX_FORMAT_MESH_FULL]) =
+            createStaticBuffer(mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        std::tie(vk.meshVertexBuffers[order][VERTEX_FORMAT_MESH_PACKED], vk.meshVertexBufferMemories[order][VERTEX_FORMAT_MESH_PACKED]) =
+            createStaticBuffer(packedMesh.vertices.data(), packedMesh.vertices.size() * sizeof(PackedVertex),
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);    // meshlet_ms.glsl pulls them
+
+        if (fits16) {
+            std::vector<uint16_t> indices(mesh.indices.begin(), mesh.indices.end());
+            std::tie(vk.meshIndexBuffers[order], vk.meshIndexBufferMemories[order]) =
+                createStaticBuffer(indices.data(), indices.size() * sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+        } else {
+            std::tie(vk.meshIndexBuffers[order], vk.meshIndexBufferMemories[order]) =
+                createStaticBuffer(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+        }
+    }
+}
+
+/*
+--meshlets: the meshlets of the drawn order for the task and mesh shader, the same triangles as one index buffer
+for the compute path, and its draws. The mesh shader reads the packed vertex buffer of createMeshBuffers().
+*/
+void createMeshletBuffers()
+{
+    const uint32_t count = (uint32_t)meshletMesh.meshlets.size();
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vk.physicalDevice, &props);
+    if (options.meshletPath == MESHLET_PATH_COMPUTE && count > props.limits.maxDrawIndirectCount) {
+        throw std::runtime_error("more meshlets than maxDrawIndirectCount!");
+    }
+
+    std::tie(vk.meshletBuffer, vk.meshletBufferMemory) = createStaticBuffer(
+        meshletMesh.meshlets.data(), count * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    std::tie(vk.meshletVertexBuffer, vk.meshletVertexBufferMemory) = createStaticBuffer(
+        meshletMesh.vertices.data(), meshletMesh.vertices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    std::tie(vk.meshletTriangleBuffer, vk.meshletTriangleBufferMemory) = createStaticBuffer(
+        meshletMesh.triangles.data(), meshletMesh.triangles.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    if (vk.indexType == VK_INDEX_TYPE_UINT16) {
+        std::vector<uint16_t> indices(meshletMesh.indices.begin(), meshletMesh.indices.end());
+        std::tie(vk.meshletIndexBuffer, vk.meshletIndexBufferMemory) =
+            createStaticBuffer(indices.data(), indices.size() * sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    } else {
+        std::tie(vk.meshletIndexBuffer, vk.meshletIndexBufferMemory) =
+            createStaticBuffer(meshletMesh.indices.data(), meshletMesh.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    }
+
+    std::tie(vk.drawBuffer, vk.drawBufferMemory) = createBuffer(
+        sizeof(VkDrawIndexedIndirectCommand) * count,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.drawCountBuffer, vk.drawCountBufferMemory) = createBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.visibleCountBuffer, vk.visibleCountBufferMemory) = createBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkMapMemory(vk.device, vk.visibleCountBufferMemory, 0, sizeof(uint32_t), 0, (void**)&vk.visibleCount);
+
+    VkBuffer buffers[] = {
+        vk.meshletBuffer, vk.meshletVertexBuffer, vk.meshletTriangleBuffer,
+        vk.meshVertexBuffers[drawnOrder()][VERTEX_FORMAT_MESH_PACKED], vk.drawBuffer, vk.drawCountBuffer,
+    };
+    VkDescriptorBufferInfo bufferInfos[6];
+    VkWriteDescriptorSet descriptorWrites[6];
+    for (uint binding = 0; binding < 6; ++binding) {
+        bufferInfos[binding] = {
+            .buffer = buffers[binding],
+            .range = VK_WHOLE_SIZE,
+        };
+        descriptorWrites[binding] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = vk.meshletSet,
+            .dstBinding = binding,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &bufferInfos[binding],
+        };
+    }
+
+    vkUpdateDescriptorSets(vk.device, 6, descriptorWrites, 0, nullptr);
+}
+
+// Dequantization of the order's packed mesh, which the full format ignores, the --zoom view and --layers
+MeshPushConstants meshPushConstants(MeshOrder order)
+{
+    const PackedMesh& packedMesh = packedMeshes[order];
+    MeshPushConstants result{ .view = { options.zoom, 0.0f, 0.0f, (float)options.layers } };
+    std::copy(packedMesh.scale, packedMesh.scale + 4, result.scale);
+    std::copy(packedMesh.offset, packedMesh.offset + 4, result.offset);
+    return result;
+}
+
+/*
+--meshlets, before the render pass: resets the visible count and, on the compute path, culls the meshlets into
+draws. Without drawIndirectCount every meshlet gets a draw slot and the ones past the visible stay zero.
+The task shader culls inside the render pass.
+*/
+void recordMeshletCull(VkCommandBuffer commandBuffer, MeshletPath path)
+{
+    vkCmdFillBuffer(commandBuffer, vk.drawCountBuffer, 0, sizeof(uint32_t), 0);
+    if (path == MESHLET_PATH_COMPUTE && !vk.drawIndirectCount) {
+        vkCmdFillBuffer(commandBuffer, vk.drawBuffer, 0, VK_WHOLE_SIZE, 0);
+    }
+
+    VkMemoryBarrier fillBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        path == MESHLET_PATH_MESH_SHADER ? VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+
+    if (path == MESHLET_PATH_MESH_SHADER) {
+        return;
+    }
+
+    const MeshletPushConstants pushConstants{
+        .mesh = meshPushConstants(drawnOrder()),
+        .meshletCount = (uint32_t)meshletMesh.meshlets.size(),
+    };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vk.meshletCullPipeline);
+    vkCmdBindDescriptorSets(
+        commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        vk.meshletPipelineLayout, 0,
+        1, &vk.meshletSet,
+        0, nullptr);
+    vkCmdPushConstants(commandBuffer, vk.meshletPipelineLayout, vk.meshletStages, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (pushConstants.meshletCount + 63) / 64, 1, 1);    // local_size_x 64 in meshlet_cull_cs.glsl
+
+    VkMemoryBarrier cullBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+// --meshlets, after the render pass: the visible count back to the host for the report
+void recordMeshletReadback(VkCommandBuffer commandBuffer, MeshletPath path)
+{
+    VkMemoryBarrier countBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        path == MESHLET_PATH_MESH_SHADER ? VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &countBarrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy copyRegion{ .size = sizeof(uint32_t) };
+    vkCmdCopyBuffer(commandBuffer, vk.drawCountBuffer, vk.visibleCountBuffer, 1, &copyRegion);
+
+    VkMemoryBarrier readbackBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &readbackBarrier, 0, nullptr, 0, nullptr);
+}
+
+// Accumulates the GPU time of the frame the fence just released under the format and order it was drawn with.
+void readTimestamps()
 {
-    const VkClearValue clearColor = { .color = {0.0f, 0.0f, 0.0f, 1.0f} };
+    if (!vk.timestampsPending || !meshMode()) {
+        return;     // nothing has been submitted yet, or nothing reports it
+    }
+
+    uint64_t timestamps[2];
+    if (vkGetQueryPoolResults(
+        vk.device, vk.timestampPool, 0, 2,
+        sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    const double gpuMs = (timestamps[1] - timestamps[0]) * vk.timestampPeriod * 1e-6;
+
+    uint64_t fragments = 0;
+    if (vk.pipelineStatistics) {
+        vkGetQueryPoolResults(
+            vk.device, vk.statisticsPool, 0, 1,
+            sizeof(fragments), &fragments, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+    }
+    DepthStats& depth = depthStats[vk.lastDepth];
+    depth.gpuMs += gpuMs;
+    depth.fragments += fragments;
+    ++depth.frames;
+
+    if (vk.lastPath != MESHLET_PATH_NONE) {
+        MeshletStats& stats = meshletStats[vk.lastPath];
+        stats.gpuMs += gpuMs;
+        stats.visible += *vk.visibleCount;
+        ++stats.frames;
+        return;
+    }
+
+    FormatStats& stats = formatStats[vk.lastOrder][vk.lastFormat];
+    stats.gpuMs += gpuMs;
+    ++stats.frames;
+}
+
+void render(
+    VertexFormat format, MeshOrder order = MESH_ORDER_SOURCE, MeshletPath path = MESHLET_PATH_NONE,
+    DepthMode depth = DEPTH_MODE_OFF)
+{
+    const VkClearValue clearValues[] = {
+        { .color = {0.0f, 0.0f, 0.0f, 1.0f} },
+        { .depthStencil = { .depth = 1.0f } },
+    };
     const VkViewport viewport{ .width = (float)WIDTH, .height = (float)HEIGHT, .maxDepth = 1.0f };
     const VkRect2D scissor{ .extent = {.width = WIDTH, .height = HEIGHT } };
     const VkCommandBufferBeginInfo beginInfo{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
 
     vkWaitForFences(vk.device, 1, &vk.inFlightFence, VK_TRUE, UINT64_MAX);
     vkResetFences(vk.device, 1, &vk.inFlightFence);
+    readTimestamps();
 
     uint32_t imageIndex;
     vkAcquireNextImageKHR(vk.device, vk.swapChain, UINT64_MAX, vk.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
@@ -795,30 +2542,98 @@ void render()
             throw std::runtime_error("failed to begin recording command buffer!");
         }
 
+        vkCmdResetQueryPool(vk.commandBuffer, vk.timestampPool, 0, 2);
+        vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, 0);
+
+        if (path != MESHLET_PATH_NONE) {
+            recordMeshletCull(vk.commandBuffer, path);
+        }
+
         VkRenderPassBeginInfo renderPassInfo{
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
             .renderPass = vk.renderPass,
             .framebuffer = vk.framebuffers[imageIndex],
             .renderArea = { .extent = { .width = WIDTH, .height = HEIGHT } },
-            .clearValueCount = 1,
-            .pClearValues = &clearColor,
+            .clearValueCount = 2,
+            .pClearValues = clearValues,
         };
 
+        if (vk.pipelineStatistics) {
+            vkCmdResetQueryPool(vk.commandBuffer, vk.statisticsPool, 0, 1);
+            vkCmdBeginQuery(vk.commandBuffer, vk.statisticsPool, 0, 0);
+        }
+
         vkCmdBeginRenderPass(vk.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-        {
-            vkCmdBindPipeline(vk.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk.graphicsPipeline);
+        if (path == MESHLET_PATH_MESH_SHADER) {
+            const MeshletPushConstants pushConstants{
+                .mesh = meshPushConstants(order),
+                .meshletCount = (uint32_t)meshletMesh.meshlets.size(),
+            };
+
+            vkCmdBindPipeline(vk.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk.meshletPipeline);
+            vkCmdSetViewport(vk.commandBuffer, 0, 1, &viewport);
+            vkCmdSetScissor(vk.commandBuffer, 0, 1, &scissor);
+            vkCmdBindDescriptorSets(
+                vk.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                vk.meshletPipelineLayout, 0,
+                1, &vk.meshletSet,
+                0, nullptr);
+            vkCmdPushConstants(vk.commandBuffer, vk.meshletPipelineLayout, vk.meshletStages, 0, sizeof(pushConstants), &pushConstants);
+            vk.vkCmdDrawMeshTasksEXT(vk.commandBuffer, (pushConstants.meshletCount + MESHLET_TASK_GROUP - 1) / MESHLET_TASK_GROUP, 1, 1);
+        }
+        else {
             vkCmdSetViewport(vk.commandBuffer, 0, 1, &viewport);
             vkCmdSetScissor(vk.commandBuffer, 0, 1, &scissor);
 
-            VkDeviceSize offsets[] = { 0 };
-            size_t numIndices = std::get<1>(Geometry::getIndices()) / sizeof(uint16_t);
-            vkCmdBindVertexBuffers(vk.commandBuffer, 0, 1, &vk.vertexBuffer, offsets);
-            vkCmdBindIndexBuffer(vk.commandBuffer, vk.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-            vkCmdDrawIndexed(vk.commandBuffer, (uint)numIndices, 1, 0, 0, 0);
+            if (format == VERTEX_FORMAT_RECTANGLE) {
+                VkDeviceSize offsets[] = { vk.vertexOffset };
+                vkCmdBindVertexBuffers(vk.commandBuffer, 0, 1, &vk.vertexBuffer, offsets);
+            }
+            else {
+                const MeshPushConstants pushConstants = meshPushConstants(order);
+                vkCmdPushConstants(vk.commandBuffer, vk.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+                VkDeviceSize offsets[] = { 0 };
+                vkCmdBindVertexBuffers(vk.commandBuffer, 0, 1, &vk.meshVertexBuffers[order][format], offsets);
+            }
 
+            // The same draws once per pass, the push constants and vertex buffer stay bound across pipelines of one layout.
+            for (DepthPass pass : DEPTH_MODE_PASSES[depth]) {
+                vkCmdBindPipeline(vk.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk.graphicsPipelines[pass][format]);
+
+                if (options.streamVertices > 0) {
+                    vkCmdDraw(vk.commandBuffer, options.streamVertices, 1, 0, 0);
+                }
+                else if (path == MESHLET_PATH_COMPUTE) {
+                    const uint32_t count = (uint32_t)meshletMesh.meshlets.size();
+                    vkCmdBindIndexBuffer(vk.commandBuffer, vk.meshletIndexBuffer, 0, vk.indexType);
+                    if (vk.drawIndirectCount) {
+                        vkCmdDrawIndexedIndirectCount(
+                            vk.commandBuffer, vk.drawBuffer, 0, vk.drawCountBuffer, 0,
+                            count, sizeof(VkDrawIndexedIndirectCommand));
+                    } else {
+                        vkCmdDrawIndexedIndirect(vk.commandBuffer, vk.drawBuffer, 0, count, sizeof(VkDrawIndexedIndirectCommand));
+                    }
+                }
+                else {
+                    const VkBuffer indexBuffer = format == VERTEX_FORMAT_RECTANGLE ? vk.indexBuffer : vk.meshIndexBuffers[order];
+                    vkCmdBindIndexBuffer(vk.commandBuffer, indexBuffer, 0, vk.indexType);
+                    vkCmdDrawIndexed(vk.commandBuffer, vk.indexCount, options.layers, 0, 0, 0);
+                }
+            }
         }
         vkCmdEndRenderPass(vk.commandBuffer);
 
+        if (vk.pipelineStatistics) {
+            vkCmdEndQuery(vk.commandBuffer, vk.statisticsPool, 0);
+        }
+
+        vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestampPool, 1);
+
+        if (path != MESHLET_PATH_NONE) {
+            recordMeshletReadback(vk.commandBuffer, path);
+        }
+
         if (vkEndCommandBuffer(vk.commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer!");
         }
@@ -843,6 +2658,11 @@ void render()
     if (vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, vk.inFlightFence) != VK_SUCCESS) {
         throw std::runtime_error("failed to submit draw command buffer!");
     }
+    vk.lastFormat = format;
+    vk.lastOrder = order;
+    vk.lastPath = path;
+    vk.lastDepth = depth;
+    vk.timestampsPending = true;
 
     VkPresentInfoKHR presentInfo{
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -856,27 +2676,156 @@ void render()
     vkQueuePresentKHR(vk.graphicsQueue, &presentInfo);
 }
 
-int main() 
+// Reports the CPU time of the vertex writes every STATS_REPORT_INTERVAL frames in --stream mode.
+void reportStream(double writeMs, double frameMs)
+{
+    static double totalWriteMs = 0.0;
+    static double totalFrameMs = 0.0;
+    static uint frames = 0;
+
+    totalWriteMs += writeMs;
+    totalFrameMs += frameMs;
+    if (++frames < STATS_REPORT_INTERVAL) {
+        return;
+    }
+
+    const double bytes = (double)options.streamVertices * Geometry::vertexBytesSize;
+    printf("[stream] %u vertices (%.1f MB) per frame, write %.3f ms/frame (%.2f GB/s), frame %.3f ms\n",
+        options.streamVertices, bytes / (1024.0 * 1024.0), totalWriteMs / frames,
+        bytes * frames / (totalWriteMs * 1e6), totalFrameMs / frames);
+    totalWriteMs = 0.0;
+    totalFrameMs = 0.0;
+    frames = 0;
+}
+
+/*
+Reports the GPU time of each mesh format and order, of the meshlet path and of each depth mode every
+STATS_REPORT_INTERVAL frames. Fragments per pixel is the overdraw the fragment shader paid for.
+*/
+void reportFormats()
+{
+    static uint frames = 0;
+    if (++frames < STATS_REPORT_INTERVAL) {
+        return;
+    }
+
+    const size_t vertexCount = meshes[MESH_ORDER_SOURCE].vertices.size();
+    const uint strides[VERTEX_FORMAT_COUNT] = { Geometry::vertexBytesSize, sizeof(MeshVertex), sizeof(PackedVertex) };
+    for (uint order = 0; order < MESH_ORDER_COUNT; ++order) {
+        for (uint i = VERTEX_FORMAT_MESH_FULL; i < VERTEX_FORMAT_COUNT; ++i) {
+            FormatStats& stats = formatStats[order][i];
+            if (stats.frames == 0) {
+                continue;
+            }
+
+            const double gpuMs = stats.gpuMs / stats.frames;
+            printf("[mesh] %-9s %-6s %u B/vertex, %.1f MB, gpu %.3f ms (%.2f M vertices/s)\n",
+                MESH_ORDER_NAMES[order], VERTEX_FORMAT_NAMES[i], strides[i], vertexCount * strides[i] / (1024.0 * 1024.0),
+                gpuMs, vertexCount / (gpuMs * 1e3));
+            stats = {};
+        }
+    }
+
+    for (uint i = MESHLET_PATH_COMPUTE; i < MESHLET_PATH_COUNT; ++i) {
+        MeshletStats& stats = meshletStats[i];
+        if (stats.frames == 0) {
+            continue;
+        }
+
+        printf("[meshlet] %-7s %.0f of %zu meshlets visible, gpu %.3f ms (culling included)\n",
+            MESHLET_PATH_NAMES[i], stats.visible / stats.frames, meshletMesh.meshlets.size(), stats.gpuMs / stats.frames);
+        stats = {};
+    }
+
+    for (uint i = 0; i < DEPTH_MODE_COUNT; ++i) {
+        DepthStats& stats = depthStats[i];
+        if (stats.frames == 0 || (options.depthMode == DEPTH_MODE_OFF && !options.compareDepth)) {
+            stats = {};
+            continue;
+        }
+
+        if (vk.pipelineStatistics) {
+            printf("[depth] %-7s %.2f fragments per pixel, gpu %.3f ms\n",
+                DEPTH_MODE_NAMES[i], stats.fragments / stats.frames / (WIDTH * HEIGHT), stats.gpuMs / stats.frames);
+        } else {
+            printf("[depth] %-7s gpu %.3f ms\n", DEPTH_MODE_NAMES[i], stats.gpuMs / stats.frames);
+        }
+        stats = {};
+    }
+    frames = 0;
+}
+
+int main(int argc, char* argv[]) 
 {
+    parseOptions(argc, argv);
+
+    // Offline packer: no window, no device.
+    if (!options.packPath.empty()) {
+        loadMesh();
+        writePackedMesh(options.packPath, packedMeshes[options.optimizeMesh ? MESH_ORDER_OPTIMIZED : MESH_ORDER_SOURCE]);
+        printf("[mesh] wrote %s\n", options.packPath.c_str());
+        return 0;
+    }
+    if (meshMode()) {
+        loadMesh();
+    }
+
     glfwInit();
     GLFWwindow* window = createWindow();
     createVkInstance(window);
     createVkDevice();
     createSwapChain();
+    createDepthImage();
     createRenderPass();
     createGraphicsPipeline();
+    if (options.meshletPath != MESHLET_PATH_NONE) {
+        createMeshletPipelines();
+    }
     createCommandCenter();
     createSyncObjects();
-    createVertexBuffer();
-    createIndexBuffer();
+    createQueryPool();
+    if (meshMode()) {
+        createMeshBuffers();
+        if (options.meshletPath != MESHLET_PATH_NONE) {
+            createMeshletBuffers();
+        }
+    } else {
+        createVertexBuffer();
+        createIndexBuffer();
+    }
 
     float t = 0.f;
+    auto last = std::chrono::steady_clock::now();
     while (!glfwWindowShouldClose(window)) 
     {
         glfwPollEvents();
+        if (meshMode()) {
+            // Static mesh, nothing to write. --compare-* alternate so every variant sees the same conditions.
+            static uint frame = 0;
+            const VertexFormat format = options.compareFormats
+                ? (VertexFormat)(VERTEX_FORMAT_MESH_FULL + frame % 2) : options.vertexFormat;
+            const MeshOrder order = options.compareOrders
+                ? (MeshOrder)(frame / (options.compareFormats ? 2 : 1) % 2) : drawnOrder();
+            const MeshletPath path = options.compareMeshlets && frame % 2 == 0 ? MESHLET_PATH_NONE : options.meshletPath;
+            const DepthMode depth = options.compareDepth ? (DepthMode)(frame % DEPTH_MODE_COUNT) : options.depthMode;
+            ++frame;
+            render(format, order, path, depth);
+            reportFormats();
+            continue;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
         updateVertexBuffer(t);
-        render();
+        auto written = std::chrono::steady_clock::now();
+        render(VERTEX_FORMAT_RECTANGLE);
         t += 0.00001f;
+
+        if (options.streamVertices > 0) {
+            reportStream(
+                std::chrono::duration<double, std::milli>(written - begin).count(),
+                std::chrono::duration<double, std::milli>(begin - last).count());
+        }
+        last = begin;
     }
     
     vkDeviceWaitIdle(vk.device);
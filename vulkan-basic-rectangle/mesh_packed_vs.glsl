@@ -0,0 +1,37 @@
+#version 450
+
+// R16G16B16A16_SNORM, R16G16_SNORM and R8G8B8A8_UNORM arrive already widened to float by the vertex fetch.
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNormal;
+layout(location = 2) in vec4 inColor;
+
+layout(push_constant) uniform PushConstants {
+    vec4 scale;
+    vec4 offset;
+    vec4 view;      // zoom, center x, center y, --layers
+} pc;
+
+layout(location = 0) out vec3 fragColor;
+
+// The depth prepass and the EQUAL color pass run this shader in two pipelines, both must get the same depth.
+invariant gl_Position;
+
+const vec3 lightDir = normalize(vec3(-0.4, -0.5, 0.8));
+
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+// Instance 0 is the farthest copy, so the layers arrive back to front. The height stays inside its layer's slice.
+float layerDepth(float height) {
+    return (pc.view.w - float(gl_InstanceIndex) - 0.5 + height) / pc.view.w;
+}
+
+void main() {
+    vec3 position = inPosition.xyz * pc.scale.xyz + pc.offset.xyz;
+    gl_Position = vec4((position.xy - pc.view.yz) * pc.view.x, layerDepth(position.z), 1.0);
+    fragColor = inColor.rgb * (0.2 + 0.8 * max(dot(octahedralDecode(inNormal), lightDir), 0.0));
+}
@@ -0,0 +1,29 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec3 inColor;
+
+// scale and offset are for mesh_packed_vs.glsl, view is zoom, center x, center y, --layers
+layout(push_constant) uniform PushConstants {
+    vec4 scale;
+    vec4 offset;
+    vec4 view;
+} pc;
+
+layout(location = 0) out vec3 fragColor;
+
+// The depth prepass and the EQUAL color pass run this shader in two pipelines, both must get the same depth.
+invariant gl_Position;
+
+const vec3 lightDir = normalize(vec3(-0.4, -0.5, 0.8));
+
+// Instance 0 is the farthest copy, so the layers arrive back to front. The height stays inside its layer's slice.
+float layerDepth(float height) {
+    return (pc.view.w - float(gl_InstanceIndex) - 0.5 + height) / pc.view.w;
+}
+
+void main() {
+    gl_Position = vec4((inPosition.xy - pc.view.yz) * pc.view.x, layerDepth(inPosition.z), 1.0);
+    fragColor = inColor * (0.2 + 0.8 * max(dot(inNormal, lightDir), 0.0));
+}
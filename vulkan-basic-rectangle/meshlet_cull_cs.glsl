@@ -0,0 +1,64 @@
+#version 450
+
+// One meshlet per invocation, the visible ones are compacted into indexed indirect draws.
+layout(local_size_x = 64) in;
+
+struct Meshlet {
+    vec3 center;
+    float radius;
+    vec3 coneAxis;
+    float coneCutoff;
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+};
+
+// VkDrawIndexedIndirectCommand
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Meshlets {
+    Meshlet meshlets[];
+};
+
+layout(std430, binding = 4) writeonly buffer Draws {
+    DrawCommand draws[];
+};
+
+layout(std430, binding = 5) buffer DrawCount {
+    uint drawCount;
+};
+
+layout(push_constant) uniform PushConstants {
+    vec4 scale;
+    vec4 offset;
+    vec4 view;          // zoom, center x, center y
+    uint meshletCount;
+} pc;
+
+// Same as visible() in meshlet_ts.glsl
+bool visible(Meshlet meshlet) {
+    // Orthographic, so every triangle is seen from the same direction.
+    if (dot(meshlet.coneAxis, vec3(0.0, 0.0, -1.0)) > meshlet.coneCutoff) {
+        return false;
+    }
+    vec2 center = (meshlet.center.xy - pc.view.yz) * pc.view.x;
+    float radius = meshlet.radius * pc.view.x;
+    return all(lessThanEqual(abs(center), vec2(1.0 + radius)));
+}
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= pc.meshletCount || !visible(meshlets[index])) {
+        return;
+    }
+
+    Meshlet meshlet = meshlets[index];
+    draws[atomicAdd(drawCount, 1)] = DrawCommand(meshlet.triangleCount * 3, 1, meshlet.triangleOffset * 3, 0, 0);
+}
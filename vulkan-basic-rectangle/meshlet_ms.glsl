@@ -0,0 +1,77 @@
+#version 460
+#extension GL_EXT_mesh_shader : require
+
+layout(local_size_x = 32) in;
+layout(triangles, max_vertices = 64, max_primitives = 124) out;
+
+struct Meshlet {
+    vec3 center;
+    float radius;
+    vec3 coneAxis;
+    float coneCutoff;
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+};
+
+layout(std430, binding = 0) readonly buffer Meshlets {
+    Meshlet meshlets[];
+};
+
+layout(std430, binding = 1) readonly buffer MeshletVertices {
+    uint meshletVertices[];
+};
+
+// Three 8 bit meshlet vertex indices each
+layout(std430, binding = 2) readonly buffer MeshletTriangles {
+    uint meshletTriangles[];
+};
+
+// PackedVertex: position xy, position zw, normal (R16G16_SNORM), color (R8G8B8A8_UNORM)
+layout(std430, binding = 3) readonly buffer Vertices {
+    uvec4 vertices[];
+};
+
+layout(push_constant) uniform PushConstants {
+    vec4 scale;
+    vec4 offset;
+    vec4 view;          // zoom, center x, center y
+    uint meshletCount;
+} pc;
+
+struct Payload {
+    uint meshletIndices[32];
+};
+
+taskPayloadSharedEXT Payload payload;
+
+layout(location = 0) out vec3 fragColor[];
+
+const vec3 lightDir = normalize(vec3(-0.4, -0.5, 0.8));
+
+// Same as octahedralDecode() in mesh_packed_vs.glsl
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+void main() {
+    Meshlet meshlet = meshlets[payload.meshletIndices[gl_WorkGroupID.x]];
+    SetMeshOutputsEXT(meshlet.vertexCount, meshlet.triangleCount);
+
+    // No vertex fetch here: unpack what the R16G16B16A16_SNORM, R16G16_SNORM and R8G8B8A8_UNORM attributes would give.
+    for (uint i = gl_LocalInvocationIndex; i < meshlet.vertexCount; i += 32) {
+        uvec4 v = vertices[meshletVertices[meshlet.vertexOffset + i]];
+        vec3 position = vec3(unpackSnorm2x16(v.x), unpackSnorm2x16(v.y).x) * pc.scale.xyz + pc.offset.xyz;
+        gl_MeshVerticesEXT[i].gl_Position = vec4((position.xy - pc.view.yz) * pc.view.x, 0.5, 1.0);
+        fragColor[i] = unpackUnorm4x8(v.w).rgb * (0.2 + 0.8 * max(dot(octahedralDecode(unpackSnorm2x16(v.z)), lightDir), 0.0));
+    }
+
+    for (uint i = gl_LocalInvocationIndex; i < meshlet.triangleCount; i += 32) {
+        uint t = meshletTriangles[meshlet.triangleOffset + i];
+        gl_PrimitiveTriangleIndicesEXT[i] = uvec3(t & 0xff, (t >> 8) & 0xff, t >> 16);
+    }
+}
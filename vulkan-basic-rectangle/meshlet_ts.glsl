@@ -0,0 +1,68 @@
+#version 460
+#extension GL_EXT_mesh_shader : require
+
+// MESHLET_TASK_GROUP meshlets per workgroup, one mesh shader workgroup for each that survives culling.
+layout(local_size_x = 32) in;
+
+struct Meshlet {
+    vec3 center;
+    float radius;
+    vec3 coneAxis;
+    float coneCutoff;
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+};
+
+layout(std430, binding = 0) readonly buffer Meshlets {
+    Meshlet meshlets[];
+};
+
+layout(std430, binding = 5) buffer DrawCount {
+    uint drawCount;     // visible meshlets, read back for the report
+};
+
+layout(push_constant) uniform PushConstants {
+    vec4 scale;
+    vec4 offset;
+    vec4 view;          // zoom, center x, center y
+    uint meshletCount;
+} pc;
+
+struct Payload {
+    uint meshletIndices[32];
+};
+
+taskPayloadSharedEXT Payload payload;
+
+shared uint visibleCount;
+
+// Same as visible() in meshlet_cull_cs.glsl
+bool visible(Meshlet meshlet) {
+    // Orthographic, so every triangle is seen from the same direction.
+    if (dot(meshlet.coneAxis, vec3(0.0, 0.0, -1.0)) > meshlet.coneCutoff) {
+        return false;
+    }
+    vec2 center = (meshlet.center.xy - pc.view.yz) * pc.view.x;
+    float radius = meshlet.radius * pc.view.x;
+    return all(lessThanEqual(abs(center), vec2(1.0 + radius)));
+}
+
+void main() {
+    if (gl_LocalInvocationIndex == 0) {
+        visibleCount = 0;
+    }
+    barrier();
+
+    uint index = gl_GlobalInvocationID.x;
+    if (index < pc.meshletCount && visible(meshlets[index])) {
+        payload.meshletIndices[atomicAdd(visibleCount, 1)] = index;
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0) {
+        atomicAdd(drawCount, visibleCount);
+    }
+    EmitMeshTasksEXT(visibleCount, 1, 1);
+}
@@ -52,8 +52,6 @@ struct Global {
     VkSemaphore renderFinishedSemaphore;
     VkFence graphicsFence;
 
-    VkBuffer uniformBuffer;
-    VkDeviceMemory uniformBufferMemory;
     VkBuffer storageBuffer;
     VkDeviceMemory storageBufferMemory;
 
@@ -72,8 +70,6 @@ struct Global {
         vkDestroyFence(device, computeFence, nullptr);
         vkDestroyPipeline(device, computePipeline, nullptr);
 
-        vkDestroyBuffer(device, uniformBuffer, nullptr);
-        vkFreeMemory(device, uniformBufferMemory, nullptr);
         vkDestroyBuffer(device, storageBuffer, nullptr);
         vkFreeMemory(device, storageBufferMemory, nullptr);
 
@@ -176,6 +172,11 @@ public:
 };
 
 
+// Must match the push_constant block in shader.comp.
+struct ComputePushConstants {
+    float deltaTime;
+};
+
 struct Particle {
     float position[2];
     float velocity[2];
@@ -545,12 +546,6 @@ void createDescriptorRelated()
     // Create Descriptor Set Layout
     {   
         VkDescriptorSetLayoutBinding bindings[] = {
-            {
-                .binding = 0,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .descriptorCount = 1,
-                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-            },
             {
                 .binding = 1,
                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
@@ -573,10 +568,6 @@ void createDescriptorRelated()
     // Create Descriptor Pool
     {
         VkDescriptorPoolSize poolSizes[] = {
-            {
-                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .descriptorCount = 1,
-            },
             {
                 .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                 .descriptorCount = 1,
@@ -610,11 +601,21 @@ void createDescriptorRelated()
     }
 
     // Create Pipeline Layout
+    // deltaTime is a single float that changes every dispatch, so it travels as a push constant
+    // instead of through a host-visible UBO and a descriptor binding.
     {
+        VkPushConstantRange pushConstantRange{
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(ComputePushConstants),
+        };
+
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             .setLayoutCount = 1,
             .pSetLayouts = &vk.descriptorSetLayout,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &pushConstantRange,
         };
 
         if (vkCreatePipelineLayout(vk.device, &pipelineLayoutInfo, nullptr, &vk.computeLayout) != VK_SUCCESS) {
@@ -870,32 +871,6 @@ void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
 
 void createBuffers() 
 {
-    // Uniform buffer for deltaTime
-    {
-        std::tie(vk.uniformBuffer, vk.uniformBufferMemory) = createBuffer(
-            sizeof(float),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        // Write descriptor set
-        {
-            VkDescriptorBufferInfo bufferInfo{
-                .buffer = vk.uniformBuffer,
-                .range = VK_WHOLE_SIZE,
-            };
-
-            VkWriteDescriptorSet descriptorWrite{
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = vk.descriptorSet,
-                .dstBinding = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .pBufferInfo = &bufferInfo,
-            };
-            vkUpdateDescriptorSets(vk.device, 1, &descriptorWrite, 0, nullptr);
-        }
-    }
-
     // Storage Buffer for particle info
     {
         VkDeviceSize storageBufferSize = sizeof(Particle) * PARTICLE_COUNT;
@@ -963,16 +938,6 @@ void createBuffers()
     }
 }
 
-void updateBuffers(float lastFrameTime)
-{
-    static float* ubo_address = nullptr;
-    if (!ubo_address) {
-        vkMapMemory(vk.device, vk.uniformBufferMemory, 0, sizeof(float), 0, (void**)&ubo_address);
-    }
-
-    *ubo_address = lastFrameTime * 2.0f;
-}
-
 void render(float lastFrameTime)
 {
     const VkCommandBufferBeginInfo beginInfo{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
@@ -981,8 +946,6 @@ void render(float lastFrameTime)
     {
         vkWaitForFences(vk.device, 1, &vk.computeFence, VK_TRUE, UINT64_MAX);
         vkResetFences(vk.device, 1, &vk.computeFence);
-        
-        updateBuffers(lastFrameTime);
 
         vkResetCommandBuffer(vk.computeCommandBuffer, /*VkCommandBufferResetFlagBits*/ 0);
         {
@@ -995,6 +958,11 @@ void render(float lastFrameTime)
                 vk.computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
                 vk.computeLayout, 0, 1, &vk.descriptorSet, 
                 0, nullptr);
+
+            ComputePushConstants pushConstants{ .deltaTime = lastFrameTime * 2.0f };
+            vkCmdPushConstants(
+                vk.computeCommandBuffer, vk.computeLayout, 
+                VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
             vkCmdDispatch(vk.computeCommandBuffer, PARTICLE_COUNT / 256, 1, 1);
 
             if (vkEndCommandBuffer(vk.computeCommandBuffer) != VK_SUCCESS) {
@@ -6,13 +6,27 @@
 #include <tuple>
 #include <bitset>
 #include <span>
+#include <string>
+#include <algorithm>
+#include <type_traits>
+#include <cmath>
+#include <random>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <limits>
 #include "shader_module.h"
 
 typedef unsigned int uint;
 
 const uint32_t WIDTH = 1200;
 const uint32_t HEIGHT = 800;
-const uint32_t SHADER_GROUP_HANDLE_SIZE = 32;
+const uint32_t MAX_PATH_DEPTH = 16;
+const uint32_t STATS_REPORT_INTERVAL = 120;     // frames
+const uint32_t MAX_PROCEDURAL_PRIMITIVES = 1 << 20;
+const float MIN_RENDER_SCALE = 0.25f;
+const uint32_t CAMERA_SLOTS = 2;                // the frame in flight reads one, the next frame is written to the other
+const uint32_t CAMERA_PATH_FRAMES = 600;        // one loop of the scripted camera path
 
 #ifdef NDEBUG
     const bool ON_DEBUG = false;
@@ -21,6 +35,183 @@ const uint32_t SHADER_GROUP_HANDLE_SIZE = 32;
 #endif
 
 
+enum SbtRegion : uint {
+    SBT_RAYGEN,
+    SBT_MISS,
+    SBT_HIT,
+    SBT_CALLABLE,
+    SBT_REGION_COUNT,
+};
+
+/*
+Shader binding table with any number of raygen, miss, hit and callable records.
+Each record is a shader group handle followed by an optional typed payload (read as shaderRecordEXT).
+Strides and alignments come from VkPhysicalDeviceRayTracingPipelinePropertiesKHR at build(),
+and the table lives in device local memory filled through a staging buffer.
+update() patches a single record in place; the patch is recorded by flush() into the next frame.
+*/
+class ShaderBindingTable {
+public:
+    template <typename T>
+    uint add(SbtRegion region, uint shaderGroup, const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return addRecord(region, shaderGroup, &data, sizeof(T));
+    }
+
+    uint add(SbtRegion region, uint shaderGroup) {
+        return addRecord(region, shaderGroup, nullptr, 0);
+    }
+
+    template <typename T>
+    void update(SbtRegion region, uint index, const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        updateRecord(region, index, &data, sizeof(T));
+    }
+
+    template <typename T>
+    T get(SbtRegion region, uint index) const {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T data;
+        memcpy(&data, records[region].at(index).data.data(), sizeof(T));
+        return data;
+    }
+
+    uint count(SbtRegion region) const {
+        return (uint)records[region].size();
+    }
+
+    // For shaders that read the records as plain data through a storage buffer descriptor
+    VkDescriptorBufferInfo storageBufferInfo() const {
+        return { buffer, 0, VK_WHOLE_SIZE };
+    }
+
+    VkDeviceSize recordDataOffset(SbtRegion region, uint index) const {
+        return addressOffset + offsets[region] + index * strides[region] + handleSize;
+    }
+
+    VkDeviceSize stride(SbtRegion region) const {
+        return strides[region];
+    }
+
+    void build(VkPipeline pipeline);
+    bool flush(VkCommandBuffer commandBuffer);
+    VkStridedDeviceAddressRegionKHR region(SbtRegion region) const;
+    VkStridedDeviceAddressRegionKHR raygenRegion(uint index) const;
+    void destroy(VkDevice device);
+
+private:
+    struct Record {
+        uint shaderGroup;
+        std::vector<uint8_t> data;
+    };
+
+    struct Patch {
+        VkDeviceSize offset;
+        std::vector<uint8_t> data;
+    };
+
+    uint addRecord(SbtRegion region, uint shaderGroup, const void* data, size_t size);
+    void updateRecord(SbtRegion region, uint index, const void* data, size_t size);
+
+    std::vector<Record> records[SBT_REGION_COUNT];
+    std::vector<Patch> patches;
+
+    VkDeviceSize offsets[SBT_REGION_COUNT] = {};    // from address
+    VkDeviceSize strides[SBT_REGION_COUNT] = {};
+    uint32_t handleSize = 0;
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceAddress address = 0;                    // buffer address rounded up to shaderGroupBaseAlignment
+    VkDeviceSize addressOffset = 0;                 // address - buffer address
+};
+
+enum TraceMode : uint {
+    TRACE_PIPELINE,         // vkCmdTraceRaysKHR with raygen/miss/chit through the SBT
+    TRACE_RAY_QUERY,        // compute shader with rayQueryEXT, no SBT indirection
+    TRACE_MODE_COUNT,
+};
+
+const char* traceModeNames[TRACE_MODE_COUNT] = { "pipeline", "ray query" };
+
+// Per frame A/B variants, timings are kept per combination
+enum FrameVariant : uint {
+    VARIANT_RAY_QUERY = 1 << 0,
+    VARIANT_ALPHA_TEST = 1 << 1,
+    VARIANT_TESSELLATED = 1 << 2,   // triangle meshes instead of the AABB shapes
+    VARIANT_WAVEFRONT = 1 << 3,     // path tracing one bounce per dispatch, see wavefront_src
+    VARIANT_COUNT = 1 << 4,
+};
+
+enum WavefrontStage : uint {    // WAVEFRONT_STAGE of wavefront_src, one compute pipeline each
+    WAVEFRONT_GENERATE,
+    WAVEFRONT_TRACE,
+    WAVEFRONT_SCAN,
+    WAVEFRONT_SCATTER,
+    WAVEFRONT_RESOLVE,
+    WAVEFRONT_STAGE_COUNT,
+};
+
+enum DenoisePass : uint {       // DENOISE_PASS of denoise_src, one compute pipeline each
+    DENOISE_VARIANCE,
+    DENOISE_ATROUS_B_TO_A,      // the a-trous iterations ping-pong between the two illumination images
+    DENOISE_ATROUS_A_TO_B,
+    DENOISE_MODULATE_A,
+    DENOISE_MODULATE_B,
+    DENOISE_PASS_COUNT,
+};
+
+enum DenoiseImage : uint {      // bindings 11 to 14
+    DENOISE_ILLUMINATION_A,     // written by the trace, radiance divided by the primary albedo
+    DENOISE_ILLUMINATION_B,
+    DENOISE_NORMAL_DEPTH,       // primary hit normal and distance
+    DENOISE_ALBEDO,
+    DENOISE_IMAGE_COUNT,
+};
+
+const uint MAX_DENOISE_ITERATIONS = 6;     // step width 1 << 5 = 32 pixels
+
+const uint32_t WAVEFRONT_SORT_BUCKETS = 4096;   // SORT_BUCKETS in wavefront_src
+const VkDeviceSize WAVEFRONT_PATH_STATE_SIZE = 64;  // sizeof(PathState) in wavefront_src
+
+// Layout of the RayStats buffer (binding 4)
+struct RayStats {
+    uint32_t anyHitCount;
+    uint32_t rayCounts[MAX_PATH_DEPTH];
+};
+
+const uint32_t MAX_BINDLESS_TEXTURES = 256;     // descriptor count of textures[] (set 1, binding 2)
+const uint32_t MAX_BINDLESS_MATERIALS = 256;
+
+// Vertex of the quad BLAS. The BLAS reads the position, the hit shaders the whole vertex (Vertex in bindless_src).
+struct QuadVertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+
+// Set 1, binding 0: one entry per BLAS geometry, found at instanceCustomIndex + geometryIndex
+struct GeometryData {
+    VkDeviceAddress vertexAddress;      // QuadVertex[]
+    VkDeviceAddress indexAddress;       // uint32_t[], three per triangle
+    uint32_t materialIndex;
+    uint32_t pad0;
+};
+static_assert(sizeof(GeometryData) == 24, "GeometryData must match the std430 layout in bindless_src");
+
+// Set 1, binding 1
+struct Material {
+    float baseColor[3];
+    int32_t textureIndex;               // into textures[], -1 for none
+};
+
+struct BindlessTexture {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+};
+
+
 struct Global {
     PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR;
     PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR;
@@ -28,9 +219,16 @@ struct Global {
     PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR;
     PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR;
     PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
+    PFN_vkCmdBuildAccelerationStructuresIndirectKHR vkCmdBuildAccelerationStructuresIndirectKHR;
     PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR;
 	PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR;
     PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
+    PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructuresKHR;
+    PFN_vkCreateDeferredOperationKHR vkCreateDeferredOperationKHR;
+    PFN_vkDestroyDeferredOperationKHR vkDestroyDeferredOperationKHR;
+    PFN_vkGetDeferredOperationMaxConcurrencyKHR vkGetDeferredOperationMaxConcurrencyKHR;
+    PFN_vkDeferredOperationJoinKHR vkDeferredOperationJoinKHR;
+    PFN_vkGetDeferredOperationResultKHR vkGetDeferredOperationResultKHR;
 
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR  rtProperties = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
     
@@ -62,54 +260,251 @@ struct Global {
     VkAccelerationStructureKHR blas;
     VkDeviceAddress blasAddress;
 
+    VkBuffer aabbBlasBuffer;
+    VkDeviceMemory aabbBlasBufferMem;
+    VkAccelerationStructureKHR aabbBlas;
+    VkDeviceAddress aabbBlasAddress;
+
+    VkBuffer meshBlasBuffer;
+    VkDeviceMemory meshBlasBufferMem;
+    VkAccelerationStructureKHR meshBlas;
+    VkDeviceAddress meshBlasAddress;
+
+    VkBuffer proceduralBuffer;      // ProceduralScene, binding 7
+    VkDeviceMemory proceduralBufferMem;
+
+    VkBuffer particleBuffer;        // simulated in place, also the AABB build input (binding 8)
+    VkDeviceMemory particleBufferMem;
+    VkBuffer particleBlasBuffer;
+    VkDeviceMemory particleBlasBufferMem;
+    VkAccelerationStructureKHR particleBlas;
+    VkDeviceAddress particleBlasAddress;
+    VkBuffer particleScratchBuffer;
+    VkDeviceMemory particleScratchBufferMem;
+    uint32_t particleCapacity;      // particles in the buffer, all of them are simulated
+    uint32_t activeParticles;       // particles in the BLAS
+    uint32_t particleBlasCount = 0; // primitive count of the last particle BLAS build
+    bool lastParticleRefit = false;
+
     VkBuffer tlasBuffer;
     VkDeviceMemory tlasBufferMem;
     VkAccelerationStructureKHR tlas;
+    VkBuffer tlasInstanceBuffer;
+    VkDeviceMemory tlasInstanceBufferMem;
+    VkBuffer tlasScratchBuffer;
+    VkDeviceMemory tlasScratchBufferMem;
+    uint32_t tlasInstanceCount;     // instances in the TLAS build, scene + active generated
+    uint32_t tlasInstanceCapacity;  // instances the buffers and the TLAS are sized for
+    uint32_t sceneInstanceCount;    // sceneInstances, the generated instances follow them
+    uint32_t generatedInstances = 0;
+    VkAabbPositionsKHR blasBounds[BLAS_KIND_COUNT];     // object space, for the instance culling
+    bool tlasCulled = false;        // the TLAS holds only the instances visible when it was built
+
+    VkBuffer instanceBoundsBuffer;  // world space AABB per instance, binding 16
+    VkDeviceMemory instanceBoundsBufferMem;
+    VkBuffer culledInstanceBuffer;  // build range + visible instances, binding 17
+    VkDeviceMemory culledInstanceBufferMem;
+    VkBuffer cullStatsBuffer;       // visible instance count copied back every frame
+    VkDeviceMemory cullStatsBufferMem;
+    uint32_t* culledInstanceCount;  // persistently mapped
+    VkBuffer instanceTemplateBuffer;    // BLAS library of the instance generator, binding 18
+    VkDeviceMemory instanceTemplateBufferMem;
+    uint32_t instanceTemplateCount;
 
     VkImage outImage;
     VkDeviceMemory outImageMem;
     VkImageView outImageView;
 
-    VkBuffer uniformBuffer;
+    VkImage accumImage;
+    VkDeviceMemory accumImageMem;
+    VkImageView accumImageView;
+    uint accumFrameCount = 0;   // frames accumulated since the last reset
+
+    VkImage upscaleImage;       // full size, outImage is blitted into it below render scale 1
+    VkDeviceMemory upscaleImageMem;
+    float renderScale = 1.0f;
+    uint32_t renderWidth = WIDTH;   // traced top left region of outImage and accumImage
+    uint32_t renderHeight = HEIGHT;
+
+    std::vector<VkCommandBuffer> tileCommandBuffers;    // extra submits of a tiled frame
+
+    VkImage denoiseImages[DENOISE_IMAGE_COUNT];     // RGBA16F, see DenoiseImage
+    VkDeviceMemory denoiseImageMems[DENOISE_IMAGE_COUNT];
+    VkImageView denoiseImageViews[DENOISE_IMAGE_COUNT];
+
+    VkBuffer uniformBuffer;         // CAMERA_SLOTS cameras, binding 2 is a dynamic UBO reading one of them
     VkDeviceMemory uniformBufferMem;
+    uint8_t* cameraSlots;           // persistently mapped
+    VkDeviceSize cameraSlotSize;    // CameraProperties rounded up to minUniformBufferOffsetAlignment
+    uint32_t cameraSlot = 0;
+    uint32_t cameraOffset = 0;      // dynamic offset of binding 2 for the frame being recorded
+
+    VkImage alphaImage;
+    VkDeviceMemory alphaImageMem;
+    VkImageView alphaImageView;
+    VkSampler alphaSampler;
+
+    VkBuffer quadVertexBuffer;      // QuadVertex, kept after the BLAS build for the hit shaders
+    VkDeviceMemory quadVertexBufferMem;
+    VkBuffer quadIndexBuffer;
+    VkDeviceMemory quadIndexBufferMem;
+
+    VkBuffer geometryBuffer;        // GeometryData, set 1 binding 0
+    VkDeviceMemory geometryBufferMem;
+    GeometryData* geometries;       // persistently mapped
+    uint32_t geometryCount = 0;
+    VkBuffer materialBuffer;        // Material, set 1 binding 1
+    VkDeviceMemory materialBufferMem;
+    Material* materials;            // persistently mapped
+    uint32_t materialCount = 0;
+    std::vector<BindlessTexture> textures;  // set 1 binding 2, sampled with alphaSampler
+    bool materialRequested = false; // N key, served by render() once the previous frame has finished
+
+    VkBuffer rayStatsBuffer;
+    VkDeviceMemory rayStatsBufferMem;
+    RayStats* rayStats;         // persistently mapped
+
+    VkBuffer pathStateBuffer;   // wavefront_src PathStates, binding 9
+    VkDeviceMemory pathStateBufferMem;
+    VkBuffer raySortBuffer;     // wavefront_src RaySort, binding 10
+    VkDeviceMemory raySortBufferMem;
+
+    VkQueryPool timestampPool;
+    float timestampPeriod;      // nanoseconds per tick
+    uint frameSeed = 0;
 
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
     VkPipeline pipeline;
+    VkPipeline rayQueryPipeline = VK_NULL_HANDLE;
+    VkPipeline particlePipeline;
+    VkPipeline wavefrontPipelines[WAVEFRONT_STAGE_COUNT] = {};
+    VkPipeline denoisePipelines[DENOISE_PASS_COUNT] = {};
+    VkPipeline cullPipeline;
+    VkPipeline instanceGenPipeline;
+    bool rayQuerySupported = false;
+    bool hostBuildSupported = false;    // accelerationStructureHostCommands
+    bool indirectBuildSupported = false;    // accelerationStructureIndirectBuild
+    uint lastVariant = 0;       // FrameVariant bits of the frame whose timestamps are read next
+    bool lastDenoised = false;  // whether that frame ran the denoiser
+    bool lastTlasBuilt = false; // whether that frame rebuilt the TLAS
+    bool lastCulled = false;    // and whether it culled the instances first
 
     VkDescriptorPool descriptorPool;
     VkDescriptorSet descriptorSet;
 
-    VkBuffer sbtBuffer;
-    VkDeviceMemory sbtBufferMem;
-    VkStridedDeviceAddressRegionKHR rgenSbt{};
-    VkStridedDeviceAddressRegionKHR missSbt{};
-    VkStridedDeviceAddressRegionKHR hitgSbt{};
+    VkDescriptorSetLayout bindlessSetLayout;    // set 1, update after bind
+    VkDescriptorPool bindlessPool;
+    VkDescriptorSet bindlessSet;
+
+    ShaderBindingTable sbt;
     
     ~Global() {
         vkDestroyBuffer(device, tlasBuffer, nullptr);
         vkFreeMemory(device, tlasBufferMem, nullptr);
         vkDestroyAccelerationStructureKHR(device, tlas, nullptr);
+        vkDestroyBuffer(device, tlasInstanceBuffer, nullptr);
+        vkFreeMemory(device, tlasInstanceBufferMem, nullptr);
+        vkDestroyBuffer(device, tlasScratchBuffer, nullptr);
+        vkFreeMemory(device, tlasScratchBufferMem, nullptr);
+        vkDestroyBuffer(device, instanceBoundsBuffer, nullptr);
+        vkFreeMemory(device, instanceBoundsBufferMem, nullptr);
+        vkDestroyBuffer(device, culledInstanceBuffer, nullptr);
+        vkFreeMemory(device, culledInstanceBufferMem, nullptr);
+        vkDestroyBuffer(device, cullStatsBuffer, nullptr);
+        vkFreeMemory(device, cullStatsBufferMem, nullptr);
+        vkDestroyBuffer(device, instanceTemplateBuffer, nullptr);
+        vkFreeMemory(device, instanceTemplateBufferMem, nullptr);
 
         vkDestroyBuffer(device, blasBuffer, nullptr);
         vkFreeMemory(device, blasBufferMem, nullptr);
         vkDestroyAccelerationStructureKHR(device, blas, nullptr);
 
+        vkDestroyBuffer(device, aabbBlasBuffer, nullptr);
+        vkFreeMemory(device, aabbBlasBufferMem, nullptr);
+        vkDestroyAccelerationStructureKHR(device, aabbBlas, nullptr);
+
+        vkDestroyBuffer(device, meshBlasBuffer, nullptr);
+        vkFreeMemory(device, meshBlasBufferMem, nullptr);
+        vkDestroyAccelerationStructureKHR(device, meshBlas, nullptr);
+
+        vkDestroyBuffer(device, proceduralBuffer, nullptr);
+        vkFreeMemory(device, proceduralBufferMem, nullptr);
+
+        vkDestroyAccelerationStructureKHR(device, particleBlas, nullptr);
+        vkDestroyBuffer(device, particleBlasBuffer, nullptr);
+        vkFreeMemory(device, particleBlasBufferMem, nullptr);
+        vkDestroyBuffer(device, particleScratchBuffer, nullptr);
+        vkFreeMemory(device, particleScratchBufferMem, nullptr);
+        vkDestroyBuffer(device, particleBuffer, nullptr);
+        vkFreeMemory(device, particleBufferMem, nullptr);
+
         vkDestroyImageView(device, outImageView, nullptr);
         vkDestroyImage(device, outImage, nullptr);
         vkFreeMemory(device, outImageMem, nullptr);
 
+        vkDestroyImageView(device, accumImageView, nullptr);
+        vkDestroyImage(device, accumImage, nullptr);
+        vkFreeMemory(device, accumImageMem, nullptr);
+
+        vkDestroyImage(device, upscaleImage, nullptr);
+        vkFreeMemory(device, upscaleImageMem, nullptr);
+
+        for (uint i = 0; i < DENOISE_IMAGE_COUNT; ++i) {
+            vkDestroyImageView(device, denoiseImageViews[i], nullptr);
+            vkDestroyImage(device, denoiseImages[i], nullptr);
+            vkFreeMemory(device, denoiseImageMems[i], nullptr);
+        }
+
         vkDestroyBuffer(device, uniformBuffer, nullptr);
         vkFreeMemory(device, uniformBufferMem, nullptr);
 
-        vkDestroyBuffer(device, sbtBuffer, nullptr);
-        vkFreeMemory(device, sbtBufferMem, nullptr);
+        vkDestroySampler(device, alphaSampler, nullptr);
+        vkDestroyImageView(device, alphaImageView, nullptr);
+        vkDestroyImage(device, alphaImage, nullptr);
+        vkFreeMemory(device, alphaImageMem, nullptr);
+
+        vkDestroyBuffer(device, quadVertexBuffer, nullptr);
+        vkFreeMemory(device, quadVertexBufferMem, nullptr);
+        vkDestroyBuffer(device, quadIndexBuffer, nullptr);
+        vkFreeMemory(device, quadIndexBufferMem, nullptr);
+        vkDestroyBuffer(device, geometryBuffer, nullptr);
+        vkFreeMemory(device, geometryBufferMem, nullptr);
+        vkDestroyBuffer(device, materialBuffer, nullptr);
+        vkFreeMemory(device, materialBufferMem, nullptr);
+        for (auto& texture : textures) {
+            vkDestroyImageView(device, texture.view, nullptr);
+            vkDestroyImage(device, texture.image, nullptr);
+            vkFreeMemory(device, texture.memory, nullptr);
+        }
+
+        vkDestroyBuffer(device, rayStatsBuffer, nullptr);
+        vkFreeMemory(device, rayStatsBufferMem, nullptr);
+        vkDestroyBuffer(device, pathStateBuffer, nullptr);
+        vkFreeMemory(device, pathStateBufferMem, nullptr);
+        vkDestroyBuffer(device, raySortBuffer, nullptr);
+        vkFreeMemory(device, raySortBufferMem, nullptr);
+        vkDestroyQueryPool(device, timestampPool, nullptr);
+
+        sbt.destroy(device);
 
         vkDestroyPipeline(device, pipeline, nullptr);
+        vkDestroyPipeline(device, rayQueryPipeline, nullptr);
+        vkDestroyPipeline(device, particlePipeline, nullptr);
+        for (auto wavefrontPipeline : wavefrontPipelines) {
+            vkDestroyPipeline(device, wavefrontPipeline, nullptr);
+        }
+        for (auto denoisePipeline : denoisePipelines) {
+            vkDestroyPipeline(device, denoisePipeline, nullptr);
+        }
+        vkDestroyPipeline(device, cullPipeline, nullptr);
+        vkDestroyPipeline(device, instanceGenPipeline, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
         
         vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, bindlessSetLayout, nullptr);
+        vkDestroyDescriptorPool(device, bindlessPool, nullptr);
 
 
         vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
@@ -132,6 +527,45 @@ struct Global {
     }
 } vk;
 
+struct Options {
+    bool progressive = false;       // jittered multi-frame accumulation + tonemapping
+    uint samplesPerFrame = 1;       // samples per pixel per frame in progressive mode
+    float exposure = 1.0f;
+    bool pathTrace = false;         // multi-bounce diffuse path tracing, bounce loop in raygen
+    uint maxDepth = 8;
+    uint rrStartDepth = 3;
+    bool stats = false;             // count rays per bounce depth and report rays per second
+    TraceMode traceMode = TRACE_PIPELINE;
+    bool compareModes = false;      // alternate pipeline / ray query every frame and report both timings
+    bool alphaTest = false;         // run any-hit alpha testing on non-opaque geometry
+    bool compareAlpha = false;      // alternate alpha testing on / off every frame and report both timings
+    bool shadows = false;           // sun light with terminate-on-first-hit shadow rays
+    uint primitiveCount = 48;       // analytic spheres, boxes and capsules
+    uint tessellation = 16;         // segments around the tessellated sphere and capsule
+    bool tessellated = false;       // trace the triangle versions of the shapes
+    bool compareProcedural = false; // alternate AABB / triangle shapes every frame and report both timings
+    uint particleCount = 0;         // simulated particles traced as spheres, 0 disables them
+    bool refit = false;             // update the particle BLAS instead of rebuilding it
+    bool particleSweep = false;     // start with 1024 particles and double them every report
+    bool hostBuild = false;         // build the static BLASes on the CPU through a deferred operation
+    uint buildThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    bool compareBuilds = false;     // build every static BLAS on both host and device and report both timings
+    bool wavefront = false;         // path trace bounce by bounce with ray queries instead of in one kernel
+    bool sortRays = true;           // wavefront: sort secondary rays by direction octant and origin Morton code
+    bool compareWavefront = false;  // alternate megakernel / wavefront every frame and report both timings
+    float renderScale = 1.0f;       // internal resolution per axis, upscaled to the window
+    uint tileSize = 0;              // trace in tiles of this many pixels (multiple of 8), 0 traces the frame at once
+    uint tilesPerSubmit = 4;        // tiles recorded into one command buffer before it is submitted
+    float frameBudgetMs = 0.0f;     // adjust the render scale so the trace takes about this long, 0 disables
+    bool denoise = false;           // edge-avoiding a-trous filter after the trace
+    uint denoiseIterations = 4;     // a-trous iterations, the filter footprint doubles with each
+    bool cull = false;              // rebuild the TLAS every frame from the instances inside the view frustum
+    uint instanceCount = 0;         // instances generated on the GPU from the BLAS library, 0 disables them
+    bool instanceSweep = false;     // start with 1024 generated instances and quadruple them every report
+    bool cameraPath = false;        // fly the camera along a fixed path instead of following the input
+    uint frameLimit = 0;            // exit after this many frames, 0 runs until the window is closed
+} options;
+
 void loadDeviceExtensionFunctions(VkDevice device)
 {
     vk.vkGetBufferDeviceAddressKHR = (PFN_vkGetBufferDeviceAddressKHR)(vkGetDeviceProcAddr(device, "vkGetBufferDeviceAddressKHR"));
@@ -140,19 +574,22 @@ void loadDeviceExtensionFunctions(VkDevice device)
     vk.vkDestroyAccelerationStructureKHR = (PFN_vkDestroyAccelerationStructureKHR)(vkGetDeviceProcAddr(device, "vkDestroyAccelerationStructureKHR"));
     vk.vkGetAccelerationStructureBuildSizesKHR = (PFN_vkGetAccelerationStructureBuildSizesKHR)(vkGetDeviceProcAddr(device, "vkGetAccelerationStructureBuildSizesKHR"));
     vk.vkCmdBuildAccelerationStructuresKHR = (PFN_vkCmdBuildAccelerationStructuresKHR)(vkGetDeviceProcAddr(device, "vkCmdBuildAccelerationStructuresKHR"));
+    vk.vkCmdBuildAccelerationStructuresIndirectKHR = (PFN_vkCmdBuildAccelerationStructuresIndirectKHR)(vkGetDeviceProcAddr(device, "vkCmdBuildAccelerationStructuresIndirectKHR"));
 	vk.vkCreateRayTracingPipelinesKHR = (PFN_vkCreateRayTracingPipelinesKHR)(vkGetDeviceProcAddr(device, "vkCreateRayTracingPipelinesKHR"));
 	vk.vkGetRayTracingShaderGroupHandlesKHR = (PFN_vkGetRayTracingShaderGroupHandlesKHR)(vkGetDeviceProcAddr(device, "vkGetRayTracingShaderGroupHandlesKHR"));
     vk.vkCmdTraceRaysKHR = (PFN_vkCmdTraceRaysKHR)(vkGetDeviceProcAddr(device, "vkCmdTraceRaysKHR"));
+    vk.vkBuildAccelerationStructuresKHR = (PFN_vkBuildAccelerationStructuresKHR)(vkGetDeviceProcAddr(device, "vkBuildAccelerationStructuresKHR"));
+    vk.vkCreateDeferredOperationKHR = (PFN_vkCreateDeferredOperationKHR)(vkGetDeviceProcAddr(device, "vkCreateDeferredOperationKHR"));
+    vk.vkDestroyDeferredOperationKHR = (PFN_vkDestroyDeferredOperationKHR)(vkGetDeviceProcAddr(device, "vkDestroyDeferredOperationKHR"));
+    vk.vkGetDeferredOperationMaxConcurrencyKHR = (PFN_vkGetDeferredOperationMaxConcurrencyKHR)(vkGetDeviceProcAddr(device, "vkGetDeferredOperationMaxConcurrencyKHR"));
+    vk.vkDeferredOperationJoinKHR = (PFN_vkDeferredOperationJoinKHR)(vkGetDeviceProcAddr(device, "vkDeferredOperationJoinKHR"));
+    vk.vkGetDeferredOperationResultKHR = (PFN_vkGetDeferredOperationResultKHR)(vkGetDeviceProcAddr(device, "vkGetDeferredOperationResultKHR"));
 
     VkPhysicalDeviceProperties2 deviceProperties2{
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
         .pNext = &vk.rtProperties,
     };
 	vkGetPhysicalDeviceProperties2(vk.physicalDevice, &deviceProperties2);
-
-    if (vk.rtProperties.shaderGroupHandleSize != SHADER_GROUP_HANDLE_SIZE) {
-        throw std::runtime_error("shaderGroupHandleSize must be 32 mentioned in the vulakn spec (Table 69. Required Limits)!");
-    }
 }
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
@@ -232,11 +669,103 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device, std::vector<const char
     return true;
 }
 
+void parseOptions(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--progressive") {
+            options.progressive = true;
+        } else if (arg == "--spp") {
+            options.samplesPerFrame = std::max(1, std::atoi(next()));
+        } else if (arg == "--exposure") {
+            options.exposure = (float)std::atof(next());
+        } else if (arg == "--path") {
+            options.pathTrace = true;
+        } else if (arg == "--max-depth") {
+            options.maxDepth = std::clamp(std::atoi(next()), 1, (int)MAX_PATH_DEPTH);
+        } else if (arg == "--rr-depth") {
+            options.rrStartDepth = std::max(1, std::atoi(next()));
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--ray-query") {
+            options.traceMode = TRACE_RAY_QUERY;
+        } else if (arg == "--compare-modes") {
+            options.compareModes = true;
+        } else if (arg == "--alpha-test") {
+            options.alphaTest = true;
+        } else if (arg == "--compare-alpha") {
+            options.compareAlpha = true;
+        } else if (arg == "--shadows") {
+            options.shadows = true;
+        } else if (arg == "--primitives") {
+            options.primitiveCount = std::clamp(std::atoi(next()), 3, (int)MAX_PROCEDURAL_PRIMITIVES);
+        } else if (arg == "--tessellation") {
+            options.tessellation = std::clamp(std::atoi(next()), 4, 256) & ~3;
+        } else if (arg == "--tessellated") {
+            options.tessellated = true;
+        } else if (arg == "--compare-procedural") {
+            options.compareProcedural = true;
+        } else if (arg == "--particles") {
+            options.particleCount = std::max(0, std::atoi(next()));
+        } else if (arg == "--refit") {
+            options.refit = true;
+        } else if (arg == "--particle-sweep") {
+            options.particleSweep = true;
+        } else if (arg == "--host-build") {
+            options.hostBuild = true;
+        } else if (arg == "--build-threads") {
+            options.buildThreads = std::max(1, std::atoi(next()));
+        } else if (arg == "--compare-builds") {
+            options.compareBuilds = true;
+        } else if (arg == "--wavefront") {
+            options.wavefront = true;
+            options.pathTrace = true;
+        } else if (arg == "--no-sort") {
+            options.sortRays = false;
+        } else if (arg == "--compare-wavefront") {
+            options.compareWavefront = true;
+            options.pathTrace = true;
+        } else if (arg == "--render-scale") {
+            options.renderScale = std::clamp((float)std::atof(next()), MIN_RENDER_SCALE, 1.0f);
+        } else if (arg == "--tile") {
+            options.tileSize = (std::max(0, std::atoi(next())) + 7) & ~7;
+        } else if (arg == "--tiles-per-submit") {
+            options.tilesPerSubmit = std::max(1, std::atoi(next()));
+        } else if (arg == "--frame-budget") {
+            options.frameBudgetMs = std::max(0.0f, (float)std::atof(next()));
+        } else if (arg == "--denoise") {
+            options.denoise = true;
+        } else if (arg == "--cull") {
+            options.cull = true;
+        } else if (arg == "--instances") {
+            options.instanceCount = std::max(0, std::atoi(next()));
+        } else if (arg == "--instance-sweep") {
+            options.instanceSweep = true;
+        } else if (arg == "--camera-path") {
+            options.cameraPath = true;
+        } else if (arg == "--frames") {
+            options.frameLimit = std::max(0, std::atoi(next()));
+        } else if (arg == "--denoise-iterations") {
+            options.denoiseIterations = std::min((uint)std::max(0, std::atoi(next())), MAX_DENOISE_ITERATIONS);
+        } else {
+            throw std::runtime_error("unknown option: " + arg);
+        }
+    }
+}
+
 GLFWwindow* createWindow()
 {
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-    return glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    return window;
 }
 
 void createVkInstance(GLFWwindow* window)
@@ -304,8 +833,8 @@ void createVkDevice()
         VK_KHR_SWAPCHAIN_EXTENSION_NAME, 
 
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
-        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME, // not used
-        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, // not used
+        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
         VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
 
         VK_KHR_SPIRV_1_4_EXTENSION_NAME, // not used
@@ -325,6 +854,33 @@ void createVkDevice()
         throw std::runtime_error("failed to find a suitable GPU!");
     }
 
+    // Ray query is optional, the pipeline mode works without it.
+    std::vector<const char*> rayQueryExtentions = { VK_KHR_RAY_QUERY_EXTENSION_NAME };
+    vk.rayQuerySupported = checkDeviceExtensionSupport(vk.physicalDevice, rayQueryExtentions);
+    if (vk.rayQuerySupported) {
+        extentions.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+    }
+
+    // Host builds are optional as well, few drivers implement accelerationStructureHostCommands.
+    // So are indirect builds; without them the culled TLAS is built over inactive instances instead.
+    {
+        VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeatures{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+        };
+        VkPhysicalDeviceFeatures2 features2{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &asFeatures,
+        };
+        vkGetPhysicalDeviceFeatures2(vk.physicalDevice, &features2);
+        vk.hostBuildSupported = asFeatures.accelerationStructureHostCommands;
+        vk.indirectBuildSupported = asFeatures.accelerationStructureIndirectBuild;
+    }
+    if (!vk.hostBuildSupported && (options.hostBuild || options.compareBuilds)) {
+        std::cout << "host acceleration structure builds are not supported on this device, building on the device" << std::endl;
+        options.hostBuild = false;
+        options.compareBuilds = false;
+    }
+
     uint32_t queueFamilyCount = 0;
     vkGetPhysicalDeviceQueueFamilyProperties(vk.physicalDevice, &queueFamilyCount, nullptr);
     std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
@@ -366,9 +922,21 @@ void createVkDevice()
         .bufferDeviceAddress = VK_TRUE,
     };
 
+    // textures[] in bindless_src: runtime sized, partially bound, indexed with nonuniformEXT
+    VkPhysicalDeviceDescriptorIndexingFeatures f5{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .descriptorBindingVariableDescriptorCount = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
+    };
+
 	VkPhysicalDeviceAccelerationStructureFeaturesKHR f2{
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
         .accelerationStructure = VK_TRUE,
+        .accelerationStructureIndirectBuild = vk.indirectBuildSupported,
+        .accelerationStructureHostCommands = vk.hostBuildSupported,
     };
 	
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR f3{
@@ -376,9 +944,18 @@ void createVkDevice()
         .rayTracingPipeline = VK_TRUE,
     };
 
+    VkPhysicalDeviceRayQueryFeaturesKHR f4{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR,
+        .rayQuery = VK_TRUE,
+    };
+
     createInfo.pNext = &f1;
-    f1.pNext = &f2;
+    f1.pNext = &f5;
+    f5.pNext = &f2;
     f2.pNext = &f3;
+    if (vk.rayQuerySupported) {
+        f3.pNext = &f4;
+    }
 
     if (vkCreateDevice(vk.physicalDevice, &createInfo, nullptr, &vk.device) != VK_SUCCESS) {
         throw std::runtime_error("failed to create logical device!");
@@ -513,6 +1090,35 @@ void createSyncObjects()
 
 }
 
+enum TimestampSlot : uint {
+    TS_TRACE_BEGIN,
+    TS_TRACE_END,
+    TS_BUILD_BEGIN,         // particle BLAS build, written back to back when there are no particles
+    TS_BUILD_END,
+    TS_DENOISE_BEGIN,       // written back to back when the denoiser is off
+    TS_DENOISE_END,
+    TS_TLAS_BEGIN,          // per frame TLAS build including the instance culling, back to back when there is none
+    TS_TLAS_END,
+    TIMESTAMP_COUNT,
+};
+
+void createQueryPool()
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vk.physicalDevice, &props);
+    vk.timestampPeriod = props.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo ci{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = TIMESTAMP_COUNT,
+    };
+
+    if (vkCreateQueryPool(vk.device, &ci, nullptr, &vk.timestampPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
+}
+
 
 uint findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags reqMemProps)
 {
@@ -646,6 +1252,8 @@ void setImageLayout(
         barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     } else if (newImageLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
         barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    } else if (newImageLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
     }
 
     vkCmdPipelineBarrier(
@@ -671,222 +1279,790 @@ inline VkDeviceAddress getDeviceAddressOf(VkAccelerationStructureKHR as)
     return vk.vkGetAccelerationStructureDeviceAddressKHR(vk.device, &info);
 }
 
-void createBLAS()
+// Per hit record tint. Vertex attributes and materials come from the bindless set (bindless_src).
+struct HitgCustomData {
+    float color[3];
+};
+
+enum ShaderGroup : uint {     // index into shaderGroups[] of createRayTracingPipeline()
+    GROUP_RAYGEN,
+    GROUP_MISS,
+    GROUP_HIT,
+    GROUP_SHADOW_MISS,
+    GROUP_HIT_ALPHA,            // closest hit + alpha testing any-hit
+    GROUP_HIT_SPHERE,           // procedural hit groups, one intersection shader per shape
+    GROUP_HIT_BOX,
+    GROUP_HIT_CAPSULE,
+    GROUP_HIT_PROCEDURAL_MESH,  // tessellated shapes, shaded like the procedural ones
+};
+
+enum BlasKind : uint {
+    BLAS_QUADS,
+    BLAS_PROCEDURAL,            // one AABB geometry per shape
+    BLAS_TESSELLATED,           // the same shapes as triangle meshes
+    BLAS_PARTICLES,             // rebuilt or refit every frame
+    BLAS_KIND_COUNT,
+};
+
+// Instance masks, the ray cull mask picks either the procedural or the tessellated shapes
+enum InstanceMask : uint32_t {
+    MASK_QUADS = 0x01,
+    MASK_PROCEDURAL = 0x02,
+    MASK_TESSELLATED = 0x04,
+    MASK_PARTICLES = 0x08,
+    MASK_GENERATED = 0x10,
+};
+
+const uint32_t PROCEDURAL_INSTANCE = 200;   // instanceCustomIndex, see procedural_src
+const uint32_t PARTICLE_INSTANCE = 300;
+
+// Per BLAS geometry: non-opaque geometry gets the alpha testing hit group
+const bool geometryAlphaTested[] = { false, true };
+
+struct InstanceDesc {
+    VkTransformMatrixKHR transform;
+    std::vector<HitgCustomData> geometryMaterials;    // one hit record per BLAS geometry
+    VkGeometryInstanceFlagsKHR flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    BlasKind blas = BLAS_QUADS;
+    uint32_t mask = MASK_QUADS;
+    uint32_t customIndex = 0;                       // BLAS_QUADS: GeometryData index of the first geometry
+    std::vector<ShaderGroup> hitGroups = {};        // per BLAS geometry, empty picks by geometryAlphaTested[]
+    std::vector<uint32_t> materials = {};           // BLAS_QUADS: initial Material index per BLAS geometry
+};
+
+const VkTransformMatrixKHR identityTransform = {
+    1.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 1.0f, 0.0f
+};
+
+const VkAabbPositionsKHR emptyBounds = {
+    std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+    -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+};
+
+// Grows bounds by the point p transformed with a row major 3x4 matrix
+void growBounds(VkAabbPositionsKHR& bounds, const VkTransformMatrixKHR& transform, const float p[3])
 {
-    float vertices[][3] = {
-        { -1.0f, -1.0f, 0.0f },
-        {  1.0f, -1.0f, 0.0f },
-        {  1.0f,  1.0f, 0.0f },
-        { -1.0f,  1.0f, 0.0f },
+    float q[3];
+    for (uint row = 0; row < 3; ++row) {
+        const float* m = transform.matrix[row];
+        q[row] = m[0] * p[0] + m[1] * p[1] + m[2] * p[2] + m[3];
+    }
+    bounds = {
+        std::min(bounds.minX, q[0]), std::min(bounds.minY, q[1]), std::min(bounds.minZ, q[2]),
+        std::max(bounds.maxX, q[0]), std::max(bounds.maxY, q[1]), std::max(bounds.maxZ, q[2]),
     };
-    uint32_t indices[] = { 0, 1, 3, 1, 2, 3 };
+}
 
-    VkTransformMatrixKHR geoTransforms[] = {
-        {
-            1.0f, 0.0f, 0.0f, -2.0f,
-            0.0f, 1.0f, 0.0f, 0.0f,
+// Bounds of the 8 corners of local after the transform, loose but cheap for culling
+VkAabbPositionsKHR transformBounds(const VkAabbPositionsKHR& local, const VkTransformMatrixKHR& transform)
+{
+    VkAabbPositionsKHR bounds = emptyBounds;
+    for (uint corner = 0; corner < 8; ++corner) {
+        const float p[3] = {
+            corner & 1 ? local.maxX : local.minX,
+            corner & 2 ? local.maxY : local.minY,
+            corner & 4 ? local.maxZ : local.minZ,
+        };
+        growBounds(bounds, transform, p);
+    }
+    return bounds;
+}
+
+// createParticles() appends the particle instance
+std::vector<InstanceDesc> sceneInstances = {
+    {
+        .transform = {
+            1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, 1.0f, 0.0f, 2.0f,
             0.0f, 0.0f, 1.0f, 0.0f
-        }, 
-        {
-            1.0f, 0.0f, 0.0f, 2.0f,
-            0.0f, 1.0f, 0.0f, 0.0f,
+        },
+        .geometryMaterials = {
+            {{0.6f, 0.1f, 0.2f}}, // Deep Red Wine
+            {{0.1f, 0.8f, 0.4f}}, // Emerald Green
+        },
+        .customIndex = 0,
+        .materials = { 0, 1 },
+    },
+    {
+        .transform = {
+            1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, 1.0f, 0.0f, -2.0f,
             0.0f, 0.0f, 1.0f, 0.0f
         },
-    };
+        .geometryMaterials = {
+            {{0.9f, 0.7f, 0.1f}}, // Golden Yellow
+            {{0.3f, 0.6f, 0.9f}}, // Dawn Sky Blue
+        },
+        .customIndex = 2,
+        .materials = { 2, 0 },
+    },
+    {
+        // Backdrop that receives the shadows, forced opaque so its right half keeps no holes
+        .transform = {
+            3.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, 3.0f, 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f, -3.0f
+        },
+        .geometryMaterials = {
+            {{0.7f, 0.7f, 0.7f}},
+            {{0.7f, 0.7f, 0.7f}},
+        },
+        .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR | VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR,
+        .customIndex = 4,
+        .materials = { 1, 1 },
+    },
+    {
+        // Geometry i holds the shapes of ProceduralShape i, the records tint the per-primitive colors
+        .transform = identityTransform,
+        .geometryMaterials = {
+            {{1.0f, 1.0f, 1.0f}},
+            {{1.0f, 1.0f, 1.0f}},
+            {{1.0f, 1.0f, 1.0f}},
+        },
+        .blas = BLAS_PROCEDURAL,
+        .mask = MASK_PROCEDURAL,
+        .customIndex = PROCEDURAL_INSTANCE,
+        .hitGroups = { GROUP_HIT_SPHERE, GROUP_HIT_BOX, GROUP_HIT_CAPSULE },
+    },
+    {
+        .transform = identityTransform,
+        .geometryMaterials = {
+            {{1.0f, 1.0f, 1.0f}},
+            {{1.0f, 1.0f, 1.0f}},
+            {{1.0f, 1.0f, 1.0f}},
+        },
+        .blas = BLAS_TESSELLATED,
+        .mask = MASK_TESSELLATED,
+        .customIndex = PROCEDURAL_INSTANCE,
+        .hitGroups = { GROUP_HIT_PROCEDURAL_MESH, GROUP_HIT_PROCEDURAL_MESH, GROUP_HIT_PROCEDURAL_MESH },
+    },
+};
 
-    auto [vertexBuffer, vertexBufferMem] = createBuffer(
-        sizeof(vertices), 
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    
-    auto [indexBuffer, indexBufferMem] = createBuffer(
-        sizeof(indices), 
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+// Host visible build input, kept mapped so the same data can feed a host build as well as a device build.
+struct BuildInput {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    void* mapped;
+
+    VkDeviceOrHostAddressConstKHR address(bool host) const {
+        if (host) {
+            return { .hostAddress = mapped };
+        }
+        return { .deviceAddress = getDeviceAddressOf(buffer) };
+    }
+};
 
-    auto [geoTransformBuffer, geoTransformBufferMem] = createBuffer(
-        sizeof(geoTransforms), 
+BuildInput createBuildInput(const void* data, VkDeviceSize size)
+{
+    BuildInput input;
+    std::tie(input.buffer, input.memory) = createBuffer(
+        size, 
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    
-    void* dst;
+    vkMapMemory(vk.device, input.memory, 0, size, 0, &input.mapped);
+    memcpy(input.mapped, data, size);
+    return input;
+}
 
-    vkMapMemory(vk.device, vertexBufferMem, 0, sizeof(vertices), 0, &dst);
-    memcpy(dst, vertices, sizeof(vertices));
-    vkUnmapMemory(vk.device, vertexBufferMem);
+void destroyBuildInput(const BuildInput& input)
+{
+    vkUnmapMemory(vk.device, input.memory);
+    vkFreeMemory(vk.device, input.memory, nullptr);
+    vkDestroyBuffer(vk.device, input.buffer, nullptr);
+}
+
+/*
+vkBuildAccelerationStructuresKHR on a deferred operation, joined by up to options.buildThreads threads
+(the calling one included). The driver reports how many threads can help with vkGetDeferredOperationMaxConcurrencyKHR.
+*/
+void hostBuildAccelerationStructure(
+    const VkAccelerationStructureBuildGeometryInfoKHR& buildInfo, 
+    const VkAccelerationStructureBuildRangeInfoKHR* ranges)
+{
+    VkDeferredOperationKHR operation;
+    if (vk.vkCreateDeferredOperationKHR(vk.device, nullptr, &operation) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create deferred operation!");
+    }
 
-    vkMapMemory(vk.device, indexBufferMem, 0, sizeof(indices), 0, &dst);
-    memcpy(dst, indices, sizeof(indices));
-    vkUnmapMemory(vk.device, indexBufferMem);
+    VkResult result = vk.vkBuildAccelerationStructuresKHR(vk.device, operation, 1, &buildInfo, &ranges);
+    if (result == VK_OPERATION_DEFERRED_KHR) {
+        const uint concurrency = vk.vkGetDeferredOperationMaxConcurrencyKHR(vk.device, operation);
+        const uint threadCount = std::max(std::min(options.buildThreads, concurrency), 1u);
 
-    vkMapMemory(vk.device, geoTransformBufferMem, 0, sizeof(geoTransforms), 0, &dst);
-    memcpy(dst, geoTransforms, sizeof(geoTransforms));
-    vkUnmapMemory(vk.device, geoTransformBufferMem);
+        auto join = [operation]() {
+            for (;;) {
+                VkResult joined = vk.vkDeferredOperationJoinKHR(vk.device, operation);
+                if (joined != VK_THREAD_IDLE_KHR) {
+                    break;      // VK_SUCCESS, VK_THREAD_DONE_KHR or an error read back below
+                }
+                std::this_thread::yield();
+            }
+        };
 
-    VkAccelerationStructureGeometryKHR geometry0{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
-        .geometry = {
-            .triangles = {
-                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
-                .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
-                .vertexData = { .deviceAddress = getDeviceAddressOf(vertexBuffer) },
-                .vertexStride = sizeof(vertices[0]),
-                .maxVertex = sizeof(vertices) / sizeof(vertices[0]) - 1,
-                .indexType = VK_INDEX_TYPE_UINT32,
-                .indexData = { .deviceAddress = getDeviceAddressOf(indexBuffer) },
-                .transformData = { .deviceAddress = getDeviceAddressOf(geoTransformBuffer) },
-            },
-        },
-        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
-    };
-    VkAccelerationStructureGeometryKHR geometries[] = { geometry0, geometry0 };
+        std::vector<std::thread> workers;
+        for (uint i = 1; i < threadCount; ++i) {
+            workers.emplace_back(join);
+        }
+        join();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        result = vk.vkGetDeferredOperationResultKHR(vk.device, operation);
+    }
+    vk.vkDestroyDeferredOperationKHR(vk.device, operation, nullptr);
 
-    uint32_t triangleCount0 = sizeof(indices) / (sizeof(indices[0]) * 3);
-    uint32_t triangleCounts[] = { triangleCount0, triangleCount0 };
+    if (result != VK_SUCCESS && result != VK_OPERATION_NOT_DEFERRED_KHR) {
+        throw std::runtime_error("failed to build acceleration structure on the host!");
+    }
+}
+
+/*
+Creates a bottom level AS and builds it on the host or on the device (one-shot submit).
+Returns the acceleration structure size in bytes and the wall clock build time in ms, allocation excluded.
+A host built AS lives in host visible memory, which the device then traces from.
+*/
+std::tuple<VkDeviceSize, double> buildBLASOnce(
+    bool host,
+    const std::vector<VkAccelerationStructureGeometryKHR>& geometries,
+    const std::vector<VkAccelerationStructureBuildRangeInfoKHR>& ranges,
+    VkBuffer& blasBuffer, VkDeviceMemory& blasBufferMem, VkAccelerationStructureKHR& blas, VkDeviceAddress& blasAddress)
+{
+    std::vector<uint32_t> primitiveCounts;
+    for (auto& range : ranges) {
+        primitiveCounts.push_back(range.primitiveCount);
+    }
 
     VkAccelerationStructureBuildGeometryInfoKHR buildBlasInfo{
         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
         .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
         .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-        .geometryCount = sizeof(geometries) / sizeof(geometries[0]),
-        .pGeometries = geometries,
+        .geometryCount = (uint32_t)geometries.size(),
+        .pGeometries = geometries.data(),
     };
     
     VkAccelerationStructureBuildSizesInfoKHR requiredSize{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
     vk.vkGetAccelerationStructureBuildSizesKHR(
         vk.device,
-        VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        host ? VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR : VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
         &buildBlasInfo,
-        triangleCounts,
+        primitiveCounts.data(),
         &requiredSize);
 
-    std::tie(vk.blasBuffer, vk.blasBufferMem) = createBuffer(
+    std::tie(blasBuffer, blasBufferMem) = createBuffer(
         requiredSize.accelerationStructureSize,
         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    auto [scratchBuffer, scratchBufferMem] = createBuffer(
-        requiredSize.buildScratchSize,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        host ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     // Generate BLAS handle
     {
         VkAccelerationStructureCreateInfoKHR asCreateInfo{
             .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-            .buffer = vk.blasBuffer,
+            .buffer = blasBuffer,
             .size = requiredSize.accelerationStructureSize,
             .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
         };
-        vk.vkCreateAccelerationStructureKHR(vk.device, &asCreateInfo, nullptr, &vk.blas);
+        vk.vkCreateAccelerationStructureKHR(vk.device, &asCreateInfo, nullptr, &blas);
 
-        vk.blasAddress = getDeviceAddressOf(vk.blas);
+        blasAddress = getDeviceAddressOf(blas);
     }
+    buildBlasInfo.dstAccelerationStructure = blas;
 
-    // Build BLAS using GPU operations
-    {
-        vkResetCommandBuffer(vk.commandBuffer, 0);
-        VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-        vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
-        {
-            buildBlasInfo.dstAccelerationStructure = vk.blas;
-            buildBlasInfo.scratchData.deviceAddress = getDeviceAddressOf(scratchBuffer);
-            VkAccelerationStructureBuildRangeInfoKHR buildBlasRangeInfo[] = {
-                { 
-                    .primitiveCount = triangleCounts[0],
-                    .transformOffset = 0,
-                },
-                { 
-                    .primitiveCount = triangleCounts[1],
-                    .transformOffset = sizeof(geoTransforms[0]),
-                }
-            };
+    double buildMs;
+    if (host) {
+        std::vector<uint8_t> scratch(requiredSize.buildScratchSize);
+        buildBlasInfo.scratchData.hostAddress = scratch.data();
 
-            VkAccelerationStructureBuildGeometryInfoKHR buildBlasInfos[] = { buildBlasInfo };
-            VkAccelerationStructureBuildRangeInfoKHR* buildBlasRangeInfos[] = { buildBlasRangeInfo };
-            vk.vkCmdBuildAccelerationStructuresKHR(vk.commandBuffer, 1, buildBlasInfos, buildBlasRangeInfos);
-            // vkCmdBuildAccelerationStructuresKHR(vk.commandBuffer, 1, &buildBlasInfo, 
-            // (const VkAccelerationStructureBuildRangeInfoKHR *const *)&buildBlasRangeInfo);
+        auto begin = std::chrono::steady_clock::now();
+        hostBuildAccelerationStructure(buildBlasInfo, ranges.data());
+        buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+    else {
+        auto [scratchBuffer, scratchBufferMem] = createBuffer(
+            requiredSize.buildScratchSize,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        buildBlasInfo.scratchData.deviceAddress = getDeviceAddressOf(scratchBuffer);
+
+        // Build BLAS using GPU operations
+        auto begin = std::chrono::steady_clock::now();
+        {
+            vkResetCommandBuffer(vk.commandBuffer, 0);
+            VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+            vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
+            {
+                const VkAccelerationStructureBuildRangeInfoKHR* buildBlasRangeInfos[] = { ranges.data() };
+                vk.vkCmdBuildAccelerationStructuresKHR(vk.commandBuffer, 1, &buildBlasInfo, buildBlasRangeInfos);
+            }
+            vkEndCommandBuffer(vk.commandBuffer);
+
+            VkSubmitInfo submitInfo {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &vk.commandBuffer,
+            }; 
+            vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+            vkQueueWaitIdle(vk.graphicsQueue);
         }
-        vkEndCommandBuffer(vk.commandBuffer);
+        buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
 
-        VkSubmitInfo submitInfo {
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &vk.commandBuffer,
-        }; 
-        vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(vk.graphicsQueue);
+        vkFreeMemory(vk.device, scratchBufferMem, nullptr);
+        vkDestroyBuffer(vk.device, scratchBuffer, nullptr);
     }
 
-    vkFreeMemory(vk.device, scratchBufferMem, nullptr);
-    vkFreeMemory(vk.device, vertexBufferMem, nullptr);
-    vkFreeMemory(vk.device, indexBufferMem, nullptr);
-    vkFreeMemory(vk.device, geoTransformBufferMem, nullptr);
-    vkDestroyBuffer(vk.device, scratchBuffer, nullptr);
-    vkDestroyBuffer(vk.device, vertexBuffer, nullptr);
-    vkDestroyBuffer(vk.device, indexBuffer, nullptr);
-    vkDestroyBuffer(vk.device, geoTransformBuffer, nullptr);
+    return { requiredSize.accelerationStructureSize, buildMs };
 }
 
-void createTLAS()
+/*
+Builds a BLAS the way --host-build selects. geometries(host) returns the geometry descriptions
+with host or device input addresses (see BuildInput). With --compare-builds the other build type
+also runs into a throwaway BLAS so both timings are printed side by side.
+Input buffers may be freed once this returns. Returns the acceleration structure size in bytes.
+*/
+VkDeviceSize buildBLAS(
+    const char* name,
+    const std::function<std::vector<VkAccelerationStructureGeometryKHR>(bool host)>& geometries,
+    const std::vector<VkAccelerationStructureBuildRangeInfoKHR>& ranges,
+    VkBuffer& blasBuffer, VkDeviceMemory& blasBufferMem, VkAccelerationStructureKHR& blas, VkDeviceAddress& blasAddress)
+{
+    const bool host = options.hostBuild;
+    auto [size, buildMs] = buildBLASOnce(host, geometries(host), ranges, blasBuffer, blasBufferMem, blas, blasAddress);
+
+    double otherMs = 0.0;
+    if (options.compareBuilds) {
+        VkBuffer otherBuffer;
+        VkDeviceMemory otherBufferMem;
+        VkAccelerationStructureKHR other;
+        VkDeviceAddress otherAddress;
+        std::tie(std::ignore, otherMs) = buildBLASOnce(
+            !host, geometries(!host), ranges, otherBuffer, otherBufferMem, other, otherAddress);
+
+        vk.vkDestroyAccelerationStructureKHR(vk.device, other, nullptr);
+        vkFreeMemory(vk.device, otherBufferMem, nullptr);
+        vkDestroyBuffer(vk.device, otherBuffer, nullptr);
+    }
+
+    uint64_t primitives = 0;
+    for (auto& range : ranges) {
+        primitives += range.primitiveCount;
+    }
+    const double hostMs = host ? buildMs : otherMs;
+    const double deviceMs = host ? otherMs : buildMs;
+    if (options.compareBuilds) {
+        printf("[build] %-11s %8llu primitives: device %8.3f ms, host (%u threads) %8.3f ms\n",
+            name, (unsigned long long)primitives, deviceMs, options.buildThreads, hostMs);
+    }
+    else {
+        printf("[build] %-11s %8llu primitives: %s %8.3f ms\n",
+            name, (unsigned long long)primitives, host ? "host" : "device", buildMs);
+    }
+    return size;
+}
+
+void createBLAS()
 {
-    VkTransformMatrixKHR insTransforms[] = {
+    QuadVertex vertices[] = {
+        { { -1.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f } },
+        { {  1.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f } },
+        { {  1.0f,  1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f } },
+        { { -1.0f,  1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f } },
+    };
+    uint32_t indices[] = { 0, 1, 3, 1, 2, 3 };
+
+    VkTransformMatrixKHR geoTransforms[] = {
         {
-            1.0f, 0.0f, 0.0f, 0.0f,
-            0.0f, 1.0f, 0.0f, 2.0f,
+            1.0f, 0.0f, 0.0f, -2.0f,
+            0.0f, 1.0f, 0.0f, 0.0f,
             0.0f, 0.0f, 1.0f, 0.0f
         }, 
         {
-            1.0f, 0.0f, 0.0f, 0.0f,
-            0.0f, 1.0f, 0.0f, -2.0f,
+            1.0f, 0.0f, 0.0f, 2.0f,
+            0.0f, 1.0f, 0.0f, 0.0f,
             0.0f, 0.0f, 1.0f, 0.0f
         },
     };
 
-    VkAccelerationStructureInstanceKHR instance0 {
-        .instanceCustomIndex = 100,
-        .mask = 0xFF,
-        .instanceShaderBindingTableRecordOffset = 0,
-        .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
-        .accelerationStructureReference = vk.blasAddress,
+    BuildInput vertexInput = createBuildInput(vertices, sizeof(vertices));
+    BuildInput indexInput = createBuildInput(indices, sizeof(indices));
+    BuildInput geoTransformInput = createBuildInput(geoTransforms, sizeof(geoTransforms));
+
+    auto buildGeometries = [&](bool host) {
+        VkAccelerationStructureGeometryKHR geometry0{
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+            .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+            .geometry = {
+                .triangles = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                    .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+                    .vertexData = vertexInput.address(host),
+                    .vertexStride = sizeof(vertices[0]),
+                    .maxVertex = sizeof(vertices) / sizeof(vertices[0]) - 1,
+                    .indexType = VK_INDEX_TYPE_UINT32,
+                    .indexData = indexInput.address(host),
+                    .transformData = geoTransformInput.address(host),
+                },
+            },
+            .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+        };
+        std::vector<VkAccelerationStructureGeometryKHR> geometries = { geometry0, geometry0 };
+        for (uint i = 0; i < geometries.size(); ++i) {
+            if (geometryAlphaTested[i]) {
+                // The any-hit shader counts its invocations, so ask for exactly one per primitive.
+                geometries[i].flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
+            }
+        }
+        return geometries;
     };
-    VkAccelerationStructureInstanceKHR instanceData[] = { instance0, instance0 };
-    instanceData[0].transform = insTransforms[0];
-    instanceData[1].transform = insTransforms[1];
-    instanceData[1].instanceShaderBindingTableRecordOffset = 2; // 2 geometry (in instance0) + 2 geometry (in instance1)
 
-    auto [instanceBuffer, instanceBufferMem] = createBuffer(
-        sizeof(instanceData), 
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+    uint32_t triangleCount0 = sizeof(indices) / (sizeof(indices[0]) * 3);
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges = {
+        { 
+            .primitiveCount = triangleCount0,
+            .transformOffset = 0,
+        },
+        { 
+            .primitiveCount = triangleCount0,
+            .transformOffset = sizeof(geoTransforms[0]),
+        }
+    };
+
+    buildBLAS("quads", buildGeometries, ranges, vk.blasBuffer, vk.blasBufferMem, vk.blas, vk.blasAddress);
+
+    vk.blasBounds[BLAS_QUADS] = emptyBounds;
+    for (auto& transform : geoTransforms) {
+        for (auto& vertex : vertices) {
+            growBounds(vk.blasBounds[BLAS_QUADS], transform, vertex.position);
+        }
+    }
+
+    // The hit shaders fetch the vertices through GeometryData, so only the transforms are freed.
+    vk.quadVertexBuffer = vertexInput.buffer;
+    vk.quadVertexBufferMem = vertexInput.memory;
+    vk.quadIndexBuffer = indexInput.buffer;
+    vk.quadIndexBufferMem = indexInput.memory;
+    destroyBuildInput(geoTransformInput);
+}
+
+enum ProceduralShape : uint {   // BLAS geometry index of each shape, SHAPE_* in procedural_src
+    SHAPE_SPHERE,
+    SHAPE_BOX,
+    SHAPE_CAPSULE,
+    SHAPE_COUNT,
+};
+
+const char* shapeNames[SHAPE_COUNT] = { "sphere", "box", "capsule" };
+
+// std430 layout of Primitive in procedural_src
+struct ProceduralPrimitive {
+    float center[3];
+    float radius;
+    float extent[3];
+    float pad0;
+    float color[3];
+    float pad1;
+};
+
+// Header of the ProceduralScene buffer (binding 7), followed by the primitives
+struct ProceduralSceneHeader {
+    uint32_t geometryBase[4];
+    uint32_t trianglesPerPrimitive[4];
+};
+
+/*
+Capsule around the y axis with the given half segment length, a sphere when halfLength is 0.
+segments is the ring resolution, a multiple of 4 so the latitude rings hit the equator.
+*/
+void appendCapsuleMesh(
+    std::vector<float>& vertices, std::vector<uint32_t>& indices, 
+    const float center[3], float radius, float halfLength, uint segments)
+{
+    const float pi = 3.14159265f;
+    const uint first = (uint)vertices.size() / 3;
+    const uint halfRings = segments / 4;    // rings per hemisphere, equator included
+
+    // Rings from the top pole down; the equator is duplicated when the capsule has a cylinder part.
+    uint ringCount = 0;
+    for (uint hemisphere = 0; hemisphere < 2; ++hemisphere) {
+        for (uint j = 0; j <= halfRings; ++j) {
+            if (hemisphere == 1 && j == 0 && halfLength == 0.0f) {
+                continue;
+            }
+            const float theta = pi * 0.5f * (hemisphere + (float)j / halfRings);
+            const float y = std::cos(theta) * radius + (hemisphere == 0 ? halfLength : -halfLength);
+            const float r = std::sin(theta) * radius;
+            for (uint i = 0; i < segments; ++i) {
+                const float phi = 2.0f * pi * i / segments;
+                vertices.insert(vertices.end(), { 
+                    center[0] + r * std::cos(phi), center[1] + y, center[2] + r * std::sin(phi) });
+            }
+            ++ringCount;
+        }
+    }
+
+    for (uint ring = 0; ring + 1 < ringCount; ++ring) {
+        for (uint i = 0; i < segments; ++i) {
+            const uint a = first + ring * segments + i;
+            const uint b = first + ring * segments + (i + 1) % segments;
+            const uint c = a + segments;
+            const uint d = b + segments;
+            if (ring > 0) {
+                indices.insert(indices.end(), { a, b, c });     // the top pole ring is collapsed
+            }
+            if (ring + 2 < ringCount) {
+                indices.insert(indices.end(), { b, d, c });     // so is the bottom one
+            }
+        }
+    }
+}
+
+void appendBoxMesh(std::vector<float>& vertices, std::vector<uint32_t>& indices, const float center[3], const float extent[3])
+{
+    const uint first = (uint)vertices.size() / 3;
+    for (uint i = 0; i < 8; ++i) {
+        vertices.insert(vertices.end(), {
+            center[0] + (i & 1 ? extent[0] : -extent[0]),
+            center[1] + (i & 2 ? extent[1] : -extent[1]),
+            center[2] + (i & 4 ? extent[2] : -extent[2]) });
+    }
+    const uint32_t faces[][4] = {   // corner bits: x = 1, y = 2, z = 4
+        { 0, 2, 6, 4 }, { 1, 5, 7, 3 },
+        { 0, 4, 5, 1 }, { 2, 3, 7, 6 },
+        { 0, 1, 3, 2 }, { 4, 6, 7, 5 },
+    };
+    for (auto& f : faces) {
+        indices.insert(indices.end(), { first + f[0], first + f[1], first + f[2], first + f[0], first + f[2], first + f[3] });
+    }
+}
+
+/*
+A grid of analytic spheres, boxes and capsules below the quads, built twice:
+as an AABB BLAS traced with intersection shaders, and as a tessellated triangle BLAS of the same shapes.
+Both are instanced, and the ray cull mask selects one of them, so the two can be compared in the same scene.
+*/
+void createProceduralScene()
+{
+    const uint count = options.primitiveCount;
+    const uint side = (uint)std::ceil(std::sqrt((float)count));
+    const float spacing = 20.0f / side;
+    const float size = 0.4f * spacing;
+
+    // Sorted by shape, so geometry i of both BLASes holds the primitives of shape i.
+    std::vector<ProceduralPrimitive> primitives;
+    ProceduralSceneHeader header{};
+    uint seed = 1;
+    auto random = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) * (1.0f / (1u << 24));
+    };
+    for (uint shape = 0; shape < SHAPE_COUNT; ++shape) {
+        header.geometryBase[shape] = (uint32_t)primitives.size();
+        for (uint i = shape; i < count; i += SHAPE_COUNT) {
+            ProceduralPrimitive p{
+                .center = { -10.0f + spacing * (i % side + 0.5f), -4.5f, 2.0f - spacing * (i / side + 0.5f) },
+                .radius = shape == SHAPE_CAPSULE ? 0.5f * size : size,     // AABB half size is |extent| + radius
+                .extent = { 0.0f, 0.0f, 0.0f },
+                .color = { 0.2f + 0.7f * random(), 0.2f + 0.7f * random(), 0.2f + 0.7f * random() },
+            };
+            if (shape == SHAPE_BOX) {
+                p.radius = 0.0f;
+                std::fill(p.extent, p.extent + 3, 0.75f * size);
+            }
+            if (shape == SHAPE_CAPSULE) {
+                p.extent[1] = 0.5f * size;      // the mesh version only supports capsules along y
+            }
+            primitives.push_back(p);
+        }
+    }
+
+    // Analytic shapes: one AABB per primitive
+    std::vector<VkAabbPositionsKHR> aabbs;
+    VkAabbPositionsKHR sceneBounds = emptyBounds;
+    for (auto& p : primitives) {
+        float half[3];
+        for (uint k = 0; k < 3; ++k) {
+            half[k] = std::abs(p.extent[k]) + p.radius;
+        }
+        aabbs.push_back({
+            p.center[0] - half[0], p.center[1] - half[1], p.center[2] - half[2],
+            p.center[0] + half[0], p.center[1] + half[1], p.center[2] + half[2] });
+        growBounds(sceneBounds, identityTransform, &aabbs.back().minX);
+        growBounds(sceneBounds, identityTransform, &aabbs.back().maxX);
+    }
+    vk.blasBounds[BLAS_PROCEDURAL] = sceneBounds;
+    vk.blasBounds[BLAS_TESSELLATED] = sceneBounds;
+
+    // Tessellated shapes: indices are absolute, each geometry starts at its own index range
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    uint32_t indexStart[SHAPE_COUNT];
+    for (uint shape = 0; shape < SHAPE_COUNT; ++shape) {
+        indexStart[shape] = (uint32_t)indices.size();
+        const uint end = shape + 1 < SHAPE_COUNT ? header.geometryBase[shape + 1] : (uint)primitives.size();
+        for (uint i = header.geometryBase[shape]; i < end; ++i) {
+            const size_t before = indices.size();
+            const ProceduralPrimitive& p = primitives[i];
+            if (shape == SHAPE_BOX) {
+                appendBoxMesh(vertices, indices, p.center, p.extent);
+            }
+            else {
+                appendCapsuleMesh(vertices, indices, p.center, p.radius, p.extent[1], options.tessellation);
+            }
+            header.trianglesPerPrimitive[shape] = (uint32_t)(indices.size() - before) / 3;
+        }
+    }
+
+    const VkDeviceSize aabbSize = sizeof(aabbs[0]) * aabbs.size();
+    const VkDeviceSize vertexSize = sizeof(float) * vertices.size();
+    const VkDeviceSize indexSize = sizeof(uint32_t) * indices.size();
+    BuildInput aabbInput = createBuildInput(aabbs.data(), aabbSize);
+    BuildInput vertexInput = createBuildInput(vertices.data(), vertexSize);
+    BuildInput indexInput = createBuildInput(indices.data(), indexSize);
+
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> aabbRanges;
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> meshRanges;
+    for (uint shape = 0; shape < SHAPE_COUNT; ++shape) {
+        const uint end = shape + 1 < SHAPE_COUNT ? header.geometryBase[shape + 1] : (uint)primitives.size();
+        const uint32_t primitiveCount = end - header.geometryBase[shape];
+
+        aabbRanges.push_back({
+            .primitiveCount = primitiveCount,
+            .primitiveOffset = (uint32_t)(header.geometryBase[shape] * sizeof(VkAabbPositionsKHR)),
+        });
+        meshRanges.push_back({
+            .primitiveCount = primitiveCount * header.trianglesPerPrimitive[shape],
+            .primitiveOffset = indexStart[shape] * (uint32_t)sizeof(uint32_t),
+        });
+    }
+
+    auto aabbGeometries = [&](bool host) {
+        VkAccelerationStructureGeometryKHR geometry{
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+            .geometryType = VK_GEOMETRY_TYPE_AABBS_KHR,
+            .geometry = {
+                .aabbs = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
+                    .data = aabbInput.address(host),
+                    .stride = sizeof(VkAabbPositionsKHR),
+                },
+            },
+            .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+        };
+        return std::vector<VkAccelerationStructureGeometryKHR>(SHAPE_COUNT, geometry);
+    };
+
+    auto meshGeometries = [&](bool host) {
+        VkAccelerationStructureGeometryKHR geometry{
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+            .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+            .geometry = {
+                .triangles = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                    .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+                    .vertexData = vertexInput.address(host),
+                    .vertexStride = sizeof(float) * 3,
+                    .maxVertex = (uint32_t)vertices.size() / 3 - 1,
+                    .indexType = VK_INDEX_TYPE_UINT32,
+                    .indexData = indexInput.address(host),
+                },
+            },
+            .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+        };
+        return std::vector<VkAccelerationStructureGeometryKHR>(SHAPE_COUNT, geometry);
+    };
+
+    const VkDeviceSize aabbBlasSize = buildBLAS(
+        "procedural", aabbGeometries, aabbRanges, vk.aabbBlasBuffer, vk.aabbBlasBufferMem, vk.aabbBlas, vk.aabbBlasAddress);
+    const VkDeviceSize meshBlasSize = buildBLAS(
+        "tessellated", meshGeometries, meshRanges, vk.meshBlasBuffer, vk.meshBlasBufferMem, vk.meshBlas, vk.meshBlasAddress);
+
+    // Build inputs are not needed after the build, so the memory to compare is the BLAS itself.
+    printf("[blas] procedural : %8u AABBs,     BLAS %9.1f KB, build input %9.1f KB\n",
+        (uint)aabbs.size(), aabbBlasSize / 1024.0, aabbSize / 1024.0);
+    printf("[blas] tessellated: %8u triangles, BLAS %9.1f KB, build input %9.1f KB (%u segments)\n",
+        (uint)indices.size() / 3, meshBlasSize / 1024.0, (vertexSize + indexSize) / 1024.0, options.tessellation);
+    for (uint shape = 0; shape < SHAPE_COUNT; ++shape) {
+        printf("    %-8s: %u triangles per primitive\n", shapeNames[shape], header.trianglesPerPrimitive[shape]);
+    }
+
+    destroyBuildInput(aabbInput);
+    destroyBuildInput(vertexInput);
+    destroyBuildInput(indexInput);
+
+    // Primitive data read by the intersection and closest hit shaders
+    const VkDeviceSize sceneSize = sizeof(header) + sizeof(primitives[0]) * primitives.size();
+    std::tie(vk.proceduralBuffer, vk.proceduralBufferMem) = createBuffer(
+        sceneSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    void* dst;
-    vkMapMemory(vk.device, instanceBufferMem, 0, sizeof(instanceData), 0, &dst);
-    memcpy(dst, instanceData, sizeof(instanceData));
-    vkUnmapMemory(vk.device, instanceBufferMem);
+    uint8_t* dst;
+    vkMapMemory(vk.device, vk.proceduralBufferMem, 0, sceneSize, 0, (void**)&dst);
+    memcpy(dst, &header, sizeof(header));
+    memcpy(dst + sizeof(header), primitives.data(), sizeof(primitives[0]) * primitives.size());
+    vkUnmapMemory(vk.device, vk.proceduralBufferMem);
+}
 
-    VkAccelerationStructureGeometryKHR instances{
+// Size of the VkAccelerationStructureBuildRangeInfoKHR in front of the culled instances, keeps them 16 byte aligned
+const VkDeviceSize CULLED_INSTANCE_OFFSET = 16;
+
+// culled: read the instances compacted by cmdCullInstances() instead of all of them
+VkAccelerationStructureGeometryKHR tlasGeometry(bool culled = false)
+{
+    const VkDeviceAddress data = culled ? 
+        getDeviceAddressOf(vk.culledInstanceBuffer) + CULLED_INSTANCE_OFFSET : getDeviceAddressOf(vk.tlasInstanceBuffer);
+    return {
         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
         .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
         .geometry = {
             .instances = {
                 .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
-                .data = { .deviceAddress = getDeviceAddressOf(instanceBuffer) },
+                .data = { .deviceAddress = data },
             },
         },
         .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
     };
+}
 
-    uint32_t instanceCount = 2;
-
+// Records a full TLAS build. Also used every frame when a referenced BLAS changes (see cmdUpdateParticles())
+// or when the instances are culled, then it builds over the output of cmdCullInstances().
+void cmdBuildTLAS(VkCommandBuffer commandBuffer, bool culled = false)
+{
+    VkAccelerationStructureGeometryKHR instances = tlasGeometry(culled);
     VkAccelerationStructureBuildGeometryInfoKHR buildTlasInfo{
         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
         .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
         .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
         .geometryCount = 1,     // It must be 1 with .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR as shown in the vulkan spec.
         .pGeometries = &instances,
+        .dstAccelerationStructure = vk.tlas,
+        .scratchData = { .deviceAddress = getDeviceAddressOf(vk.tlasScratchBuffer) },
+    };
+
+    if (culled && vk.indirectBuildSupported) {
+        // The primitive count comes from the build range the cull shader wrote, bounded by the size the TLAS was created for.
+        const VkDeviceAddress rangeAddress = getDeviceAddressOf(vk.culledInstanceBuffer);
+        const uint32_t rangeStride = sizeof(VkAccelerationStructureBuildRangeInfoKHR);
+        const uint32_t* maxPrimitiveCounts[] = { &vk.tlasInstanceCount };
+        vk.vkCmdBuildAccelerationStructuresIndirectKHR(commandBuffer, 1, &buildTlasInfo, &rangeAddress, &rangeStride, maxPrimitiveCounts);
+        return;
+    }
+
+    VkAccelerationStructureBuildRangeInfoKHR buildTlasRangeInfo = { .primitiveCount = vk.tlasInstanceCount };
+    VkAccelerationStructureBuildRangeInfoKHR* buildTlasRangeInfo_[] = { &buildTlasRangeInfo };
+    vk.vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildTlasInfo, buildTlasRangeInfo_);
+}
+
+// TLAS and build scratch sizes for instanceCount instances
+VkAccelerationStructureBuildSizesInfoKHR tlasBuildSizes(uint32_t instanceCount)
+{
+    VkAccelerationStructureGeometryKHR instances = tlasGeometry();
+    VkAccelerationStructureBuildGeometryInfoKHR buildTlasInfo{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+        .geometryCount = 1,
+        .pGeometries = &instances,
     };
 
     VkAccelerationStructureBuildSizesInfoKHR requiredSize{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
@@ -896,13 +2072,127 @@ void createTLAS()
         &buildTlasInfo,
         &instanceCount,
         &requiredSize);
+    return requiredSize;
+}
+
+// std430 layout of InstanceTemplate in instance_gen_src
+struct InstanceTemplate {
+    VkAccelerationStructureInstanceKHR instance;    // everything but the transform is copied into the generated instances
+    float boundsMin[4];                             // object space
+    float boundsMax[4];
+};
+static_assert(sizeof(InstanceTemplate) == 96, "instance_gen_src expects 96 byte templates");
+
+void createTLAS()
+{
+    std::vector<VkAccelerationStructureInstanceKHR> instanceData;
+    std::vector<InstanceTemplate> templates;
+    bool templated[BLAS_KIND_COUNT] = {};
+    uint32_t sbtRecordOffset = 0;
+    for (auto& instance : sceneInstances) {
+        instanceData.push_back({
+            .transform = instance.transform,
+            .instanceCustomIndex = instance.customIndex,
+            .mask = instance.mask,
+            .instanceShaderBindingTableRecordOffset = sbtRecordOffset,
+            .flags = instance.flags,
+            .accelerationStructureReference = 
+                instance.blas == BLAS_PROCEDURAL ? vk.aabbBlasAddress : 
+                instance.blas == BLAS_TESSELLATED ? vk.meshBlasAddress : 
+                instance.blas == BLAS_PARTICLES ? vk.particleBlasAddress : vk.blasAddress,
+        });
+        sbtRecordOffset += (uint32_t)instance.geometryMaterials.size();
+
+        // The generator library: the first instance of every static BLAS, hit records included.
+        if (instance.blas != BLAS_PARTICLES && !templated[instance.blas]) {
+            templated[instance.blas] = true;
+            const VkAabbPositionsKHR& bounds = vk.blasBounds[instance.blas];
+            InstanceTemplate t{
+                .instance = instanceData.back(),
+                .boundsMin = { bounds.minX, bounds.minY, bounds.minZ, 0.0f },
+                .boundsMax = { bounds.maxX, bounds.maxY, bounds.maxZ, 0.0f },
+            };
+            t.instance.mask = MASK_GENERATED;
+            templates.push_back(t);
+        }
+    }
+    vk.tlasInstanceCount = (uint32_t)instanceData.size();
+    vk.sceneInstanceCount = vk.tlasInstanceCount;
+    vk.tlasInstanceCapacity = vk.sceneInstanceCount + options.instanceCount;   // generateInstances() fills the rest
+    vk.instanceTemplateCount = (uint32_t)templates.size();
+
+    // Instance culling: world space bounds as vec4 min, max pairs next to the instances they belong to
+    std::vector<float> instanceBounds;
+    for (auto& instance : sceneInstances) {
+        const VkAabbPositionsKHR bounds = transformBounds(vk.blasBounds[instance.blas], instance.transform);
+        instanceBounds.insert(instanceBounds.end(), { bounds.minX, bounds.minY, bounds.minZ, 0.0f });
+        instanceBounds.insert(instanceBounds.end(), { bounds.maxX, bounds.maxY, bounds.maxZ, 0.0f });
+    }
+
+    const VkDeviceSize instanceDataSize = sizeof(VkAccelerationStructureInstanceKHR) * vk.tlasInstanceCapacity;
+    const VkDeviceSize instanceBoundsSize = 2 * sizeof(float[4]) * vk.tlasInstanceCapacity;
+
+    // Kept alive with the scratch buffer, the TLAS is rebuilt in place every frame in particle mode.
+    // Also the source of the instance culling (binding 15) and the target of the instance generator.
+    // Device local: with a million generated instances neither this nor the bounds are touched by the CPU again.
+    std::tie(vk.tlasInstanceBuffer, vk.tlasInstanceBufferMem) = createBuffer(
+        instanceDataSize, 
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.instanceBoundsBuffer, vk.instanceBoundsBufferMem) = createBuffer(
+        instanceBoundsSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // The scene instances and their bounds are uploaded through one staging buffer below.
+    const VkDeviceSize sceneDataSize = sizeof(instanceData[0]) * instanceData.size();
+    const VkDeviceSize sceneBoundsSize = sizeof(float) * instanceBounds.size();
+    auto [stagingBuffer, stagingBufferMem] = createBuffer(
+        sceneDataSize + sceneBoundsSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    uint8_t* dst;
+    vkMapMemory(vk.device, stagingBufferMem, 0, sceneDataSize + sceneBoundsSize, 0, (void**)&dst);
+    memcpy(dst, instanceData.data(), sceneDataSize);
+    memcpy(dst + sceneDataSize, instanceBounds.data(), sceneBoundsSize);
+    vkUnmapMemory(vk.device, stagingBufferMem);
+
+    const VkDeviceSize templateSize = sizeof(templates[0]) * templates.size();
+    std::tie(vk.instanceTemplateBuffer, vk.instanceTemplateBufferMem) = createBuffer(
+        templateSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    vkMapMemory(vk.device, vk.instanceTemplateBufferMem, 0, templateSize, 0, (void**)&dst);
+    memcpy(dst, templates.data(), templateSize);
+    vkUnmapMemory(vk.device, vk.instanceTemplateBufferMem);
+
+    std::tie(vk.culledInstanceBuffer, vk.culledInstanceBufferMem) = createBuffer(
+        CULLED_INSTANCE_OFFSET + instanceDataSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | 
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.cullStatsBuffer, vk.cullStatsBufferMem) = createBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkMapMemory(vk.device, vk.cullStatsBufferMem, 0, sizeof(uint32_t), 0, (void**)&vk.culledInstanceCount);
+    *vk.culledInstanceCount = vk.tlasInstanceCount;
+
+    // Sized for every instance the generator may add, builds with fewer instances reuse it.
+    VkAccelerationStructureBuildSizesInfoKHR requiredSize = tlasBuildSizes(vk.tlasInstanceCapacity);
 
     std::tie(vk.tlasBuffer, vk.tlasBufferMem) = createBuffer(
         requiredSize.accelerationStructureSize,
         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    auto [scratchBuffer, scratchBufferMem] = createBuffer(
+    std::tie(vk.tlasScratchBuffer, vk.tlasScratchBufferMem) = createBuffer(
         requiredSize.buildScratchSize,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -918,18 +2208,226 @@ void createTLAS()
         vk.vkCreateAccelerationStructureKHR(vk.device, &asCreateInfo, nullptr, &vk.tlas);
     }
 
-    // Build TLAS using GPU operations
+    // Upload the scene instances, then build TLAS using GPU operations
     {
         vkResetCommandBuffer(vk.commandBuffer, 0);
         VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
         vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
         {
-            buildTlasInfo.dstAccelerationStructure = vk.tlas;
-            buildTlasInfo.scratchData.deviceAddress = getDeviceAddressOf(scratchBuffer);
+            VkBufferCopy instanceRegion{ .srcOffset = 0, .dstOffset = 0, .size = sceneDataSize };
+            vkCmdCopyBuffer(vk.commandBuffer, stagingBuffer, vk.tlasInstanceBuffer, 1, &instanceRegion);
+            VkBufferCopy boundsRegion{ .srcOffset = sceneDataSize, .dstOffset = 0, .size = sceneBoundsSize };
+            vkCmdCopyBuffer(vk.commandBuffer, stagingBuffer, vk.instanceBoundsBuffer, 1, &boundsRegion);
+
+            VkMemoryBarrier uploaded{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            };
+            vkCmdPipelineBarrier(vk.commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 1, &uploaded, 0, nullptr, 0, nullptr);
+
+            cmdBuildTLAS(vk.commandBuffer);
+        }
+        vkEndCommandBuffer(vk.commandBuffer);
+
+        VkSubmitInfo submitInfo {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &vk.commandBuffer,
+        }; 
+        vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        vkQueueWaitIdle(vk.graphicsQueue);
+    }
+
+    vkDestroyBuffer(vk.device, stagingBuffer, nullptr);
+    vkFreeMemory(vk.device, stagingBufferMem, nullptr);
+}
+
+// std430 layout of Particle in procedural_src
+struct Particle {
+    float aabb[6];      // VkAabbPositionsKHR
+    float radius;
+    float pad0;
+    float position[3];
+    float pad1;
+    float velocity[3];
+    float pad2;
+    float color[3];
+    float pad3;
+};
+
+static_assert(offsetof(Particle, aabb) == 0 && sizeof(Particle) % 8 == 0, "AABB build input stride must be a multiple of 8");
+
+const VkBuildAccelerationStructureFlagsKHR PARTICLE_BLAS_FLAGS = 
+    VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR;
+
+// Zero copy: the AABBs are read in place from the simulated particle buffer, sizeof(Particle) apart.
+VkAccelerationStructureGeometryKHR particleGeometry()
+{
+    return {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_AABBS_KHR,
+        .geometry = {
+            .aabbs = {
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
+                .data = { .deviceAddress = getDeviceAddressOf(vk.particleBuffer) },
+                .stride = sizeof(Particle),
+            },
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+    };
+}
+
+// A refit (update) keeps the tree topology of the last full build and only refreshes the bounds.
+void cmdBuildParticleBLAS(VkCommandBuffer commandBuffer, uint32_t count, bool refit)
+{
+    VkAccelerationStructureGeometryKHR geometry = particleGeometry();
+    VkAccelerationStructureBuildGeometryInfoKHR buildBlasInfo{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .flags = PARTICLE_BLAS_FLAGS,
+        .mode = refit ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .srcAccelerationStructure = refit ? vk.particleBlas : VK_NULL_HANDLE,
+        .dstAccelerationStructure = vk.particleBlas,
+        .geometryCount = 1,
+        .pGeometries = &geometry,
+        .scratchData = { .deviceAddress = getDeviceAddressOf(vk.particleScratchBuffer) },
+    };
+
+    VkAccelerationStructureBuildRangeInfoKHR buildBlasRangeInfo = { .primitiveCount = count };
+    VkAccelerationStructureBuildRangeInfoKHR* buildBlasRangeInfo_[] = { &buildBlasRangeInfo };
+    vk.vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildBlasInfo, buildBlasRangeInfo_);
+    vk.particleBlasCount = count;
+}
+
+/*
+Particles simulated by a compute shader (particle_sim_src) and ray traced as spheres.
+The BLAS is sized for the whole buffer, --particle-sweep builds over a growing prefix of it.
+The particle buffer is always created since binding 8 is statically used by the hit shaders.
+*/
+void createParticles()
+{
+    vk.particleCapacity = std::max(options.particleCount, 1u);
+    vk.activeParticles = options.particleSweep ? std::min(1024u, options.particleCount) : options.particleCount;
+
+    std::default_random_engine rndEngine(0);
+    std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+    const float radius = std::clamp(0.5f / std::cbrt((float)vk.particleCapacity), 0.01f, 0.12f);
+
+    const float boundsMin[3] = { -6.0f, -3.0f, -2.5f };     // boundsMin/boundsMax in particle_sim_src
+    const float boundsMax[3] = { 6.0f, 4.0f, 2.0f };
+    // A particle may overshoot the bounds by one time step before it turns around.
+    const float margin = radius + 0.1f;
+    vk.blasBounds[BLAS_PARTICLES] = {
+        boundsMin[0] - margin, boundsMin[1] - margin, boundsMin[2] - margin,
+        boundsMax[0] + margin, boundsMax[1] + margin, boundsMax[2] + margin,
+    };
+
+    std::vector<Particle> particles(vk.particleCapacity);
+    for (auto& particle : particles) {
+        particle.radius = radius;
+        for (uint k = 0; k < 3; ++k) {
+            particle.position[k] = boundsMin[k] + (boundsMax[k] - boundsMin[k]) * rndDist(rndEngine);
+            particle.velocity[k] = 3.0f * rndDist(rndEngine) - 1.5f;
+            particle.color[k] = 0.3f + 0.7f * rndDist(rndEngine);
+            particle.aabb[k] = particle.position[k] - radius;
+            particle.aabb[k + 3] = particle.position[k] + radius;
+        }
+    }
+    const VkDeviceSize particleBufferSize = sizeof(Particle) * particles.size();
+
+    std::tie(vk.particleBuffer, vk.particleBufferMem) = createBuffer(
+        particleBufferSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | 
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    auto [stagingBuffer, stagingBufferMem] = createBuffer(
+        particleBufferSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    void* dst;
+    vkMapMemory(vk.device, stagingBufferMem, 0, particleBufferSize, 0, &dst);
+    memcpy(dst, particles.data(), particleBufferSize);
+    vkUnmapMemory(vk.device, stagingBufferMem);
+
+    if (options.particleCount > 0) {
+        VkAccelerationStructureGeometryKHR geometry = particleGeometry();
+        VkAccelerationStructureBuildGeometryInfoKHR buildBlasInfo{
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .flags = PARTICLE_BLAS_FLAGS,
+            .geometryCount = 1,
+            .pGeometries = &geometry,
+        };
+
+        VkAccelerationStructureBuildSizesInfoKHR requiredSize{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+        vk.vkGetAccelerationStructureBuildSizesKHR(
+            vk.device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &buildBlasInfo,
+            &vk.particleCapacity,
+            &requiredSize);
+
+        std::tie(vk.particleBlasBuffer, vk.particleBlasBufferMem) = createBuffer(
+            requiredSize.accelerationStructureSize,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        // Reused every frame, large enough for both build modes
+        std::tie(vk.particleScratchBuffer, vk.particleScratchBufferMem) = createBuffer(
+            std::max(requiredSize.buildScratchSize, requiredSize.updateScratchSize),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VkAccelerationStructureCreateInfoKHR asCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+            .buffer = vk.particleBlasBuffer,
+            .size = requiredSize.accelerationStructureSize,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        };
+        vk.vkCreateAccelerationStructureKHR(vk.device, &asCreateInfo, nullptr, &vk.particleBlas);
+        vk.particleBlasAddress = getDeviceAddressOf(vk.particleBlas);
+
+        printf("[particles] %u particles, BLAS %.1f KB, scratch build %.1f KB / update %.1f KB\n",
+            vk.particleCapacity, requiredSize.accelerationStructureSize / 1024.0,
+            requiredSize.buildScratchSize / 1024.0, requiredSize.updateScratchSize / 1024.0);
+
+        sceneInstances.push_back({
+            .transform = identityTransform,
+            .geometryMaterials = { {{1.0f, 1.0f, 1.0f}} },
+            .blas = BLAS_PARTICLES,
+            .mask = MASK_PARTICLES,
+            .customIndex = PARTICLE_INSTANCE,
+            .hitGroups = { GROUP_HIT_SPHERE },
+        });
+    }
 
-            VkAccelerationStructureBuildRangeInfoKHR buildTlasRangeInfo = { .primitiveCount = instanceCount };
-            VkAccelerationStructureBuildRangeInfoKHR* buildTlasRangeInfo_[] = { &buildTlasRangeInfo };
-            vk.vkCmdBuildAccelerationStructuresKHR(vk.commandBuffer, 1, &buildTlasInfo, buildTlasRangeInfo_);
+    // Upload, then the first build so createTLAS() can reference the BLAS
+    {
+        vkResetCommandBuffer(vk.commandBuffer, 0);
+        VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
+        {
+            VkBufferCopy copyRegion{ .size = particleBufferSize };
+            vkCmdCopyBuffer(vk.commandBuffer, stagingBuffer, vk.particleBuffer, 1, &copyRegion);
+
+            if (options.particleCount > 0) {
+                VkMemoryBarrier barrier{
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                };
+                vkCmdPipelineBarrier(
+                    vk.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+                    1, &barrier, 0, nullptr, 0, nullptr);
+
+                cmdBuildParticleBLAS(vk.commandBuffer, vk.activeParticles, false);
+            }
         }
         vkEndCommandBuffer(vk.commandBuffer);
 
@@ -942,10 +2440,49 @@ void createTLAS()
         vkQueueWaitIdle(vk.graphicsQueue);
     }
 
-    vkFreeMemory(vk.device, scratchBufferMem, nullptr);
-    vkFreeMemory(vk.device, instanceBufferMem, nullptr);
-    vkDestroyBuffer(vk.device, scratchBuffer, nullptr);
-    vkDestroyBuffer(vk.device, instanceBuffer, nullptr);
+    vkFreeMemory(vk.device, stagingBufferMem, nullptr);
+    vkDestroyBuffer(vk.device, stagingBuffer, nullptr);
+}
+
+/*
+Per frame: simulate, rebuild or refit the particle BLAS over the updated AABBs, then rebuild the TLAS
+since the bounds of the particle instance changed. The BLAS build is bracketed by TS_BUILD_* timestamps.
+*/
+void cmdUpdateParticles(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vk.particlePipeline);
+    vkCmdBindDescriptorSets(
+        commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, 
+        vk.pipelineLayout, 0, 1, &vk.descriptorSet, 1, &vk.cameraOffset);
+    vkCmdDispatch(commandBuffer, (vk.particleCapacity + 255) / 256, 1, 1);     // local_size 256 in particle_sim_src
+
+    VkMemoryBarrier simulated{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        1, &simulated, 0, nullptr, 0, nullptr);
+
+    // A refit needs the same primitive count as the build it updates.
+    const bool refit = options.refit && vk.particleBlasCount == vk.activeParticles;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, vk.timestampPool, TS_BUILD_BEGIN);
+    cmdBuildParticleBLAS(commandBuffer, vk.activeParticles, refit);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, vk.timestampPool, TS_BUILD_END);
+    vk.lastParticleRefit = refit;
+
+    // The TLAS that references the new BLAS is rebuilt by render().
+    VkMemoryBarrier built{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+        1, &built, 0, nullptr, 0, nullptr);
 }
 
 void createOutImage()
@@ -957,6 +2494,14 @@ void createOutImage()
         VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+    // Same format as outImage, so the blit filters the already encoded values without a color space conversion.
+    // A blit straight into the sRGB swapchain would encode them a second time.
+    std::tie(vk.upscaleImage, vk.upscaleImageMem) = createImage(
+        { WIDTH, HEIGHT },
+        format, 
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
     VkImageSubresourceRange subresourceRange{
         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
         .levelCount = 1,
@@ -976,140 +2521,2156 @@ void createOutImage()
     };
     vkCreateImageView(vk.device, &ci0, nullptr, &vk.outImageView);
 
-    vkResetCommandBuffer(vk.commandBuffer, 0);
-    VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
-    {
-        setImageLayout(
-            vk.commandBuffer, 
-            vk.outImage, 
-            VK_IMAGE_LAYOUT_UNDEFINED, 
-            VK_IMAGE_LAYOUT_GENERAL, 
-            subresourceRange);
-    }
-    vkEndCommandBuffer(vk.commandBuffer);
+    // Progressive mode keeps the running sum of samples (rgb) and the sample count (a) in full float precision.
+    VkFormat accumFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    std::tie(vk.accumImage, vk.accumImageMem) = createImage(
+        { WIDTH, HEIGHT },
+        accumFormat,
+        VK_IMAGE_USAGE_STORAGE_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkImageViewCreateInfo ci1{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = vk.accumImage,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = accumFormat,
+        .subresourceRange = subresourceRange,
+    };
+    vkCreateImageView(vk.device, &ci1, nullptr, &vk.accumImageView);
+
+    // Half floats are enough for the illumination, the unit normals and distances below a few hundred units.
+    VkFormat denoiseFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+    for (uint i = 0; i < DENOISE_IMAGE_COUNT; ++i) {
+        std::tie(vk.denoiseImages[i], vk.denoiseImageMems[i]) = createImage(
+            { WIDTH, HEIGHT },
+            denoiseFormat,
+            VK_IMAGE_USAGE_STORAGE_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VkImageViewCreateInfo ci2{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = vk.denoiseImages[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = denoiseFormat,
+            .subresourceRange = subresourceRange,
+        };
+        vkCreateImageView(vk.device, &ci2, nullptr, &vk.denoiseImageViews[i]);
+    }
+
+    vkResetCommandBuffer(vk.commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
+    {
+        setImageLayout(
+            vk.commandBuffer,
+            vk.outImage,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL,
+            subresourceRange);
+
+        setImageLayout(
+            vk.commandBuffer,
+            vk.accumImage,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL,
+            subresourceRange);
+
+        for (VkImage denoiseImage : vk.denoiseImages) {
+            setImageLayout(
+                vk.commandBuffer,
+                denoiseImage,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_GENERAL,
+                subresourceRange);
+        }
+    }
+    vkEndCommandBuffer(vk.commandBuffer);
+
+    VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &vk.commandBuffer,
+    }; 
+    vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(vk.graphicsQueue);
+}
+
+/*
+Alpha mask for the non-opaque geometry: a perforated sheet, 8x8 round holes per quad.
+Sampled with the object space hit position (see ahit_src), so no texture coordinates are needed.
+*/
+// Device local 2D image with a single mip, uploaded through a staging buffer and left in SHADER_READ_ONLY_OPTIMAL.
+std::tuple<VkImage, VkDeviceMemory, VkImageView> createSampledImage(
+    uint32_t size, VkFormat format, const void* texels, VkDeviceSize texelBytes)
+{
+    auto [image, imageMem] = createImage(
+        { size, size },
+        format,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkImageSubresourceRange subresourceRange{
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .levelCount = 1,
+        .layerCount = 1,
+    };
+
+    VkImageViewCreateInfo ci0{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .subresourceRange = subresourceRange,
+    };
+    VkImageView imageView;
+    vkCreateImageView(vk.device, &ci0, nullptr, &imageView);
+
+    auto [stagingBuffer, stagingBufferMem] = createBuffer(
+        texelBytes,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    void* dst;
+    vkMapMemory(vk.device, stagingBufferMem, 0, texelBytes, 0, &dst);
+    memcpy(dst, texels, texelBytes);
+    vkUnmapMemory(vk.device, stagingBufferMem);
+
+    vkResetCommandBuffer(vk.commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
+    {
+        setImageLayout(
+            vk.commandBuffer,
+            image,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            subresourceRange);
+
+        VkBufferImageCopy copyRegion{
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageExtent = { size, size, 1 },
+        };
+        vkCmdCopyBufferToImage(
+            vk.commandBuffer, stagingBuffer, 
+            image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+            1, &copyRegion);
+
+        setImageLayout(
+            vk.commandBuffer,
+            image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            subresourceRange);
+    }
+    vkEndCommandBuffer(vk.commandBuffer);
+
+    VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &vk.commandBuffer,
+    }; 
+    vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(vk.graphicsQueue);
+
+    vkFreeMemory(vk.device, stagingBufferMem, nullptr);
+    vkDestroyBuffer(vk.device, stagingBuffer, nullptr);
+
+    return { image, imageMem, imageView };
+}
+
+void createAlphaTexture()
+{
+    const uint32_t size = 256;
+    const uint32_t cell = size / 8;
+    std::vector<uint8_t> texels(size * size);
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            float dx = (x % cell + 0.5f) / cell - 0.5f;
+            float dy = (y % cell + 0.5f) / cell - 0.5f;
+            texels[y * size + x] = dx * dx + dy * dy < 0.35f * 0.35f ? 0 : 255;
+        }
+    }
+
+    std::tie(vk.alphaImage, vk.alphaImageMem, vk.alphaImageView) = 
+        createSampledImage(size, VK_FORMAT_R8_UNORM, texels.data(), texels.size());
+
+    VkSamplerCreateInfo ci1{
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+    };
+    if (vkCreateSampler(vk.device, &ci1, nullptr, &vk.alphaSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create sampler!");
+    }
+}
+
+/*
+Bindless resources, descriptor set 1 (bindless_src):
+    binding 0: GeometryData[], vertex / index buffer addresses + material of every quad BLAS geometry
+    binding 1: Material[]
+    binding 2: sampler2D textures[], variable count, partially bound, update after bind
+Hit shaders index them with gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT, so a new material or texture
+is a buffer write plus a descriptor write. Pipelines and the shader binding table stay as they are.
+*/
+void writeBindlessTexture(uint32_t index)
+{
+    VkDescriptorImageInfo imageInfo{
+        .sampler = vk.alphaSampler,     // linear + repeat, shared
+        .imageView = vk.textures[index].view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = vk.bindlessSet,
+        .dstBinding = 2,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &imageInfo,
+    };
+    vkUpdateDescriptorSets(vk.device, 1, &write, 0, nullptr);
+}
+
+// RGBA8 checkerboard of cells x cells squares. Returns the textures[] index.
+uint32_t addCheckerTexture(uint32_t cells, const uint8_t colorA[3], const uint8_t colorB[3])
+{
+    if (vk.textures.size() >= MAX_BINDLESS_TEXTURES) {
+        throw std::runtime_error("bindless texture array is full!");
+    }
+
+    const uint32_t size = 256;
+    std::vector<uint8_t> texels(size * size * 4);
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            const uint8_t* color = (x * cells / size + y * cells / size) % 2 ? colorA : colorB;
+            uint8_t* texel = &texels[(y * size + x) * 4];
+            texel[0] = color[0];
+            texel[1] = color[1];
+            texel[2] = color[2];
+            texel[3] = 255;
+        }
+    }
+
+    BindlessTexture texture;
+    std::tie(texture.image, texture.memory, texture.view) = 
+        createSampledImage(size, VK_FORMAT_R8G8B8A8_UNORM, texels.data(), texels.size());
+    vk.textures.push_back(texture);
+
+    const uint32_t index = (uint32_t)vk.textures.size() - 1;
+    writeBindlessTexture(index);
+    return index;
+}
+
+uint32_t addMaterial(const Material& material)
+{
+    if (vk.materialCount >= MAX_BINDLESS_MATERIALS) {
+        throw std::runtime_error("bindless material buffer is full!");
+    }
+    vk.materials[vk.materialCount] = material;
+    return vk.materialCount++;
+}
+
+void createBindlessResources()
+{
+    const VkShaderStageFlags stages = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+    VkDescriptorSetLayoutBinding bindings[] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = stages,
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = stages,
+        },
+        {
+            .binding = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = MAX_BINDLESS_TEXTURES,
+            .stageFlags = stages,
+        },
+    };
+    // Only the last binding of a set may have a variable count.
+    VkDescriptorBindingFlags bindingFlags[] = {
+        0,
+        0,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | 
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | 
+        VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT,
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = sizeof(bindingFlags) / sizeof(bindingFlags[0]),
+        .pBindingFlags = bindingFlags,
+    };
+    VkDescriptorSetLayoutCreateInfo ci0{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &flagsInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = sizeof(bindings) / sizeof(bindings[0]),
+        .pBindings = bindings,
+    };
+    if (vkCreateDescriptorSetLayout(vk.device, &ci0, nullptr, &vk.bindlessSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create bindless descriptor set layout!");
+    }
+
+    VkDescriptorPoolSize poolSizes[] = {
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_TEXTURES },
+    };
+    VkDescriptorPoolCreateInfo ci1{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]),
+        .pPoolSizes = poolSizes,
+    };
+    vkCreateDescriptorPool(vk.device, &ci1, nullptr, &vk.bindlessPool);
+
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variableCount{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+        .descriptorSetCount = 1,
+        .pDescriptorCounts = &MAX_BINDLESS_TEXTURES,
+    };
+    VkDescriptorSetAllocateInfo ai0{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = &variableCount,
+        .descriptorPool = vk.bindlessPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &vk.bindlessSetLayout,
+    };
+    vkAllocateDescriptorSets(vk.device, &ai0, &vk.bindlessSet);
+
+    // Both tables are small and host visible; render() only writes them after the fence wait.
+    for (auto& instance : sceneInstances) {
+        if (instance.blas == BLAS_QUADS) {
+            vk.geometryCount = std::max(vk.geometryCount, instance.customIndex + (uint32_t)instance.geometryMaterials.size());
+        }
+    }
+    std::tie(vk.geometryBuffer, vk.geometryBufferMem) = createBuffer(
+        sizeof(GeometryData) * vk.geometryCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkMapMemory(vk.device, vk.geometryBufferMem, 0, VK_WHOLE_SIZE, 0, (void**)&vk.geometries);
+
+    std::tie(vk.materialBuffer, vk.materialBufferMem) = createBuffer(
+        sizeof(Material) * MAX_BINDLESS_MATERIALS,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkMapMemory(vk.device, vk.materialBufferMem, 0, VK_WHOLE_SIZE, 0, (void**)&vk.materials);
+
+    VkDescriptorBufferInfo geometryInfo{ vk.geometryBuffer, 0, VK_WHOLE_SIZE };
+    VkDescriptorBufferInfo materialInfo{ vk.materialBuffer, 0, VK_WHOLE_SIZE };
+    VkWriteDescriptorSet writes[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = vk.bindlessSet,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &geometryInfo,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = vk.bindlessSet,
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &materialInfo,
+        },
+    };
+    vkUpdateDescriptorSets(vk.device, sizeof(writes) / sizeof(writes[0]), writes, 0, nullptr);
+
+    // Material indices used by sceneInstances: 0 untextured, 1 fine checker, 2 coarse checker
+    const uint8_t white[3] = { 255, 255, 255 };
+    const uint8_t gray[3] = { 96, 96, 96 };
+    const uint8_t black[3] = { 16, 16, 16 };
+    const int32_t fine = (int32_t)addCheckerTexture(8, white, gray);
+    const int32_t coarse = (int32_t)addCheckerTexture(2, white, black);
+    addMaterial({ { 1.0f, 1.0f, 1.0f }, -1 });
+    addMaterial({ { 1.0f, 1.0f, 1.0f }, fine });
+    addMaterial({ { 1.0f, 1.0f, 1.0f }, coarse });
+
+    const VkDeviceAddress vertexAddress = getDeviceAddressOf(vk.quadVertexBuffer);
+    const VkDeviceAddress indexAddress = getDeviceAddressOf(vk.quadIndexBuffer);
+    for (auto& instance : sceneInstances) {
+        if (instance.blas != BLAS_QUADS) {
+            continue;
+        }
+        for (uint i = 0; i < instance.geometryMaterials.size(); ++i) {
+            vk.geometries[instance.customIndex + i] = {
+                .vertexAddress = vertexAddress,     // both geometries share the quad, the BLAS transforms only translate
+                .indexAddress = indexAddress,
+                .materialIndex = i < instance.materials.size() ? instance.materials[i] : 0,
+            };
+        }
+    }
+}
+
+/*
+N key: a new checker texture and material, assigned to the next quad geometry in turn.
+Runs between frames, so the tables and the new descriptor are not in use by the GPU.
+*/
+void addRandomMaterial()
+{
+    static std::mt19937 rng(7);
+    static uint32_t geometry = 0;
+    std::uniform_int_distribution<int> channel(0, 255);
+
+    if (vk.textures.size() >= MAX_BINDLESS_TEXTURES || vk.materialCount >= MAX_BINDLESS_MATERIALS) {
+        std::cout << "bindless tables are full" << std::endl;
+        return;
+    }
+
+    const uint8_t colorA[3] = { (uint8_t)channel(rng), (uint8_t)channel(rng), (uint8_t)channel(rng) };
+    const uint8_t colorB[3] = { (uint8_t)channel(rng), (uint8_t)channel(rng), (uint8_t)channel(rng) };
+    const uint32_t texture = addCheckerTexture(2 + rng() % 14, colorA, colorB);
+    const uint32_t material = addMaterial({ { 1.0f, 1.0f, 1.0f }, (int32_t)texture });
+
+    const uint32_t target = geometry++ % vk.geometryCount;
+    vk.geometries[target].materialIndex = material;
+    vk.accumFrameCount = 0;
+    std::cout << "material " << material << " (texture " << texture << ") -> geometry " << target << std::endl;
+}
+
+// std140 layout of CameraProperties in trace_src and instance_cull_src
+struct CameraProperties {
+    float viewInverse[16];  // camera to world, column major
+    float projInverse[16];  // clip to camera
+    float cameraPos[3];
+    float yFov_degree;
+};
+
+// Yaw 0 and pitch 0 look down -Z from +Z, the view of the original fixed camera.
+struct FlyCamera {
+    float position[3] = { 0.0f, 0.0f, 10.0f };
+    float yaw = 0.0f;           // radians around +Y, positive turns left
+    float pitch = 0.0f;         // radians, positive looks up
+    float yFov_degree = 60.0f;
+} flyCamera;
+
+const float CAMERA_NEAR = 0.1f;         // only for a proper projection inverse, rays start at the camera
+const float CAMERA_FAR = 1000.0f;
+const float CAMERA_SPEED = 5.0f;        // units per second, x4 with shift
+const float MOUSE_SENSITIVITY = 0.003f; // radians per pixel
+
+void cameraBasis(const FlyCamera& camera, float right[3], float up[3], float forward[3])
+{
+    const float cosPitch = std::cos(camera.pitch);
+    forward[0] = -std::sin(camera.yaw) * cosPitch;
+    forward[1] = std::sin(camera.pitch);
+    forward[2] = -std::cos(camera.yaw) * cosPitch;
+    right[0] = std::cos(camera.yaw);
+    right[1] = 0.0f;
+    right[2] = -std::sin(camera.yaw);
+    up[0] = right[1] * forward[2] - right[2] * forward[1];     // right x forward
+    up[1] = right[2] * forward[0] - right[0] * forward[2];
+    up[2] = right[0] * forward[1] - right[1] * forward[0];
+}
+
+/*
+Writes the camera into the next slot of the persistently mapped uniform buffer and points vk.cameraOffset at it.
+The frame that may still be running reads the other slot, and the one before it finished before that frame was
+submitted, so the write never has to wait for the fence. The memory is coherent and vkQueueSubmit makes the write
+visible to the frame recorded next.
+*/
+void writeCamera(const FlyCamera& camera)
+{
+    static CameraProperties current{};
+
+    float right[3], up[3], forward[3];
+    cameraBasis(camera, right, up, forward);
+
+    // Inverse of a right handed perspective into Vulkan clip space, y pointing down and depth 0 ~ 1
+    const float tanY = std::tan(camera.yFov_degree * 3.14159265f / 360.0f);
+    const float tanX = tanY * WIDTH / HEIGHT;
+    const float depthScale = CAMERA_FAR / (CAMERA_NEAR - CAMERA_FAR);
+    const float depthOffset = CAMERA_NEAR * CAMERA_FAR / (CAMERA_NEAR - CAMERA_FAR);
+    const CameraProperties properties{
+        .viewInverse = {
+            right[0], right[1], right[2], 0.0f,
+            up[0], up[1], up[2], 0.0f,
+            -forward[0], -forward[1], -forward[2], 0.0f,
+            camera.position[0], camera.position[1], camera.position[2], 1.0f,
+        },
+        .projInverse = {
+            tanX, 0.0f, 0.0f, 0.0f,
+            0.0f, -tanY, 0.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f / depthOffset,
+            0.0f, 0.0f, -1.0f, depthScale / depthOffset,
+        },
+        .cameraPos = { camera.position[0], camera.position[1], camera.position[2] },
+        .yFov_degree = camera.yFov_degree,
+    };
+
+    // Accumulated samples belong to the old view, so any change of the camera restarts the accumulation.
+    if (memcmp(&current, &properties, sizeof(properties)) != 0) {
+        vk.accumFrameCount = 0;
+    }
+    current = properties;
+
+    vk.cameraSlot = (vk.cameraSlot + 1) % CAMERA_SLOTS;
+    vk.cameraOffset = (uint32_t)(vk.cameraSlot * vk.cameraSlotSize);
+    memcpy(vk.cameraSlots + vk.cameraOffset, &properties, sizeof(properties));
+}
+
+/*
+Moves flyCamera for the next frame and writes it, called before render() waits for the previous frame.
+Input: drag with the left mouse button to look around, arrow keys to move, Page Up / Down to rise and sink.
+--camera-path instead follows a loop around the scene that depends only on the frame number, so every run
+traces the same views and the reports of two runs can be compared.
+*/
+void updateCamera(GLFWwindow* window)
+{
+    static double lastTime = glfwGetTime();
+    static double lastCursor[2] = {};
+    static uint pathFrame = 0;
+
+    const double now = glfwGetTime();
+    const float dt = (float)std::min(now - lastTime, 0.1);  // no jump after a stall
+    lastTime = now;
+
+    if (options.cameraPath) {
+        const float center[3] = { 0.0f, 0.0f, -2.0f };
+        const float t = 2.0f * 3.14159265f * (pathFrame++ % CAMERA_PATH_FRAMES) / CAMERA_PATH_FRAMES;
+        flyCamera.position[0] = center[0] + 12.0f * std::sin(t);
+        flyCamera.position[1] = center[1] + 1.5f + 1.5f * std::sin(2.0f * t);
+        flyCamera.position[2] = center[2] + 12.0f * std::cos(t);
+
+        float toCenter[3];
+        for (uint i = 0; i < 3; ++i) {
+            toCenter[i] = center[i] - flyCamera.position[i];
+        }
+        const float distance = std::sqrt(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+        flyCamera.yaw = std::atan2(-toCenter[0], -toCenter[2]);
+        flyCamera.pitch = std::asin(toCenter[1] / distance);
+    }
+    else {
+        double cursor[2];
+        glfwGetCursorPos(window, &cursor[0], &cursor[1]);
+        if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+            flyCamera.yaw -= (float)(cursor[0] - lastCursor[0]) * MOUSE_SENSITIVITY;
+            flyCamera.pitch = std::clamp(flyCamera.pitch - (float)(cursor[1] - lastCursor[1]) * MOUSE_SENSITIVITY, -1.5f, 1.5f);
+        }
+        lastCursor[0] = cursor[0];
+        lastCursor[1] = cursor[1];
+
+        const auto pressed = [&](int key) { return glfwGetKey(window, key) == GLFW_PRESS ? 1.0f : 0.0f; };
+        const float ahead = pressed(GLFW_KEY_UP) - pressed(GLFW_KEY_DOWN);
+        const float aside = pressed(GLFW_KEY_RIGHT) - pressed(GLFW_KEY_LEFT);
+        const float rise = pressed(GLFW_KEY_PAGE_UP) - pressed(GLFW_KEY_PAGE_DOWN);
+        const float step = dt * CAMERA_SPEED * (pressed(GLFW_KEY_LEFT_SHIFT) > 0.0f ? 4.0f : 1.0f);
+
+        float right[3], up[3], forward[3];
+        cameraBasis(flyCamera, right, up, forward);
+        for (uint i = 0; i < 3; ++i) {
+            flyCamera.position[i] += step * (ahead * forward[i] + aside * right[i] + (i == 1 ? rise : 0.0f));
+        }
+    }
+
+    writeCamera(flyCamera);
+}
+
+void createUniformBuffer()
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vk.physicalDevice, &props);
+    const VkDeviceSize alignment = props.limits.minUniformBufferOffsetAlignment;
+    vk.cameraSlotSize = (sizeof(CameraProperties) + alignment - 1) / alignment * alignment;
+
+    std::tie(vk.uniformBuffer, vk.uniformBufferMem) = createBuffer(
+        vk.cameraSlotSize * CAMERA_SLOTS,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkMapMemory(vk.device, vk.uniformBufferMem, 0, VK_WHOLE_SIZE, 0, (void**)&vk.cameraSlots);
+
+    writeCamera(flyCamera);
+}
+
+void createRayStatsBuffer()
+{
+    std::tie(vk.rayStatsBuffer, vk.rayStatsBufferMem) = createBuffer(
+        sizeof(RayStats),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    vkMapMemory(vk.device, vk.rayStatsBufferMem, 0, VK_WHOLE_SIZE, 0, (void**)&vk.rayStats);
+    memset(vk.rayStats, 0, sizeof(RayStats));
+}
+
+// Bindings 9 and 10 are part of the shared layout, so the buffers exist even when wavefront mode is never used.
+void createWavefrontBuffers()
+{
+    const VkDeviceSize pathCount = WIDTH * HEIGHT;
+    const VkDeviceSize raySortSize = sizeof(uint32_t) * (1 + 2 * WAVEFRONT_SORT_BUCKETS + pathCount);
+
+    std::tie(vk.pathStateBuffer, vk.pathStateBufferMem) = createBuffer(
+        WAVEFRONT_PATH_STATE_SIZE * pathCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.raySortBuffer, vk.raySortBufferMem) = createBuffer(
+        raySortSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // The histogram has to start at zero, WAVEFRONT_SCAN clears it again after every use.
+    vkResetCommandBuffer(vk.commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
+    vkCmdFillBuffer(vk.commandBuffer, vk.raySortBuffer, 0, VK_WHOLE_SIZE, 0);
+    vkEndCommandBuffer(vk.commandBuffer);
+
+    VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &vk.commandBuffer,
+    }; 
+    vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(vk.graphicsQueue);
+}
+
+// Shared by trace_src and the last pass of denoise_src
+const char* tonemap_src = R"(
+// Narkowicz's fit of the ACES filmic curve
+vec3 tonemapACES(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+vec3 linearToSrgb(vec3 c)
+{
+    return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, step(0.0031308, c));
+}
+)";
+
+/*
+trace_src is compiled twice: as the raygen shader of the ray tracing pipeline,
+and with RAY_QUERY defined as a compute shader that walks the same TLAS with rayQueryEXT.
+Only the launch built-ins and trace() differ, so both modes produce the same image.
+*/
+const char* rt_header_src = R"(#version 460
+#extension GL_EXT_ray_tracing : enable
+)";
+
+const char* rayquery_header_src = R"(#version 460
+#extension GL_EXT_ray_query : enable
+#define RAY_QUERY
+)";
+
+const char* trace_src = R"(
+layout(binding = 0) uniform accelerationStructureEXT topLevelAS;
+layout(binding = 1, rgba8) uniform image2D image;
+layout(binding = 2) uniform CameraProperties 
+{
+    mat4 viewInverse;
+    mat4 projInverse;
+    vec3 cameraPos;
+    float yFov_degree;
+} g;
+layout(binding = 3, rgba32f) uniform image2D accumImage;
+layout(binding = 4) buffer RayStats
+{
+    uint anyHitCount;       // any-hit invocations, or candidate tests in ray query mode
+    uint rayCounts[];       // rays traced per bounce depth
+};
+#ifdef RAY_QUERY
+layout(binding = 5) readonly buffer ShaderRecords
+{
+    uint sbtWords[];        // the whole shader binding table, read as plain data
+};
+layout(binding = 6) uniform sampler2D alphaTexture;
+#endif
+layout(binding = 11, rgba16f) uniform image2D illuminationImage;   // denoise_src inputs, written when frame.denoise != 0
+layout(binding = 13, rgba16f) uniform image2D normalDepthImage;
+layout(binding = 14, rgba16f) uniform image2D albedoImage;
+
+layout(push_constant) uniform FrameParams
+{
+    uint frameIndex;        // frames accumulated since the last reset, 0 restarts the accumulation
+    uint samplesPerFrame;
+    uint progressive;
+    float exposure;
+    uint frameSeed;         // increases every frame, decorrelates the non-accumulated noise
+    uint pathTrace;
+    uint maxDepth;
+    uint rrStartDepth;      // first bounce depth that may be terminated by russian roulette
+    uint collectStats;
+    uint hitRecordBase;     // in words: custom data of the first hit record in sbtWords
+    uint hitRecordStride;   // in words
+    uint alphaTest;         // 0 traces every geometry as opaque, so any-hit shaders never run
+    uint shadows;
+    uint cullMask;          // InstanceMask bits: procedural (0x02) or tessellated (0x04) shapes, particles (0x08)
+    uint wavefrontDepth;    // wavefront_src: bounce traced by this dispatch
+    uint sampleIndex;       // wavefront_src: sample of this frame
+    uint sortRays;          // wavefront_src: trace secondary rays in sort key order
+    uint renderWidth;       // traced region of the images, smaller than them below render scale 1
+    uint renderHeight;
+    uint tileX;             // origin of the tile this dispatch covers
+    uint tileY;
+    uint denoise;           // also write the denoiser inputs
+} frame;
+
+struct RayPayload
+{
+    vec3 color;             // surface albedo on hit, background color on miss
+    float hitT;             // negative on miss
+    vec3 normal;            // world space geometric normal, facing the incoming ray
+};
+
+#ifdef RAY_QUERY
+#ifndef WAVEFRONT
+layout(local_size_x = 8, local_size_y = 8) in;
+#endif
+#define LAUNCH_ID (gl_GlobalInvocationID + uvec3(frame.tileX, frame.tileY, 0))
+RayPayload payload;
+#else
+#define LAUNCH_ID (gl_LaunchIDEXT + uvec3(frame.tileX, frame.tileY, 0))
+layout(location = 0) rayPayloadEXT RayPayload payload;
+layout(location = 1) rayPayloadEXT float shadowVisibility;
+#endif
+#define LAUNCH_SIZE uvec3(frame.renderWidth, frame.renderHeight, 1)
+
+const vec3 sunDirection = normalize(vec3(-1.0, 1.0, 1.0));
+const vec3 sunIrradiance = vec3(3.0);
+
+uint pcgHash(uint v)
+{
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint seed)
+{
+    seed = pcgHash(seed);
+    return float(seed) * (1.0 / 4294967296.0);
+}
+
+uint rayFlags()
+{
+    return frame.alphaTest != 0 ? gl_RayFlagsNoneEXT : gl_RayFlagsOpaqueEXT;
+}
+
+#ifdef RAY_QUERY
+vec3 loadRecordVec3(uint word)
+{
+    return uintBitsToFloat(uvec3(sbtWords[word], sbtWords[word + 1], sbtWords[word + 2]));
+}
+
+// Same test as ahit_src. Only non-opaque geometry produces candidates.
+bool alphaTestPasses(vec3 objectOrigin, vec3 objectDirection, float t)
+{
+    if (frame.collectStats != 0) {
+        atomicAdd(anyHitCount, 1);
+    }
+    const vec3 objectPos = objectOrigin + objectDirection * t;
+    return textureLod(alphaTexture, objectPos.xy * 0.5, 0.0).r >= 0.5;
+}
+
+// Same as rint_src for an AABB candidate, tmax is the closest committed hit so far.
+bool proceduralCandidate(
+    int customIndex, int geometryIndex, int primitiveIndex, 
+    vec3 objectOrigin, vec3 objectDirection, float tmax, out float t)
+{
+    const Primitive p = hitPrimitive(customIndex, geometryIndex, primitiveIndex, false);
+    t = intersectShape(hitShape(customIndex, geometryIndex), p, objectOrigin, objectDirection, 0.001);
+    return t >= 0.0 && t <= tmax;
+}
+
+// Same as miss_src and chit_src, except that the hit record is looked up by hand
+// with the indexing rule that the pipeline applies to the SBT.
+void trace(vec3 origin, vec3 direction, uint depth)
+{
+    rayQueryEXT rayQuery;
+    rayQueryInitializeEXT(
+        rayQuery, topLevelAS,
+        rayFlags(), frame.cullMask,
+        origin, 0.001, direction, 100.0);
+
+    while (rayQueryProceedEXT(rayQuery)) {
+        const vec3 objectOrigin = rayQueryGetIntersectionObjectRayOriginEXT(rayQuery, false);
+        const vec3 objectDirection = rayQueryGetIntersectionObjectRayDirectionEXT(rayQuery, false);
+
+        if (rayQueryGetIntersectionTypeEXT(rayQuery, false) == gl_RayQueryCandidateIntersectionAABBEXT) {
+            const float tmax = rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionNoneEXT ? 
+                100.0 : rayQueryGetIntersectionTEXT(rayQuery, true);
+            float t;
+            if (proceduralCandidate(
+                rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, false),
+                rayQueryGetIntersectionGeometryIndexEXT(rayQuery, false),
+                rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, false),
+                objectOrigin, objectDirection, tmax, t)) {
+                rayQueryGenerateIntersectionEXT(rayQuery, t);
+            }
+        }
+        else if (alphaTestPasses(objectOrigin, objectDirection, rayQueryGetIntersectionTEXT(rayQuery, false))) {
+            rayQueryConfirmIntersectionEXT(rayQuery);
+        }
+    }
+
+    if (rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionNoneEXT) {
+        payload.color = vec3(0.0, 0.0, 0.2);
+        payload.hitT = -1.0;
+    }
+    else {
+        const int customIndex = rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, true);
+        const int geometryIndex = rayQueryGetIntersectionGeometryIndexEXT(rayQuery, true);
+        const int primitiveId = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true);
+        const uint record = rayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetEXT(rayQuery, true) + uint(geometryIndex);
+        const uint word = frame.hitRecordBase + record * frame.hitRecordStride;
+        vec3 normal;
+
+        if (customIndex == PROCEDURAL_INSTANCE || customIndex == PARTICLE_INSTANCE) {
+            // Same as chit_procedural_src
+            const uint shape = hitShape(customIndex, geometryIndex);
+            const bool triangles = rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT;
+            const Primitive p = hitPrimitive(customIndex, geometryIndex, primitiveId, triangles);
+            const vec3 objectPos = rayQueryGetIntersectionObjectRayOriginEXT(rayQuery, true) + 
+                rayQueryGetIntersectionObjectRayDirectionEXT(rayQuery, true) * rayQueryGetIntersectionTEXT(rayQuery, true);
+            payload.color = p.color * loadRecordVec3(word);
+            normal = shapeNormal(shape, p, objectPos);
+        }
+        else {
+            // Same as chit_src
+            const vec2 attribs = rayQueryGetIntersectionBarycentricsEXT(rayQuery, true);
+            const SurfaceSample surface = sampleSurface(customIndex, geometryIndex, primitiveId, attribs);
+            if (primitiveId == 1 && customIndex == 2 && geometryIndex == 1) {
+                payload.color = vec3(1.0f - attribs.x - attribs.y, attribs.x, attribs.y);
+            }
+            else {
+                payload.color = loadRecordVec3(word) * surface.albedo;     // CustomData::color
+            }
+            normal = surface.normal;
+        }
+
+        const vec3 worldNormal = normalize(normal * mat3(rayQueryGetIntersectionWorldToObjectEXT(rayQuery, true)));
+        payload.normal = faceforward(worldNormal, direction, worldNormal);
+        payload.hitT = rayQueryGetIntersectionTEXT(rayQuery, true);
+    }
+
+    if (frame.collectStats != 0) {
+        atomicAdd(rayCounts[depth], 1);
+    }
+}
+float traceShadow(vec3 origin, vec3 direction)
+{
+    rayQueryEXT rayQuery;
+    rayQueryInitializeEXT(
+        rayQuery, topLevelAS,
+        rayFlags() | gl_RayFlagsTerminateOnFirstHitEXT, frame.cullMask,
+        origin, 0.001, direction, 100.0);
+
+    while (rayQueryProceedEXT(rayQuery)) {
+        const vec3 objectOrigin = rayQueryGetIntersectionObjectRayOriginEXT(rayQuery, false);
+        const vec3 objectDirection = rayQueryGetIntersectionObjectRayDirectionEXT(rayQuery, false);
+
+        if (rayQueryGetIntersectionTypeEXT(rayQuery, false) == gl_RayQueryCandidateIntersectionAABBEXT) {
+            const float tmax = rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionNoneEXT ? 
+                100.0 : rayQueryGetIntersectionTEXT(rayQuery, true);
+            float t;
+            if (proceduralCandidate(
+                rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, false),
+                rayQueryGetIntersectionGeometryIndexEXT(rayQuery, false),
+                rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, false),
+                objectOrigin, objectDirection, tmax, t)) {
+                rayQueryGenerateIntersectionEXT(rayQuery, t);
+            }
+        }
+        else if (alphaTestPasses(objectOrigin, objectDirection, rayQueryGetIntersectionTEXT(rayQuery, false))) {
+            rayQueryConfirmIntersectionEXT(rayQuery);
+        }
+    }
+
+    return rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionNoneEXT ? 1.0 : 0.0;
+}
+#else
+void trace(vec3 origin, vec3 direction, uint depth)
+{
+    payload.hitT = -1.0;
+
+    traceRayEXT(
+        topLevelAS,                         // topLevel
+        rayFlags(), frame.cullMask,         // rayFlags, cullMask
+        0, 1, 0,                            // sbtRecordOffset, sbtRecordStride, missIndex
+        origin, 0.001, direction, 100.0,    // origin, tmin, direction, tmax
+        0);                                 // payload
+
+    if (frame.collectStats != 0) {
+        atomicAdd(rayCounts[depth], 1);
+    }
+}
+
+// Any hit that survives the alpha test ends the search, and the closest hit shader is skipped:
+// visibility stays 0 unless shadow_miss_src runs.
+float traceShadow(vec3 origin, vec3 direction)
+{
+    shadowVisibility = 0.0;
+
+    traceRayEXT(
+        topLevelAS,
+        rayFlags() | gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsSkipClosestHitShaderEXT, frame.cullMask,
+        0, 1, 1,                            // missIndex 1: shadow_miss_src
+        origin, 0.001, direction, 100.0,
+        1);                                 // payload: shadowVisibility
+
+    return shadowVisibility;
+}
+#endif
+
+// Light reflected from the sun by a white lambertian surface (E * cos / pi).
+// Shadow rays are not counted in the ray stats.
+vec3 sunLight(vec3 position, vec3 normal)
+{
+    const float cosTheta = dot(normal, sunDirection);
+    if (frame.shadows == 0 || cosTheta <= 0.0) {
+        return vec3(0.0);
+    }
+    return sunIrradiance * (cosTheta / 3.14159265359) * traceShadow(position + normal * 0.001, sunDirection);
+}
+
+vec3 cameraRay(vec2 screenCoord)
+{
+    const vec2 ndc = screenCoord/vec2(LAUNCH_SIZE.xy) * 2.0 - 1.0;
+    const vec4 target = g.projInverse * vec4(ndc, 1.0, 1.0);     // a point on the far plane in camera space
+    return normalize((g.viewInverse * vec4(target.xyz, 0.0)).xyz);
+}
+
+vec3 skyRadiance(vec3 direction)
+{
+    return mix(vec3(1.0), vec3(0.5, 0.7, 1.0), 0.5 * (direction.y + 1.0));
+}
+
+vec3 cosineSampleHemisphere(vec3 n, inout uint seed)
+{
+    const float phi = 6.28318530718 * random(seed);
+    const float r = sqrt(random(seed));
+    const vec3 t = normalize(abs(n.x) > 0.9 ? cross(n, vec3(0, 1, 0)) : cross(n, vec3(1, 0, 0)));
+    const vec3 b = cross(n, t);
+    return normalize(r * cos(phi) * t + r * sin(phi) * b + sqrt(max(0.0, 1.0 - r * r)) * n);
+}
+
+vec3 primaryAlbedo = vec3(1.0);
+vec4 primaryNormalDepth = vec4(0.0, 0.0, 0.0, -1.0);
+
+// Keeps the surface seen by the camera ray for the denoiser guides; the sky is left undemodulated.
+void recordPrimaryHit()
+{
+    primaryAlbedo = payload.hitT < 0.0 ? vec3(1.0) : payload.color;
+    primaryNormalDepth = vec4(payload.normal, payload.hitT);
+}
+
+// One path vertex: trace, add the sky or the sun light, then pick the next direction.
+// Returns false once the path ends. Shared by pathTrace() and the wavefront trace stage.
+bool pathBounce(inout vec3 origin, inout vec3 direction, inout vec3 radiance, inout vec3 throughput, uint depth, inout uint seed)
+{
+    trace(origin, direction, depth);
+    if (depth == 0) {
+        recordPrimaryHit();
+    }
+
+    if (payload.hitT < 0.0) {
+        radiance += throughput * skyRadiance(direction);
+        return false;
+    }
+
+    origin += direction * payload.hitT;
+    radiance += throughput * payload.color * sunLight(origin, payload.normal);
+
+    // Lambertian surface with cosine weighted sampling: brdf * cos / pdf == albedo
+    throughput *= payload.color;
+
+    if (depth + 1 >= frame.rrStartDepth) {
+        const float survival = clamp(max(throughput.r, max(throughput.g, throughput.b)), 0.05, 0.95);
+        if (random(seed) >= survival) {
+            return false;
+        }
+        throughput /= survival;
+    }
+
+    origin += payload.normal * 0.001;
+    direction = cosineSampleHemisphere(payload.normal, seed);
+    return true;
+}
+
+// The bounce loop lives here instead of in the hit shader, so the pipeline never recurses:
+// each traceRayEXT returns the surface data and raygen decides how to continue the path.
+vec3 pathTrace(vec3 origin, vec3 direction, inout uint seed)
+{
+    vec3 radiance = vec3(0.0);
+    vec3 throughput = vec3(1.0);
+
+    for (uint depth = 0; depth < frame.maxDepth; ++depth) {
+        if (!pathBounce(origin, direction, radiance, throughput, depth, seed)) {
+            break;
+        }
+    }
+
+    return radiance;
+}
+
+vec3 shade(vec2 screenCoord, inout uint seed)
+{
+    const vec3 direction = cameraRay(screenCoord);
+
+    if (frame.pathTrace != 0) {
+        return pathTrace(g.cameraPos, direction, seed);
+    }
+
+    trace(g.cameraPos, direction, 0);
+    recordPrimaryHit();
+    if (frame.shadows == 0 || payload.hitT < 0.0) {
+        return payload.color;
+    }
+    return payload.color * (0.3 + sunLight(g.cameraPos + direction * payload.hitT, payload.normal));
+}
+
+// Guide images for denoise_src, from the primary hit of the last shade() call
+void storeDenoiseGuides(ivec2 pixel)
+{
+    imageStore(normalDepthImage, pixel, primaryNormalDepth);
+    imageStore(albedoImage, pixel, vec4(primaryAlbedo, 1.0));
+}
+
+// Demodulated, so the filter blurs the lighting but not the texture detail; denoise_src multiplies the albedo back.
+void storeIllumination(ivec2 pixel, vec3 radiance, vec3 albedo)
+{
+    imageStore(illuminationImage, pixel, vec4(radiance / max(albedo, vec3(0.01)), 0.0));
+}
+
+#ifndef WAVEFRONT
+void main()
+{
+    if (any(greaterThanEqual(LAUNCH_ID.xy, LAUNCH_SIZE.xy))) {
+        return;     // partial workgroups at the image border in ray query mode
+    }
+
+    const ivec2 pixel = ivec2(LAUNCH_ID.xy);
+    uint seed = pcgHash(LAUNCH_ID.y * LAUNCH_SIZE.x + LAUNCH_ID.x) ^ pcgHash(frame.frameSeed);
+
+    if (frame.progressive == 0) {
+        const vec3 color = shade(vec2(pixel) + vec2(0.5), seed);
+        if (frame.denoise != 0) {
+            storeDenoiseGuides(pixel);
+            storeIllumination(pixel, color, primaryAlbedo);
+        }
+        if (frame.pathTrace != 0) {
+            imageStore(image, pixel, vec4(linearToSrgb(tonemapACES(color * frame.exposure)), 1.0));
+        } else {
+            imageStore(image, pixel, vec4(color, 0.0));
+        }
+        return;
+    }
+
+    vec3 sum = vec3(0.0);
+    for (uint i = 0; i < frame.samplesPerFrame; ++i) {
+        const vec2 jitter = vec2(random(seed), random(seed));
+        sum += shade(vec2(pixel) + jitter, seed);
+    }
+
+    vec4 accum = vec4(sum, float(frame.samplesPerFrame));
+    if (frame.frameIndex > 0) {
+        accum += imageLoad(accumImage, pixel);
+    }
+    imageStore(accumImage, pixel, accum);
+
+    const vec3 color = accum.rgb / accum.a;
+    if (frame.denoise != 0) {
+        storeDenoiseGuides(pixel);      // of the last sample, the jitter moves them by less than a pixel
+        storeIllumination(pixel, color, primaryAlbedo);
+    }
+    imageStore(image, pixel, vec4(linearToSrgb(tonemapACES(color * frame.exposure)), 1.0));
+}
+#endif
+)";
+
+/*
+Wavefront path tracing, appended to the ray query build of trace_src with WAVEFRONT and WAVEFRONT_STAGE defined.
+Instead of one thread walking its whole path (pathTrace()), every bounce is its own dispatch over all paths:
+
+    GENERATE                    camera rays into paths[], order is the pixel order
+    per bounce:
+        TRACE                   one pathBounce() per live path, writes the sort key of its next ray
+        SCAN, SCATTER           counting sort of the live paths by key into order[] (only with sortRays)
+    RESOLVE                     radiance into the output / accumulation image like main() in trace_src
+
+The key puts rays with the same direction octant and nearby origins (Morton order on an 8x8x8 grid) next
+to each other, so a subgroup walks similar parts of the BVH and shades similar materials.
+*/
+const char* wavefront_src = R"(
+#define WAVEFRONT_GENERATE 0
+#define WAVEFRONT_TRACE 1
+#define WAVEFRONT_SCAN 2
+#define WAVEFRONT_SCATTER 3
+#define WAVEFRONT_RESOLVE 4
+
+#define SORT_BUCKETS 4096           // 8 octants x 512 Morton cells, WAVEFRONT_SORT_BUCKETS
+#define PATH_DONE 0xFFFFFFFFu       // key of a terminated path
+
+struct PathState
+{
+    vec3 origin;
+    uint key;               // sort key of the next ray, PATH_DONE once terminated
+    vec3 direction;
+    uint seed;
+    vec3 throughput;
+    float pad0;
+    vec3 radiance;          // summed over the samples of this frame
+    float pad1;
+};
+
+layout(binding = 9) buffer PathStates
+{
+    PathState paths[];      // one per pixel
+};
+layout(binding = 10) buffer RaySort
+{
+    uint sortedCount;       // live paths in order[]
+    uint bucketCounts[SORT_BUCKETS];
+    uint bucketOffsets[SORT_BUCKETS];
+    uint order[];           // path indices in key order
+};
+
+layout(local_size_x = 256) in;
+
+const vec3 sortBoundsMin = vec3(-8.0);
+const vec3 sortBoundsMax = vec3(8.0);
+
+// 3 bits spread to every third bit
+uint spreadBits3(uint v)
+{
+    return (v & 1u) | ((v & 2u) << 2) | ((v & 4u) << 4);
+}
+
+uint sortKey(vec3 origin, vec3 direction)
+{
+    const uint octant = (direction.x < 0.0 ? 1u : 0u) | (direction.y < 0.0 ? 2u : 0u) | (direction.z < 0.0 ? 4u : 0u);
+    const uvec3 cell = uvec3(clamp((origin - sortBoundsMin) / (sortBoundsMax - sortBoundsMin), 0.0, 0.999) * 8.0);
+    const uint morton = spreadBits3(cell.x) | (spreadBits3(cell.y) << 1) | (spreadBits3(cell.z) << 2);
+    return (octant << 9) | morton;
+}
+
+uint sampleCount()
+{
+    return frame.progressive != 0 ? frame.samplesPerFrame : 1;
+}
+
+#if WAVEFRONT_STAGE == WAVEFRONT_SCAN
+shared uint partialSums[256];
+#endif
+
+void main()
+{
+    const uint pathCount = LAUNCH_SIZE.x * LAUNCH_SIZE.y;
+    const uint i = gl_GlobalInvocationID.x;
+
+#if WAVEFRONT_STAGE == WAVEFRONT_GENERATE
+    if (i >= pathCount) {
+        return;
+    }
+    const uvec2 pixel = uvec2(i % LAUNCH_SIZE.x, i / LAUNCH_SIZE.x);
+
+    uint seed = frame.sampleIndex == 0 ? pcgHash(i) ^ pcgHash(frame.frameSeed) : paths[i].seed;
+    const vec2 jitter = frame.progressive != 0 ? vec2(random(seed), random(seed)) : vec2(0.5);
+
+    paths[i].origin = g.cameraPos;
+    paths[i].direction = cameraRay(vec2(pixel) + jitter);
+    paths[i].throughput = vec3(1.0);
+    paths[i].seed = seed;
+    paths[i].key = 0;
+    if (frame.sampleIndex == 0) {
+        paths[i].radiance = vec3(0.0);
+    }
+
+#elif WAVEFRONT_STAGE == WAVEFRONT_TRACE
+    // Primary rays keep the pixel order, they are coherent already.
+    const bool sorted = frame.sortRays != 0 && frame.wavefrontDepth > 0;
+    if (i >= (sorted ? sortedCount : pathCount)) {
+        return;
+    }
+    const uint index = sorted ? order[i] : i;
+
+    PathState p = paths[index];
+    if (p.key == PATH_DONE) {
+        return;     // unsorted order still visits the terminated paths
+    }
+
+    const bool alive = pathBounce(p.origin, p.direction, p.radiance, p.throughput, frame.wavefrontDepth, p.seed);
+    if (frame.denoise != 0 && frame.wavefrontDepth == 0 && frame.sampleIndex == 0) {
+        storeDenoiseGuides(ivec2(index % LAUNCH_SIZE.x, index / LAUNCH_SIZE.x));
+    }
+    if (alive && frame.wavefrontDepth + 1 < frame.maxDepth) {
+        p.key = sortKey(p.origin, p.direction);
+        if (frame.sortRays != 0) {
+            atomicAdd(bucketCounts[p.key], 1);
+        }
+    }
+    else {
+        p.key = PATH_DONE;
+    }
+    paths[index] = p;
+
+#elif WAVEFRONT_STAGE == WAVEFRONT_SCAN
+    // A single workgroup, 16 buckets per thread: exclusive prefix sum of bucketCounts into bucketOffsets.
+    const uint bucketsPerThread = SORT_BUCKETS / 256;
+    const uint first = gl_LocalInvocationID.x * bucketsPerThread;
+
+    uint sum = 0;
+    for (uint b = 0; b < bucketsPerThread; ++b) {
+        sum += bucketCounts[first + b];
+    }
+    partialSums[gl_LocalInvocationID.x] = sum;
+    barrier();
+
+    if (gl_LocalInvocationID.x == 0) {
+        uint total = 0;
+        for (uint t = 0; t < 256; ++t) {
+            const uint count = partialSums[t];
+            partialSums[t] = total;
+            total += count;
+        }
+        sortedCount = total;
+    }
+    barrier();
+
+    uint offset = partialSums[gl_LocalInvocationID.x];
+    for (uint b = 0; b < bucketsPerThread; ++b) {
+        const uint count = bucketCounts[first + b];
+        bucketOffsets[first + b] = offset;
+        bucketCounts[first + b] = 0;    // ready for the next TRACE
+        offset += count;
+    }
+
+#elif WAVEFRONT_STAGE == WAVEFRONT_SCATTER
+    if (i >= pathCount) {
+        return;
+    }
+    const uint key = paths[i].key;
+    if (key != PATH_DONE) {
+        order[atomicAdd(bucketOffsets[key], 1)] = i;
+    }
+
+#elif WAVEFRONT_STAGE == WAVEFRONT_RESOLVE
+    if (i >= pathCount) {
+        return;
+    }
+    const ivec2 pixel = ivec2(i % LAUNCH_SIZE.x, i / LAUNCH_SIZE.x);
+    const vec3 sum = paths[i].radiance;
+
+    if (frame.progressive == 0) {
+        if (frame.denoise != 0) {
+            storeIllumination(pixel, sum, imageLoad(albedoImage, pixel).rgb);    // written by TRACE at depth 0
+        }
+        imageStore(image, pixel, vec4(linearToSrgb(tonemapACES(sum * frame.exposure)), 1.0));
+        return;
+    }
+
+    vec4 accum = vec4(sum, float(sampleCount()));
+    if (frame.frameIndex > 0) {
+        accum += imageLoad(accumImage, pixel);
+    }
+    imageStore(accumImage, pixel, accum);
+
+    const vec3 color = accum.rgb / accum.a;
+    if (frame.denoise != 0) {
+        storeIllumination(pixel, color, imageLoad(albedoImage, pixel).rgb);
+    }
+    imageStore(image, pixel, vec4(linearToSrgb(tonemapACES(color * frame.exposure)), 1.0));
+#endif
+})";
+
+/*
+Instance frustum culling ahead of the per frame TLAS build, one thread per instance.
+The visible instances are copied as raw words, so their custom index, mask and shader binding table
+offset come along; only their order, i.e. gl_InstanceID, changes.
+Rays leaving the view (shadows, bounces) no longer hit the culled instances either.
+*/
+const char* instance_cull_src = R"(
+layout(local_size_x = 64) in;
+
+layout(binding = 2) uniform CameraProperties 
+{
+    mat4 viewInverse;
+    mat4 projInverse;
+    vec3 cameraPos;
+    float yFov_degree;
+} g;
+layout(binding = 15) readonly buffer Instances
+{
+    uint instanceWords[];   // VkAccelerationStructureInstanceKHR, 16 words each
+};
+layout(binding = 16) readonly buffer InstanceBounds
+{
+    vec4 instanceBounds[];  // world space min, max per instance
+};
+layout(binding = 17) buffer CulledInstances
+{
+    uint primitiveCount;    // VkAccelerationStructureBuildRangeInfoKHR read by the indirect build
+    uint primitiveOffset;
+    uint firstVertex;
+    uint transformOffset;
+    uint culledWords[];     // the visible instances, in no particular order
+};
+
+layout(push_constant) uniform CullParams
+{
+    uint instanceCount;
+    float aspect;
+} params;
+
+// Whether the box is completely on the negative side of the plane through the camera with normal n
+bool outside(vec3 n, vec3 boundsMin, vec3 boundsMax)
+{
+    const vec3 corner = mix(boundsMin, boundsMax, step(0.0, n));    // the corner furthest along n
+    return dot(n, corner - g.cameraPos) < 0.0;
+}
+
+void main()
+{
+    const uint i = gl_GlobalInvocationID.x;
+    if (i >= params.instanceCount) {
+        return;
+    }
+
+    // Camera basis of cameraRay() in trace_src; the planes need no normalization for a sign test.
+    const vec3 right = g.viewInverse[0].xyz;
+    const vec3 up = g.viewInverse[1].xyz;
+    const vec3 forward = -g.viewInverse[2].xyz;
+    const float tanY = tan(radians(g.yFov_degree) * 0.5);
+    const float tanX = tanY * params.aspect;
+
+    const vec3 boundsMin = instanceBounds[2 * i].xyz;
+    const vec3 boundsMax = instanceBounds[2 * i + 1].xyz;
+    if (outside(forward, boundsMin, boundsMax) ||
+        outside(tanX * forward - right, boundsMin, boundsMax) ||
+        outside(tanX * forward + right, boundsMin, boundsMax) ||
+        outside(tanY * forward - up, boundsMin, boundsMax) ||
+        outside(tanY * forward + up, boundsMin, boundsMax)) {
+        return;
+    }
+
+    const uint slot = atomicAdd(primitiveCount, 1);
+    for (uint w = 0; w < 16; ++w) {
+        culledWords[slot * 16 + w] = instanceWords[i * 16 + w];
+    }
+})";
+
+/*
+Scene generator for the TLAS stress test: writes params.count instances behind the scene instances, each one a copy
+of a random template (one per static BLAS, with its hit records) under a random rotation, uniform scale and position
+inside the field. The scale makes the largest template extent half the mean spacing, so the instances rarely overlap
+whatever the count. The world bounds for instance_cull_src are written along with them.
+*/
+const char* instance_gen_src = R"(
+layout(local_size_x = 64) in;
+
+struct InstanceTemplate
+{
+    uint words[16];     // VkAccelerationStructureInstanceKHR, the transform words are ignored
+    vec4 boundsMin;     // object space
+    vec4 boundsMax;
+};
+
+layout(binding = 15) writeonly buffer Instances
+{
+    uint instanceWords[];
+};
+layout(binding = 16) writeonly buffer InstanceBounds
+{
+    vec4 instanceBounds[];
+};
+layout(binding = 18) readonly buffer InstanceTemplates
+{
+    InstanceTemplate templates[];
+};
+
+layout(push_constant) uniform GenParams
+{
+    uint first;         // index of the first generated instance
+    uint count;
+    uint templateCount;
+    float spacing;      // mean distance between neighbouring instances
+    vec4 fieldMin;
+    vec4 fieldMax;
+} params;
+
+uint pcgHash(uint v)
+{
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint seed)
+{
+    seed = pcgHash(seed);
+    return float(seed) * (1.0 / 4294967296.0);
+}
+
+// Uniformly distributed rotation from a random unit quaternion (Shoemake)
+mat3 randomRotation(inout uint seed)
+{
+    const float u = random(seed);
+    const float v = 6.2831853 * random(seed);
+    const float w = 6.2831853 * random(seed);
+    const vec4 q = vec4(sqrt(1.0 - u) * sin(v), sqrt(1.0 - u) * cos(v), sqrt(u) * sin(w), sqrt(u) * cos(w));
+    return mat3(
+        1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y),
+        2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x),
+        2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+}
+
+void main()
+{
+    const uint i = gl_GlobalInvocationID.x;
+    if (i >= params.count) {
+        return;
+    }
+
+    uint seed = pcgHash(i);
+    const uint templateIndex = min(uint(random(seed) * params.templateCount), params.templateCount - 1);
+    const vec3 boundsMin = templates[templateIndex].boundsMin.xyz;
+    const vec3 boundsMax = templates[templateIndex].boundsMax.xyz;
+    const vec3 center = 0.5 * (boundsMin + boundsMax);
+    const vec3 halfExtent = 0.5 * (boundsMax - boundsMin);
+
+    const float scale = 0.25 * params.spacing / max(max(halfExtent.x, halfExtent.y), max(halfExtent.z, 1e-6));
+    const mat3 m = randomRotation(seed) * scale;
+    const vec3 position = mix(params.fieldMin.xyz, params.fieldMax.xyz, vec3(random(seed), random(seed), random(seed)));
+    const vec3 translation = position - m * center;    // the template center lands on position
+
+    // VkTransformMatrixKHR is a row major 3x4 matrix
+    const uint base = (params.first + i) * 16;
+    for (uint row = 0; row < 3; ++row) {
+        instanceWords[base + row * 4 + 0] = floatBitsToUint(m[0][row]);
+        instanceWords[base + row * 4 + 1] = floatBitsToUint(m[1][row]);
+        instanceWords[base + row * 4 + 2] = floatBitsToUint(m[2][row]);
+        instanceWords[base + row * 4 + 3] = floatBitsToUint(translation[row]);
+    }
+    for (uint w = 12; w < 16; ++w) {
+        instanceWords[base + w] = templates[templateIndex].words[w];
+    }
+
+    // World extent of the rotated box along each axis
+    const vec3 worldHalfExtent = abs(m[0]) * halfExtent.x + abs(m[1]) * halfExtent.y + abs(m[2]) * halfExtent.z;
+    instanceBounds[2 * (params.first + i)] = vec4(position - worldHalfExtent, 0.0);
+    instanceBounds[2 * (params.first + i) + 1] = vec4(position + worldHalfExtent, 0.0);
+})";
+
+/*
+Edge-avoiding a-trous wavelet filter in the spirit of SVGF, run after the trace on the guide images from trace_src.
+Compiled once per DenoisePass with DENOISE_PASS defined:
+
+    VARIANCE                    luminance variance of each pixel from its 3x3 neighbours on the same surface, A -> B
+    ATROUS (x iterations)       5x5 B3 spline taps spaced 1 << iteration apart, ping-pong between B and A
+    MODULATE                    illumination times albedo, tonemapped into the output image
+
+The normal and distance weights stop the filter at geometric edges, the luminance weight shrinks with the
+estimated variance so converged pixels are left alone. Unlike full SVGF there is no temporal reprojection;
+in progressive mode the accumulated mean is filtered instead.
+*/
+const char* denoise_src = R"(
+#define DENOISE_VARIANCE 0
+#define DENOISE_ATROUS_B_TO_A 1
+#define DENOISE_ATROUS_A_TO_B 2
+#define DENOISE_MODULATE_A 3
+#define DENOISE_MODULATE_B 4
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 1, rgba8) uniform image2D image;
+layout(binding = 11, rgba16f) uniform image2D illuminationA;     // rgb illumination, a variance (except the trace output)
+layout(binding = 12, rgba16f) uniform image2D illuminationB;
+layout(binding = 13, rgba16f) uniform image2D normalDepthImage;
+layout(binding = 14, rgba16f) uniform image2D albedoImage;
+
+layout(push_constant) uniform DenoiseParams
+{
+    uint renderWidth;
+    uint renderHeight;
+    uint stepWidth;         // distance between the taps of this a-trous iteration
+    uint tonemap;           // MODULATE: 0 writes the color as is, like the trace outside path tracing and progressive mode
+    float exposure;
+} params;
+
+#if DENOISE_PASS == DENOISE_ATROUS_B_TO_A || DENOISE_PASS == DENOISE_MODULATE_B
+#define SOURCE illuminationB
+#define TARGET illuminationA
+#else
+#define SOURCE illuminationA
+#define TARGET illuminationB
+#endif
+
+const float sigmaNormal = 128.0;        // exponent of the normal similarity
+const float sigmaDepth = 0.02;          // allowed relative distance change per pixel of step
+const float sigmaLuminance = 4.0;       // in standard deviations
+
+float luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Weight of a neighbour q for the center p from the guide images; the sky only mixes with the sky.
+float geometryWeight(vec4 p, vec4 q, float stepWidth)
+{
+    if (p.w < 0.0 || q.w < 0.0) {
+        return p.w < 0.0 && q.w < 0.0 ? 1.0 : 0.0;
+    }
+    const float normalWeight = pow(max(dot(p.xyz, q.xyz), 0.0), sigmaNormal);
+    const float depthWeight = exp(-abs(p.w - q.w) / (sigmaDepth * p.w * stepWidth + 1e-4));
+    return normalWeight * depthWeight;
+}
+
+void main()
+{
+    const ivec2 size = ivec2(params.renderWidth, params.renderHeight);
+    const ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, size))) {
+        return;
+    }
+
+#if DENOISE_PASS == DENOISE_VARIANCE
+    const vec4 guide = imageLoad(normalDepthImage, pixel);
+
+    float weightSum = 0.0;
+    float moment1 = 0.0;
+    float moment2 = 0.0;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            const ivec2 q = clamp(pixel + ivec2(x, y), ivec2(0), size - 1);
+            const float w = geometryWeight(guide, imageLoad(normalDepthImage, q), 1.0);
+            const float l = luminance(imageLoad(SOURCE, q).rgb);
+            weightSum += w;
+            moment1 += w * l;
+            moment2 += w * l * l;
+        }
+    }
+    moment1 /= weightSum;       // the center always has weight 1
+    moment2 /= weightSum;
+    imageStore(TARGET, pixel, vec4(imageLoad(SOURCE, pixel).rgb, max(moment2 - moment1 * moment1, 0.0)));
+
+#elif DENOISE_PASS == DENOISE_ATROUS_B_TO_A || DENOISE_PASS == DENOISE_ATROUS_A_TO_B
+    const float kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+    const vec4 center = imageLoad(SOURCE, pixel);
+    const vec4 guide = imageLoad(normalDepthImage, pixel);
+    const float centerLuminance = luminance(center.rgb);
+    const float luminanceScale = sigmaLuminance * sqrt(center.a) + 1e-4;
+
+    vec3 colorSum = vec3(0.0);
+    float varianceSum = 0.0;
+    float weightSum = 0.0;
+    for (int y = -2; y <= 2; ++y) {
+        for (int x = -2; x <= 2; ++x) {
+            const ivec2 q = pixel + ivec2(x, y) * int(params.stepWidth);
+            if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size))) {
+                continue;
+            }
+            const vec4 sampleValue = imageLoad(SOURCE, q);
+            const float w = kernel[abs(x)] * kernel[abs(y)] *
+                geometryWeight(guide, imageLoad(normalDepthImage, q), float(params.stepWidth)) *
+                exp(-abs(centerLuminance - luminance(sampleValue.rgb)) / luminanceScale);
+            colorSum += w * sampleValue.rgb;
+            varianceSum += w * w * sampleValue.a;
+            weightSum += w;
+        }
+    }
+    // The center tap keeps weightSum above zero; variances combine with the squared weights.
+    imageStore(TARGET, pixel, vec4(colorSum / weightSum, varianceSum / (weightSum * weightSum)));
+
+#else
+    vec3 color = imageLoad(SOURCE, pixel).rgb * imageLoad(albedoImage, pixel).rgb;
+    if (params.tonemap != 0) {
+        color = linearToSrgb(tonemapACES(color * params.exposure));
+    }
+    imageStore(image, pixel, vec4(color, 1.0));
+#endif
+})";
+
+const char* miss_src = R"(
+#version 460
+#extension GL_EXT_ray_tracing : enable
+
+struct RayPayload
+{
+    vec3 color;
+    float hitT;
+    vec3 normal;
+};
+
+layout(location = 0) rayPayloadInEXT RayPayload payload;
+
+void main()
+{
+    payload.color = vec3(0.0, 0.0, 0.2);
+    payload.hitT = -1.0;
+})";
+
+const char* chit_src = R"(
+layout(shaderRecordEXT) buffer CustomData
+{
+    vec3 color;             // tint, multiplied with the bindless material
+};
+
+struct RayPayload
+{
+    vec3 color;
+    float hitT;
+    vec3 normal;
+};
+
+layout(location = 0) rayPayloadInEXT RayPayload payload;
+hitAttributeEXT vec2 attribs;
+
+void main()
+{
+    const SurfaceSample surface = sampleSurface(gl_InstanceCustomIndexEXT, gl_GeometryIndexEXT, gl_PrimitiveID, attribs);
+
+    if (gl_PrimitiveID == 1 && 
+        gl_InstanceCustomIndexEXT == 2 &&     // the second quad instance, whatever its place in the TLAS
+        gl_GeometryIndexEXT == 1) {
+        payload.color = vec3(1.0f - attribs.x - attribs.y, attribs.x, attribs.y);
+    }
+    else {
+        payload.color = color * surface.albedo;
+    }
+
+    // Normals transform with the inverse transpose of the object-to-world matrix.
+    const vec3 worldNormal = normalize(surface.normal * mat3(gl_WorldToObjectEXT));
+    payload.normal = faceforward(worldNormal, gl_WorldRayDirectionEXT, worldNormal);
+    payload.hitT = gl_HitTEXT;
+})";
+
+const char* shadow_miss_src = R"(
+#version 460
+#extension GL_EXT_ray_tracing : enable
+
+layout(location = 1) rayPayloadInEXT float shadowVisibility;
+
+void main()
+{
+    shadowVisibility = 1.0;
+})";
+
+const char* ahit_src = R"(
+#version 460
+#extension GL_EXT_ray_tracing : enable
+
+layout(binding = 4) buffer RayStats
+{
+    uint anyHitCount;
+};
+layout(binding = 6) uniform sampler2D alphaTexture;
+
+layout(push_constant) uniform FrameParams
+{
+    layout(offset = 32) uint collectStats;
+} frame;
+
+void main()
+{
+    if (frame.collectStats != 0) {
+        atomicAdd(anyHitCount, 1);
+    }
+
+    // Every geometry is a planar quad in the xy plane of the BLAS, so the object space hit point is the texture coordinate.
+    const vec3 objectPos = gl_ObjectRayOriginEXT + gl_ObjectRayDirectionEXT * gl_HitTEXT;
+    if (textureLod(alphaTexture, objectPos.xy * 0.5, 0.0).r < 0.5) {
+        ignoreIntersectionEXT;
+    }
+})";
+
+/*
+Bindless material system, descriptor set 1 (createBindlessResources()). Included by chit_src and
+the ray query compute shader. GeometryData is found at instanceCustomIndex + geometryIndex.
+*/
+const char* bindless_src = R"(
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_EXT_buffer_reference : enable
+
+struct Vertex
+{
+    float position[3];      // float arrays keep the 32 byte QuadVertex stride, a vec3 would be padded to 16
+    float normal[3];
+    float uv[2];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Vertices
+{
+    Vertex v[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Indices
+{
+    uint i[];
+};
+
+struct GeometryData
+{
+    Vertices vertices;
+    Indices indices;
+    uint materialIndex;
+};
+
+struct Material
+{
+    vec3 baseColor;
+    int textureIndex;       // -1: untextured
+};
+
+layout(set = 1, binding = 0) readonly buffer Geometries
+{
+    GeometryData geometries[];
+};
+layout(set = 1, binding = 1) readonly buffer Materials
+{
+    Material materials[];
+};
+layout(set = 1, binding = 2) uniform sampler2D textures[];
+
+struct SurfaceSample
+{
+    vec3 albedo;
+    vec3 normal;            // object space, interpolated
+};
+
+SurfaceSample sampleSurface(int customIndex, int geometryIndex, int primitiveIndex, vec2 barycentrics)
+{
+    const GeometryData geometry = geometries[customIndex + geometryIndex];
+    const uint i0 = geometry.indices.i[3 * primitiveIndex + 0];
+    const uint i1 = geometry.indices.i[3 * primitiveIndex + 1];
+    const uint i2 = geometry.indices.i[3 * primitiveIndex + 2];
+    const Vertex v0 = geometry.vertices.v[i0];
+    const Vertex v1 = geometry.vertices.v[i1];
+    const Vertex v2 = geometry.vertices.v[i2];
+    const vec3 w = vec3(1.0 - barycentrics.x - barycentrics.y, barycentrics.x, barycentrics.y);
+
+    const vec2 uv = 
+        w.x * vec2(v0.uv[0], v0.uv[1]) + 
+        w.y * vec2(v1.uv[0], v1.uv[1]) + 
+        w.z * vec2(v2.uv[0], v2.uv[1]);
+    const vec3 normal = 
+        w.x * vec3(v0.normal[0], v0.normal[1], v0.normal[2]) + 
+        w.y * vec3(v1.normal[0], v1.normal[1], v1.normal[2]) + 
+        w.z * vec3(v2.normal[0], v2.normal[1], v2.normal[2]);
+
+    // Neighbouring rays may hit different materials, hence nonuniformEXT.
+    const Material material = materials[geometry.materialIndex];
+    vec3 albedo = material.baseColor;
+    if (material.textureIndex >= 0) {
+        albedo *= textureLod(textures[nonuniformEXT(material.textureIndex)], uv, 0.0).rgb;
+    }
+    return SurfaceSample(albedo, normalize(normal));
+}
+)";
+
+/*
+Analytic shapes for the AABB BLAS. Included by the intersection shaders, chit_procedural_src
+and the ray query compute shader. Every shape has its own BLAS geometry, so the geometry index is the shape.
+*/
+const char* procedural_src = R"(
+struct Primitive
+{
+    vec3 center;
+    float radius;           // sphere, capsule
+    vec3 extent;            // box: half size, capsule: half segment
+    vec3 color;
+};
+
+layout(binding = 7) readonly buffer ProceduralScene
+{
+    uint geometryBase[4];           // first primitive of each BLAS geometry
+    uint trianglesPerPrimitive[4];  // tessellated BLAS only
+    Primitive primitives[];
+};
+
+// Simulated by particle_sim_src. The first 24 bytes are read in place as the BLAS AABB build input.
+struct Particle
+{
+    float aabb[6];          // min xyz, max xyz
+    float radius;
+    vec3 position;
+    vec3 velocity;
+    vec3 color;
+};
 
-    VkSubmitInfo submitInfo {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &vk.commandBuffer,
-    }; 
-    vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(vk.graphicsQueue);
-}
+layout(binding = 8) buffer Particles
+{
+    Particle particles[];
+};
 
-void createUniformBuffer()
+#define SHAPE_SPHERE 0
+#define SHAPE_BOX 1
+#define SHAPE_CAPSULE 2
+#define PROCEDURAL_INSTANCE 200     // instanceCustomIndex of the procedural and tessellated instances
+#define PARTICLE_INSTANCE 300       // particles are spheres in a single AABB geometry
+
+// All intersections return the ray parameter of the first hit at or after tmin, or -1.
+// The object space direction is not normalized when the instance transform scales.
+float intersectSphere(Primitive p, vec3 ro, vec3 rd, float tmin)
 {
-    struct Data{
-        float cameraPos[3];
-        float yFov_degree;
-    } dataSrc; 
+    const vec3 oc = ro - p.center;
+    const float a = dot(rd, rd);
+    const float b = dot(oc, rd);
+    const float c = dot(oc, oc) - p.radius * p.radius;
+    const float h = b * b - a * c;
+    if (h < 0.0) {
+        return -1.0;
+    }
+    float t = (-b - sqrt(h)) / a;
+    if (t < tmin) {
+        t = (-b + sqrt(h)) / a;
+    }
+    return t >= tmin ? t : -1.0;
+}
 
-    std::tie(vk.uniformBuffer, vk.uniformBufferMem) = createBuffer(
-        sizeof(dataSrc), 
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+float intersectBox(Primitive p, vec3 ro, vec3 rd, float tmin)
+{
+    const vec3 m = 1.0 / rd;
+    const vec3 n = m * (ro - p.center);
+    const vec3 k = abs(m) * p.extent;
+    const vec3 t1 = -n - k;
+    const vec3 t2 = -n + k;
+    const float tNear = max(max(t1.x, t1.y), t1.z);
+    const float tFar = min(min(t2.x, t2.y), t2.z);
+    if (tNear > tFar) {
+        return -1.0;
+    }
+    const float t = tNear >= tmin ? tNear : tFar;
+    return t >= tmin ? t : -1.0;
+}
 
-    void* dst;
-    vkMapMemory(vk.device, vk.uniformBufferMem, 0, sizeof(dataSrc), 0, &dst);
-    *(Data*) dst = {0, 0, 10, 60};
-    vkUnmapMemory(vk.device, vk.uniformBufferMem);
+// Inigo Quilez's capsule intersection, entering hits only
+float intersectCapsule(Primitive p, vec3 ro, vec3 rd, float tmin)
+{
+    const float len = length(rd);
+    rd /= len;
+
+    const vec3 pa = p.center - p.extent;
+    const vec3 ba = 2.0 * p.extent;
+    const vec3 oa = ro - pa;
+    const float baba = dot(ba, ba);
+    const float bard = dot(ba, rd);
+    const float baoa = dot(ba, oa);
+    const float rdoa = dot(rd, oa);
+    const float oaoa = dot(oa, oa);
+    const float a = baba - bard * bard;
+    float b = baba * rdoa - baoa * bard;
+    float c = baba * oaoa - baoa * baoa - p.radius * p.radius * baba;
+    float h = b * b - a * c;
+    float t = -1.0;
+    if (h >= 0.0) {
+        t = (-b - sqrt(h)) / a;
+        const float y = baoa + t * bard;
+        if (y <= 0.0 || y >= baba) {
+            // caps
+            const vec3 oc = y <= 0.0 ? oa : ro - (pa + ba);
+            b = dot(rd, oc);
+            c = dot(oc, oc) - p.radius * p.radius;
+            h = b * b - c;
+            t = h > 0.0 ? -b - sqrt(h) : -1.0;
+        }
+    }
+    return t >= tmin * len ? t / len : -1.0;
 }
 
-const char* raygen_src = R"(
-#version 460
-#extension GL_EXT_ray_tracing : enable
+float intersectShape(uint shape, Primitive p, vec3 ro, vec3 rd, float tmin)
+{
+    switch (shape) {
+    case SHAPE_SPHERE: return intersectSphere(p, ro, rd, tmin);
+    case SHAPE_BOX: return intersectBox(p, ro, rd, tmin);
+    default: return intersectCapsule(p, ro, rd, tmin);
+    }
+}
 
-layout(binding = 0) uniform accelerationStructureEXT topLevelAS;
-layout(binding = 1, rgba8) uniform image2D image;
-layout(binding = 2) uniform CameraProperties 
+uint hitShape(int customIndex, uint geometryIndex)
 {
-    vec3 cameraPos;
-    float yFov_degree;
-} g;
+    return customIndex == PARTICLE_INSTANCE ? SHAPE_SPHERE : geometryIndex;
+}
 
-layout(location = 0) rayPayloadEXT vec3 hitValue;
+// Primitive behind a hit or candidate, triangles for the tessellated instance
+Primitive hitPrimitive(int customIndex, uint geometryIndex, uint primitiveIndex, bool triangles)
+{
+    if (customIndex == PARTICLE_INSTANCE) {
+        const Particle particle = particles[primitiveIndex];
+        return Primitive(particle.position, particle.radius, vec3(0.0), particle.color);
+    }
+    const uint primitive = triangles ? primitiveIndex / trianglesPerPrimitive[geometryIndex] : primitiveIndex;
+    return primitives[geometryBase[geometryIndex] + primitive];
+}
 
-void main() 
+// Object space normal at a point on the surface. Also used for the tessellated shapes, which shade smooth.
+vec3 shapeNormal(uint shape, Primitive p, vec3 pos)
 {
-    const vec3 cameraX = vec3(1, 0, 0);
-    const vec3 cameraY = vec3(0, -1, 0);
-    const vec3 cameraZ = vec3(0, 0, -1);
-    const float aspect_y = tan(radians(g.yFov_degree) * 0.5);
-    const float aspect_x = aspect_y * float(gl_LaunchSizeEXT.x) / float(gl_LaunchSizeEXT.y);
+    if (shape == SHAPE_SPHERE) {
+        return normalize(pos - p.center);
+    }
+    if (shape == SHAPE_BOX) {
+        const vec3 d = (pos - p.center) / p.extent;
+        const vec3 a = abs(d);
+        return a.x > a.y && a.x > a.z ? vec3(sign(d.x), 0, 0) : 
+               a.y > a.z              ? vec3(0, sign(d.y), 0) : 
+                                        vec3(0, 0, sign(d.z));
+    }
+    const vec3 ba = 2.0 * p.extent;
+    const vec3 pa = pos - (p.center - p.extent);
+    const float h = clamp(dot(pa, ba) / dot(ba, ba), 0.0, 1.0);
+    return normalize(pa - h * ba);
+}
+)";
 
-    const vec2 screenCoord = vec2(gl_LaunchIDEXT.xy) + vec2(0.5);
-    const vec2 ndc = screenCoord/vec2(gl_LaunchSizeEXT.xy) * 2.0 - 1.0;
-    vec3 rayDir = ndc.x*aspect_x*cameraX + ndc.y*aspect_y*cameraY + cameraZ;
+// Same motion as vulkan-compute-shader's particles, in 3D, and keeps each AABB up to date for the BLAS build.
+const char* particle_sim_src = R"(
+layout(local_size_x = 256) in;
 
-    hitValue = vec3(0.0);
+const vec3 boundsMin = vec3(-6.0, -3.0, -2.5);
+const vec3 boundsMax = vec3(6.0, 4.0, 2.0);
+const float timeStep = 1.0 / 60.0;
 
-    traceRayEXT(
-        topLevelAS,                         // topLevel
-        gl_RayFlagsOpaqueEXT, 0xff,         // rayFlags, cullMask
-        0, 1, 0,                            // sbtRecordOffset, sbtRecordStride, missIndex
-        g.cameraPos, 0.0, rayDir, 100.0,    // origin, tmin, direction, tmax
-        0);                                 // payload
+void main()
+{
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= particles.length()) {
+        return;
+    }
 
-    imageStore(image, ivec2(gl_LaunchIDEXT.xy), vec4(hitValue, 0.0));
-})";
+    Particle particle = particles[index];
+    particle.position += particle.velocity * timeStep;
 
-const char* miss_src = R"(
-#version 460
-#extension GL_EXT_ray_tracing : enable
+    // Flip movement at the bounds
+    for (int k = 0; k < 3; ++k) {
+        if ((particle.position[k] <= boundsMin[k] && particle.velocity[k] < 0.0) || 
+            (particle.position[k] >= boundsMax[k] && particle.velocity[k] > 0.0)) {
+            particle.velocity[k] = -particle.velocity[k];
+        }
+        particle.aabb[k] = particle.position[k] - particle.radius;
+        particle.aabb[k + 3] = particle.position[k] + particle.radius;
+    }
 
-layout(location = 0) rayPayloadInEXT vec3 hitValue;
+    particles[index] = particle;
+})";
 
+// Compiled once per shape with SHAPE defined, particles use the sphere one
+const char* rint_src = R"(
 void main()
 {
-    hitValue = vec3(0.0, 0.0, 0.2);
+    const Primitive p = hitPrimitive(gl_InstanceCustomIndexEXT, gl_GeometryIndexEXT, gl_PrimitiveID, false);
+    const float t = intersectShape(SHAPE, p, gl_ObjectRayOriginEXT, gl_ObjectRayDirectionEXT, gl_RayTminEXT);
+    if (t >= 0.0) {
+        reportIntersectionEXT(t, 0);
+    }
 })";
 
-const char* chit_src = R"(
-#version 460
-#extension GL_EXT_ray_tracing : enable
-
+// Shared by the AABB hit groups and the tessellated mesh hit group
+const char* chit_procedural_src = R"(
 layout(shaderRecordEXT) buffer CustomData
+{
+    vec3 color;             // tint, multiplied with the primitive color
+};
+
+struct RayPayload
 {
     vec3 color;
+    float hitT;
+    vec3 normal;
 };
 
-layout(location = 0) rayPayloadInEXT vec3 hitValue;
-hitAttributeEXT vec2 attribs;
+layout(location = 0) rayPayloadInEXT RayPayload payload;
 
 void main()
 {
-    if (gl_PrimitiveID == 1 && 
-        gl_InstanceID == 1 && 
-        gl_InstanceCustomIndexEXT == 100 && 
-        gl_GeometryIndexEXT == 1) {
-        hitValue = vec3(1.0f - attribs.x - attribs.y, attribs.x, attribs.y);
-    }
-    else {
-        hitValue = color;
-    }
+    const uint shape = hitShape(gl_InstanceCustomIndexEXT, gl_GeometryIndexEXT);
+    const bool triangles = gl_HitKindEXT == gl_HitKindFrontFacingTriangleEXT || gl_HitKindEXT == gl_HitKindBackFacingTriangleEXT;
+    const Primitive p = hitPrimitive(gl_InstanceCustomIndexEXT, gl_GeometryIndexEXT, gl_PrimitiveID, triangles);
+
+    const vec3 objectPos = gl_ObjectRayOriginEXT + gl_ObjectRayDirectionEXT * gl_HitTEXT;
+    const vec3 worldNormal = normalize(shapeNormal(shape, p, objectPos) * mat3(gl_WorldToObjectEXT));
+    payload.color = p.color * color;
+    payload.normal = faceforward(worldNormal, gl_WorldRayDirectionEXT, worldNormal);
+    payload.hitT = gl_HitTEXT;
 })";
 
+struct TracePushConstants {
+    uint frameIndex;
+    uint samplesPerFrame;
+    uint progressive;
+    float exposure;
+    uint frameSeed;
+    uint pathTrace;
+    uint maxDepth;
+    uint rrStartDepth;
+    uint collectStats;
+    uint hitRecordBase;
+    uint hitRecordStride;
+    uint alphaTest;
+    uint shadows;
+    uint cullMask;
+    uint wavefrontDepth;
+    uint sampleIndex;
+    uint sortRays;
+    uint renderWidth;
+    uint renderHeight;
+    uint tileX;
+    uint tileY;
+    uint denoise;
+};
+
+static_assert(offsetof(TracePushConstants, collectStats) == 32, "ahit_src reads collectStats at offset 32");
+
+// CullParams of instance_cull_src, pushed into the front of the TracePushConstants range
+struct CullPushConstants {
+    uint instanceCount;
+    float aspect;
+};
+
+// GenParams of instance_gen_src, pushed into the front of the TracePushConstants range
+struct InstanceGenPushConstants {
+    uint first;
+    uint count;
+    uint templateCount;
+    float spacing;
+    float fieldMin[4];
+    float fieldMax[4];
+};
+
+// DenoiseParams of denoise_src, pushed into the front of the TracePushConstants range
+struct DenoisePushConstants {
+    uint renderWidth;
+    uint renderHeight;
+    uint stepWidth;
+    uint tonemap;
+    float exposure;
+};
+
+const VkShaderStageFlags TRACE_PUSH_CONSTANT_STAGES = 
+    VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+
 void createRayTracingPipeline()
 {
+    // Shared by the raygen shader and the ray query compute shader
+    const VkShaderStageFlags traceStages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+
     VkDescriptorSetLayoutBinding bindings[] = {
         {
             .binding = 0,
             .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
             .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+            .stageFlags = traceStages,
         },
         {
             .binding = 1,
             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
             .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+            .stageFlags = traceStages,
         },
         {
             .binding = 2,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = traceStages,
+        },
+        {
+            .binding = 3,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = traceStages,
+        },
+        {
+            .binding = 4,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = traceStages | VK_SHADER_STAGE_ANY_HIT_BIT_KHR,
+        },
+        {
+            .binding = 5,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 6,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 7,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 8,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 9,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 10,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 11,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = traceStages,
+        },
+        {
+            .binding = 12,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
             .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 13,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = traceStages,
+        },
+        {
+            .binding = 14,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = traceStages,
+        },
+        {
+            .binding = 15,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 16,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 17,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 18,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
         },
     };
 
@@ -1120,17 +4681,38 @@ void createRayTracingPipeline()
     };
     vkCreateDescriptorSetLayout(vk.device, &ci0, nullptr, &vk.descriptorSetLayout);
 
+    VkPushConstantRange pushConstantRange{
+        .stageFlags = TRACE_PUSH_CONSTANT_STAGES,
+        .offset = 0,
+        .size = sizeof(TracePushConstants),
+    };
+
+    VkDescriptorSetLayout setLayouts[] = { vk.descriptorSetLayout, vk.bindlessSetLayout };
     VkPipelineLayoutCreateInfo ci1{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &vk.descriptorSetLayout,
+        .setLayoutCount = sizeof(setLayouts) / sizeof(setLayouts[0]),
+        .pSetLayouts = setLayouts,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
     };
     vkCreatePipelineLayout(vk.device, &ci1, nullptr, &vk.pipelineLayout);
 
-    ShaderModule<VK_SHADER_STAGE_RAYGEN_BIT_KHR> raygenModule(vk.device, raygen_src);
+    ShaderModule<VK_SHADER_STAGE_RAYGEN_BIT_KHR> raygenModule(vk.device, (std::string(rt_header_src) + tonemap_src + trace_src).c_str());
     ShaderModule<VK_SHADER_STAGE_MISS_BIT_KHR> missModule(vk.device, miss_src);
-    ShaderModule<VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR> chitModule(vk.device, chit_src);
-    VkPipelineShaderStageCreateInfo stages[] = { raygenModule, missModule, chitModule };
+    ShaderModule<VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR> chitModule(vk.device, (std::string(rt_header_src) + bindless_src + chit_src).c_str());
+    ShaderModule<VK_SHADER_STAGE_ANY_HIT_BIT_KHR> ahitModule(vk.device, ahit_src);
+    ShaderModule<VK_SHADER_STAGE_MISS_BIT_KHR> shadowMissModule(vk.device, shadow_miss_src);
+    ShaderModule<VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR> chitProceduralModule(vk.device, 
+        (std::string(rt_header_src) + procedural_src + chit_procedural_src).c_str());
+    ShaderModule<VK_SHADER_STAGE_INTERSECTION_BIT_KHR> rintSphereModule(vk.device, 
+        (std::string(rt_header_src) + "#define SHAPE SHAPE_SPHERE\n" + procedural_src + rint_src).c_str());
+    ShaderModule<VK_SHADER_STAGE_INTERSECTION_BIT_KHR> rintBoxModule(vk.device, 
+        (std::string(rt_header_src) + "#define SHAPE SHAPE_BOX\n" + procedural_src + rint_src).c_str());
+    ShaderModule<VK_SHADER_STAGE_INTERSECTION_BIT_KHR> rintCapsuleModule(vk.device, 
+        (std::string(rt_header_src) + "#define SHAPE SHAPE_CAPSULE\n" + procedural_src + rint_src).c_str());
+    VkPipelineShaderStageCreateInfo stages[] = { 
+        raygenModule, missModule, chitModule, ahitModule, shadowMissModule, 
+        chitProceduralModule, rintSphereModule, rintBoxModule, rintCapsuleModule };
 
     VkRayTracingShaderGroupCreateInfoKHR shaderGroups[] = {
         {
@@ -1157,6 +4739,54 @@ void createRayTracingPipeline()
             .anyHitShader = VK_SHADER_UNUSED_KHR,
             .intersectionShader = VK_SHADER_UNUSED_KHR,
         },
+        {
+            .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+            .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
+            .generalShader = 4,
+            .closestHitShader = VK_SHADER_UNUSED_KHR,
+            .anyHitShader = VK_SHADER_UNUSED_KHR,
+            .intersectionShader = VK_SHADER_UNUSED_KHR,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+            .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR,
+            .generalShader = VK_SHADER_UNUSED_KHR,
+            .closestHitShader = 2,
+            .anyHitShader = 3,
+            .intersectionShader = VK_SHADER_UNUSED_KHR,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+            .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR,
+            .generalShader = VK_SHADER_UNUSED_KHR,
+            .closestHitShader = 5,
+            .anyHitShader = VK_SHADER_UNUSED_KHR,
+            .intersectionShader = 6,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+            .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR,
+            .generalShader = VK_SHADER_UNUSED_KHR,
+            .closestHitShader = 5,
+            .anyHitShader = VK_SHADER_UNUSED_KHR,
+            .intersectionShader = 7,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+            .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR,
+            .generalShader = VK_SHADER_UNUSED_KHR,
+            .closestHitShader = 5,
+            .anyHitShader = VK_SHADER_UNUSED_KHR,
+            .intersectionShader = 8,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+            .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR,
+            .generalShader = VK_SHADER_UNUSED_KHR,
+            .closestHitShader = 5,
+            .anyHitShader = VK_SHADER_UNUSED_KHR,
+            .intersectionShader = VK_SHADER_UNUSED_KHR,
+        },
     };
     
     VkRayTracingPipelineCreateInfoKHR ci2{
@@ -1165,18 +4795,139 @@ void createRayTracingPipeline()
         .pStages = stages,
         .groupCount = sizeof(shaderGroups) / sizeof(shaderGroups[0]),
         .pGroups = shaderGroups,
-        .maxPipelineRayRecursionDepth = 1,
+        .maxPipelineRayRecursionDepth = 1,     // the path tracer bounces inside raygen, hit shaders never trace
         .layout = vk.pipelineLayout,
     };
     vk.vkCreateRayTracingPipelinesKHR(vk.device, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &ci2, nullptr, &vk.pipeline);
 }
 
+// Shares vk.pipelineLayout and vk.descriptorSet with the ray tracing pipeline.
+void createRayQueryPipeline()
+{
+    if (!vk.rayQuerySupported) {
+        if (options.traceMode == TRACE_RAY_QUERY || options.compareModes) {
+            std::cout << "ray query is not supported on this device, using the ray tracing pipeline" << std::endl;
+        }
+        options.traceMode = TRACE_PIPELINE;
+        options.compareModes = false;
+        return;
+    }
+
+    ShaderModule<VK_SHADER_STAGE_COMPUTE_BIT> computeModule(vk.device, (std::string(rayquery_header_src) + bindless_src + procedural_src + tonemap_src + trace_src).c_str());
+
+    VkComputePipelineCreateInfo ci{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = computeModule,
+        .layout = vk.pipelineLayout,
+    };
+    if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &ci, nullptr, &vk.rayQueryPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create ray query pipeline!");
+    }
+}
+
+// Shares vk.pipelineLayout and both descriptor sets with the ray query pipeline, one pipeline per WAVEFRONT_STAGE.
+void createWavefrontPipelines()
+{
+    if (!vk.rayQuerySupported) {
+        if (options.wavefront || options.compareWavefront) {
+            std::cout << "ray query is not supported on this device, wavefront mode is disabled" << std::endl;
+        }
+        options.wavefront = false;
+        options.compareWavefront = false;
+        return;
+    }
+
+    for (uint stage = 0; stage < WAVEFRONT_STAGE_COUNT; ++stage) {
+        const std::string defines = "#define WAVEFRONT\n#define WAVEFRONT_STAGE " + std::to_string(stage) + "\n";
+        ShaderModule<VK_SHADER_STAGE_COMPUTE_BIT> computeModule(vk.device, 
+            (std::string(rayquery_header_src) + defines + bindless_src + procedural_src + tonemap_src + trace_src + wavefront_src).c_str());
+
+        VkComputePipelineCreateInfo ci{
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage = computeModule,
+            .layout = vk.pipelineLayout,
+        };
+        if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &ci, nullptr, &vk.wavefrontPipelines[stage]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create wavefront pipeline!");
+        }
+    }
+}
+
+// Shares vk.pipelineLayout and vk.descriptorSet, instance_cull_src uses bindings 2 and 15 ~ 17.
+void createCullPipeline()
+{
+    ShaderModule<VK_SHADER_STAGE_COMPUTE_BIT> computeModule(vk.device, 
+        (std::string("#version 460\n") + instance_cull_src).c_str());
+
+    VkComputePipelineCreateInfo ci{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = computeModule,
+        .layout = vk.pipelineLayout,
+    };
+    if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &ci, nullptr, &vk.cullPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance cull pipeline!");
+    }
+}
+
+// Shares vk.pipelineLayout and vk.descriptorSet, instance_gen_src uses bindings 15, 16 and 18.
+void createInstanceGenPipeline()
+{
+    ShaderModule<VK_SHADER_STAGE_COMPUTE_BIT> computeModule(vk.device, 
+        (std::string("#version 460\n") + instance_gen_src).c_str());
+
+    VkComputePipelineCreateInfo ci{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = computeModule,
+        .layout = vk.pipelineLayout,
+    };
+    if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &ci, nullptr, &vk.instanceGenPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance generator pipeline!");
+    }
+}
+
+// Shares vk.pipelineLayout and vk.descriptorSet, one pipeline per DenoisePass.
+void createDenoisePipelines()
+{
+    for (uint pass = 0; pass < DENOISE_PASS_COUNT; ++pass) {
+        const std::string defines = "#define DENOISE_PASS " + std::to_string(pass) + "\n";
+        ShaderModule<VK_SHADER_STAGE_COMPUTE_BIT> computeModule(vk.device, 
+            (std::string("#version 460\n") + defines + tonemap_src + denoise_src).c_str());
+
+        VkComputePipelineCreateInfo ci{
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage = computeModule,
+            .layout = vk.pipelineLayout,
+        };
+        if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &ci, nullptr, &vk.denoisePipelines[pass]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create denoise pipeline!");
+        }
+    }
+}
+
+// Shares vk.pipelineLayout and vk.descriptorSet, particle_sim_src only uses binding 8.
+void createParticlePipeline()
+{
+    ShaderModule<VK_SHADER_STAGE_COMPUTE_BIT> computeModule(vk.device, 
+        (std::string("#version 460\n") + procedural_src + particle_sim_src).c_str());
+
+    VkComputePipelineCreateInfo ci{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = computeModule,
+        .layout = vk.pipelineLayout,
+    };
+    if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &ci, nullptr, &vk.particlePipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create particle pipeline!");
+    }
+}
+
 void createDescriptorSets()
 {
     VkDescriptorPoolSize poolSizes[] = {
         { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 + DENOISE_IMAGE_COUNT },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
     };
     VkDescriptorPoolCreateInfo ci0 {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
@@ -1221,18 +4972,145 @@ void createDescriptorSets()
     write1.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
     write1.pImageInfo = &desc1;
  
-    // Descriptor(binding = 2), VkBuffer for uniform
+    // Descriptor(binding = 2), VkBuffer for uniform, one camera slot at the dynamic offset vk.cameraOffset
     VkDescriptorBufferInfo desc2{
         .buffer = vk.uniformBuffer,
         .offset = 0,
+        .range = sizeof(CameraProperties),
+    };
+    VkWriteDescriptorSet write2 = write_temp;
+    write2.dstBinding = 2;
+    write2.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write2.pBufferInfo = &desc2;
+
+    // Descriptor(binding = 3), VkImage for progressive accumulation
+    VkDescriptorImageInfo desc3{
+        .imageView = vk.accumImageView,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    VkWriteDescriptorSet write3 = write_temp;
+    write3.dstBinding = 3;
+    write3.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write3.pImageInfo = &desc3;
+
+    // Descriptor(binding = 4), VkBuffer for ray counters
+    VkDescriptorBufferInfo desc4{
+        .buffer = vk.rayStatsBuffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    VkWriteDescriptorSet write4 = write_temp;
+    write4.dstBinding = 4;
+    write4.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write4.pBufferInfo = &desc4;
+
+    // Descriptor(binding = 5), the shader binding table for the ray query path
+    VkDescriptorBufferInfo desc5 = vk.sbt.storageBufferInfo();
+    VkWriteDescriptorSet write5 = write_temp;
+    write5.dstBinding = 5;
+    write5.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write5.pBufferInfo = &desc5;
+
+    // Descriptor(binding = 6), alpha mask for the any-hit test
+    VkDescriptorImageInfo desc6{
+        .sampler = vk.alphaSampler,
+        .imageView = vk.alphaImageView,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet write6 = write_temp;
+    write6.dstBinding = 6;
+    write6.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write6.pImageInfo = &desc6;
+
+    // Descriptor(binding = 7), analytic primitives for the intersection shaders
+    VkDescriptorBufferInfo desc7{
+        .buffer = vk.proceduralBuffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    VkWriteDescriptorSet write7 = write_temp;
+    write7.dstBinding = 7;
+    write7.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write7.pBufferInfo = &desc7;
+
+    // Descriptor(binding = 8), simulated particles
+    VkDescriptorBufferInfo desc8{
+        .buffer = vk.particleBuffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    VkWriteDescriptorSet write8 = write_temp;
+    write8.dstBinding = 8;
+    write8.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write8.pBufferInfo = &desc8;
+
+    // Descriptor(binding = 9), wavefront path states
+    VkDescriptorBufferInfo desc9{
+        .buffer = vk.pathStateBuffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    VkWriteDescriptorSet write9 = write_temp;
+    write9.dstBinding = 9;
+    write9.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write9.pBufferInfo = &desc9;
+
+    // Descriptor(binding = 10), wavefront ray sort
+    VkDescriptorBufferInfo desc10{
+        .buffer = vk.raySortBuffer,
+        .offset = 0,
         .range = VK_WHOLE_SIZE,
     };
-    VkWriteDescriptorSet write2 = write_temp;
-    write2.dstBinding = 2;
-    write2.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    write2.pBufferInfo = &desc2;
+    VkWriteDescriptorSet write10 = write_temp;
+    write10.dstBinding = 10;
+    write10.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write10.pBufferInfo = &desc10;
+
+    // Descriptor(binding = 11 ~ 14), denoiser images
+    VkDescriptorImageInfo desc11[DENOISE_IMAGE_COUNT];
+    VkWriteDescriptorSet write11[DENOISE_IMAGE_COUNT];
+    for (uint i = 0; i < DENOISE_IMAGE_COUNT; ++i) {
+        desc11[i] = VkDescriptorImageInfo{
+            .imageView = vk.denoiseImageViews[i],
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        };
+        write11[i] = write_temp;
+        write11[i].dstBinding = 11 + i;
+        write11[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        write11[i].pImageInfo = &desc11[i];
+    }
+
+    // Descriptor(binding = 15 ~ 17), instance culling: all instances, their bounds and the compacted output
+    VkBuffer cullBuffers[] = { vk.tlasInstanceBuffer, vk.instanceBoundsBuffer, vk.culledInstanceBuffer };
+    VkDescriptorBufferInfo desc15[3];
+    VkWriteDescriptorSet write15[3];
+    for (uint i = 0; i < 3; ++i) {
+        desc15[i] = VkDescriptorBufferInfo{
+            .buffer = cullBuffers[i],
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        };
+        write15[i] = write_temp;
+        write15[i].dstBinding = 15 + i;
+        write15[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write15[i].pBufferInfo = &desc15[i];
+    }
 
-    VkWriteDescriptorSet writeInfos[] = { write0, write1, write2 };
+    // Descriptor(binding = 18), instance generator templates
+    VkDescriptorBufferInfo desc18{
+        .buffer = vk.instanceTemplateBuffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    VkWriteDescriptorSet write18 = write_temp;
+    write18.dstBinding = 18;
+    write18.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write18.pBufferInfo = &desc18;
+
+    VkWriteDescriptorSet writeInfos[] = { 
+        write0, write1, write2, write3, write4, write5, write6, write7, write8, write9, write10, 
+        write11[0], write11[1], write11[2], write11[3], write15[0], write15[1], write15[2], write18 
+    };
     vkUpdateDescriptorSets(vk.device, sizeof(writeInfos) / sizeof(writeInfos[0]), writeInfos, 0, VK_NULL_HANDLE);
     /*
     [VUID-VkWriteDescriptorSet-descriptorType-00336]
@@ -1241,13 +5119,71 @@ void createDescriptorSets()
     */
 }
 
-struct ShaderGroupHandle {
-    uint8_t data[SHADER_GROUP_HANDLE_SIZE];
-};
+/*
+Fills the instance buffer behind the scene instances with options.instanceCount instances (instance_gen_src)
+spread over a box in front of the camera. All of them are generated once; --instance-sweep only changes how many
+of them the TLAS is built over.
+*/
+void generateInstances()
+{
+    if (options.instanceCount == 0) {
+        return;
+    }
 
-struct HitgCustomData {
-    float color[3];
-};
+    const float fieldMin[] = { -40.0f, -20.0f, -80.0f };
+    const float fieldMax[] = { 40.0f, 20.0f, -5.0f };
+    const float fieldVolume = (fieldMax[0] - fieldMin[0]) * (fieldMax[1] - fieldMin[1]) * (fieldMax[2] - fieldMin[2]);
+    InstanceGenPushConstants pushConstants{
+        .first = vk.sceneInstanceCount,
+        .count = options.instanceCount,
+        .templateCount = vk.instanceTemplateCount,
+        .spacing = std::cbrt(fieldVolume / options.instanceCount),
+        .fieldMin = { fieldMin[0], fieldMin[1], fieldMin[2], 0.0f },
+        .fieldMax = { fieldMax[0], fieldMax[1], fieldMax[2], 0.0f },
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    vkResetCommandBuffer(vk.commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
+    {
+        vkCmdBindPipeline(vk.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vk.instanceGenPipeline);
+        vkCmdBindDescriptorSets(
+            vk.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, 
+            vk.pipelineLayout, 0, 1, &vk.descriptorSet, 1, &vk.cameraOffset);
+        vkCmdPushConstants(
+            vk.commandBuffer, vk.pipelineLayout, TRACE_PUSH_CONSTANT_STAGES,
+            0, sizeof(pushConstants), &pushConstants);
+        vkCmdDispatch(vk.commandBuffer, (options.instanceCount + 63) / 64, 1, 1);  // local_size 64 in instance_gen_src
+
+        // Barriers reach past the end of the command buffer, this one covers the builds and culls of later frames.
+        VkMemoryBarrier generated{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        };
+        vkCmdPipelineBarrier(
+            vk.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &generated, 0, nullptr, 0, nullptr);
+    }
+    vkEndCommandBuffer(vk.commandBuffer);
+
+    VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &vk.commandBuffer,
+    }; 
+    vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(vk.graphicsQueue);
+    const double generateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    vk.generatedInstances = options.instanceSweep ? std::min(1024u, options.instanceCount) : options.instanceCount;
+    vk.tlasInstanceCount = vk.sceneInstanceCount + vk.generatedInstances;
+    printf("[instances] generated %u instances from %u BLASes in %.2f ms, instance buffer %.1f KB\n",
+        options.instanceCount, vk.instanceTemplateCount, generateMs,
+        sizeof(VkAccelerationStructureInstanceKHR) * vk.tlasInstanceCapacity / 1024.0);
+}
 
 /*
 In the vulkan spec,
@@ -1256,67 +5192,515 @@ In the vulkan spec,
 [VUID-vkCmdTraceRaysKHR-pRayGenShaderBindingTable-03682] pRayGenShaderBindingTable->deviceAddress must be a multiple of VkPhysicalDeviceRayTracingPipelinePropertiesKHR::shaderGroupBaseAlignment
 [VUID-vkCmdTraceRaysKHR-pMissShaderBindingTable-03685] pMissShaderBindingTable->deviceAddress must be a multiple of VkPhysicalDeviceRayTracingPipelinePropertiesKHR::shaderGroupBaseAlignment
 [VUID-vkCmdTraceRaysKHR-pHitShaderBindingTable-03689] pHitShaderBindingTable->deviceAddress must be a multiple of VkPhysicalDeviceRayTracingPipelinePropertiesKHR::shaderGroupBaseAlignment
+[VUID-vkCmdTraceRaysKHR-size-04023] The size member of pRayGenShaderBindingTable must be equal to its stride member
+[VUID-vkCmdTraceRaysKHR-stride-04029] pHitShaderBindingTable->stride must be less than or equal to VkPhysicalDeviceRayTracingPipelinePropertiesKHR::maxShaderGroupStride
 
 As shown in the vulkan spec 40.3.1. Indexing Rules,  
     pHitShaderBindingTable->deviceAddress + pHitShaderBindingTable->stride × (
     instanceShaderBindingTableRecordOffset + geometryIndex × sbtRecordStride + sbtRecordOffset )
 */
-void createShaderBindingTable() 
+uint ShaderBindingTable::addRecord(SbtRegion region, uint shaderGroup, const void* data, size_t size)
+{
+    if (buffer != VK_NULL_HANDLE) {
+        throw std::runtime_error("records cannot be added after the shader binding table is built!");
+    }
+    auto bytes = (const uint8_t*)data;
+    records[region].push_back({ shaderGroup, std::vector<uint8_t>(bytes, bytes + size) });
+    return (uint)records[region].size() - 1;
+}
+
+void ShaderBindingTable::updateRecord(SbtRegion region, uint index, const void* data, size_t size)
+{
+    auto& record = records[region].at(index);
+    if (size > record.data.size()) {
+        throw std::runtime_error("shader record update is larger than the record!");
+    }
+    memcpy(record.data.data(), data, size);
+
+    if (buffer != VK_NULL_HANDLE) {
+        // vkCmdUpdateBuffer needs a 4 byte multiple, the record stride keeps the padding inside the record.
+        std::vector<uint8_t> patch((size + 3) & ~size_t(3), 0);
+        memcpy(patch.data(), data, size);
+        patches.push_back({ offsets[region] + index * strides[region] + handleSize, std::move(patch) });
+    }
+}
+
+void ShaderBindingTable::build(VkPipeline pipeline)
 {
     auto alignTo = [](auto value, auto alignment) -> decltype(value) {
         return (value + (decltype(value))alignment - 1) & ~((decltype(value))alignment - 1);
     };
-    const uint32_t handleSize = SHADER_GROUP_HANDLE_SIZE;
-    const uint32_t groupCount = 3; // 1 raygen, 1 miss, 1 hit group
-    std::vector<ShaderGroupHandle> handels(groupCount);
-    vk.vkGetRayTracingShaderGroupHandlesKHR(vk.device, vk.pipeline, 0, groupCount, handleSize * groupCount, handels.data());
-    ShaderGroupHandle rgenHandle = handels[0];
-    ShaderGroupHandle missHandle = handels[1];
-    ShaderGroupHandle hitgHandle = handels[2];
+    const auto& props = vk.rtProperties;
+    handleSize = props.shaderGroupHandleSize;
 
-    const uint32_t rgenStride = alignTo(handleSize, vk.rtProperties.shaderGroupHandleAlignment);
-    vk.rgenSbt = { 0, rgenStride, rgenStride };
-    
-    const uint64_t missOffset = alignTo(vk.rgenSbt.size, vk.rtProperties.shaderGroupBaseAlignment);
-    const uint32_t missStride = alignTo(handleSize, vk.rtProperties.shaderGroupHandleAlignment);
-    vk.missSbt = { 0, missStride, missStride };
-
-    const uint32_t hitgCustomDataSize = sizeof(HitgCustomData);
-    const uint32_t geometryCount = 4;
-    const uint64_t hitgOffset = alignTo(missOffset + vk.missSbt.size, vk.rtProperties.shaderGroupBaseAlignment);
-    const uint32_t hitgStride = alignTo(handleSize + hitgCustomDataSize, vk.rtProperties.shaderGroupHandleAlignment);
-    vk.hitgSbt = { 0, hitgStride, hitgStride * geometryCount };
-
-    const uint64_t sbtSize = hitgOffset + vk.hitgSbt.size;
-    std::tie(vk.sbtBuffer, vk.sbtBufferMem) = createBuffer(
+    uint32_t groupCount = 0;
+    for (auto& region : records) {
+        for (auto& record : region) {
+            groupCount = std::max(groupCount, record.shaderGroup + 1);
+        }
+    }
+    std::vector<uint8_t> handles(handleSize * groupCount);
+    vk.vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 0, groupCount, handles.size(), handles.data());
+
+    VkDeviceSize sbtSize = 0;
+    for (uint r = 0; r < SBT_REGION_COUNT; ++r) {
+        size_t maxDataSize = 0;
+        for (auto& record : records[r]) {
+            maxDataSize = std::max(maxDataSize, record.data.size());
+        }
+        // Each raygen record is its own region, so its stride has to keep the next record base aligned.
+        auto alignment = r == SBT_RAYGEN ? props.shaderGroupBaseAlignment : props.shaderGroupHandleAlignment;
+        strides[r] = alignTo(VkDeviceSize(handleSize + maxDataSize), alignment);
+        if (strides[r] > props.maxShaderGroupStride) {
+            throw std::runtime_error("shader record stride exceeds maxShaderGroupStride!");
+        }
+        offsets[r] = alignTo(sbtSize, props.shaderGroupBaseAlignment);
+        sbtSize = offsets[r] + strides[r] * records[r].size();
+    }
+
+    std::vector<uint8_t> table(sbtSize, 0);
+    for (uint r = 0; r < SBT_REGION_COUNT; ++r) {
+        for (size_t i = 0; i < records[r].size(); ++i) {
+            uint8_t* dst = table.data() + offsets[r] + i * strides[r];
+            memcpy(dst, handles.data() + records[r][i].shaderGroup * handleSize, handleSize);
+            memcpy(dst + handleSize, records[r][i].data.data(), records[r][i].data.size());
+        }
+    }
+
+    // The buffer address is only guaranteed to be aligned to the memory requirement, so allocate one more base alignment.
+    std::tie(buffer, memory) = createBuffer(
+        sbtSize + props.shaderGroupBaseAlignment,
+        VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | 
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkDeviceAddress bufferAddress = getDeviceAddressOf(buffer);
+    address = alignTo(bufferAddress, props.shaderGroupBaseAlignment);
+    addressOffset = address - bufferAddress;
+
+    auto [stagingBuffer, stagingBufferMem] = createBuffer(
         sbtSize,
-        VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    auto sbtAddress = getDeviceAddressOf(vk.sbtBuffer);
-    if (sbtAddress != alignTo(sbtAddress, vk.rtProperties.shaderGroupBaseAlignment)) {
-        throw std::runtime_error("It will not be happened!");
-    }
-    vk.rgenSbt.deviceAddress = sbtAddress;
-    vk.missSbt.deviceAddress = sbtAddress + missOffset;
-    vk.hitgSbt.deviceAddress = sbtAddress + hitgOffset;
+    void* dst;
+    vkMapMemory(vk.device, stagingBufferMem, 0, sbtSize, 0, &dst);
+    memcpy(dst, table.data(), sbtSize);
+    vkUnmapMemory(vk.device, stagingBufferMem);
 
-    uint8_t* dst;
-    vkMapMemory(vk.device, vk.sbtBufferMem, 0, sbtSize, 0, (void**)&dst);
+    vkResetCommandBuffer(vk.commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(vk.commandBuffer, &beginInfo);
     {
-        *(ShaderGroupHandle*)dst = rgenHandle; 
-        *(ShaderGroupHandle*)(dst + missOffset) = missHandle;
+        VkBufferCopy copyRegion{ .srcOffset = 0, .dstOffset = addressOffset, .size = sbtSize };
+        vkCmdCopyBuffer(vk.commandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+    }
+    vkEndCommandBuffer(vk.commandBuffer);
+
+    VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &vk.commandBuffer,
+    }; 
+    vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(vk.graphicsQueue);
+
+    vkFreeMemory(vk.device, stagingBufferMem, nullptr);
+    vkDestroyBuffer(vk.device, stagingBuffer, nullptr);
+}
+
+bool ShaderBindingTable::flush(VkCommandBuffer commandBuffer)
+{
+    if (patches.empty()) {
+        return false;
+    }
+
+    for (auto& patch : patches) {
+        vkCmdUpdateBuffer(commandBuffer, buffer, addressOffset + patch.offset, patch.data.size(), patch.data.data());
+    }
+    patches.clear();
+
+    VkBufferMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,     // shader binding table reads, and storage reads in ray query mode
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, 
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        0, nullptr, 1, &barrier, 0, nullptr);
+    return true;
+}
+
+VkStridedDeviceAddressRegionKHR ShaderBindingTable::region(SbtRegion region) const
+{
+    if (records[region].empty()) {
+        return {};
+    }
+    if (region == SBT_RAYGEN) {
+        return raygenRegion(0);
+    }
+    return { address + offsets[region], strides[region], strides[region] * records[region].size() };
+}
+
+VkStridedDeviceAddressRegionKHR ShaderBindingTable::raygenRegion(uint index) const
+{
+    return { address + offsets[SBT_RAYGEN] + index * strides[SBT_RAYGEN], strides[SBT_RAYGEN], strides[SBT_RAYGEN] };
+}
+
+void ShaderBindingTable::destroy(VkDevice device)
+{
+    vkDestroyBuffer(device, buffer, nullptr);
+    vkFreeMemory(device, memory, nullptr);
+    buffer = VK_NULL_HANDLE;
+    memory = VK_NULL_HANDLE;
+}
+
+void createShaderBindingTable() 
+{
+    vk.sbt.add(SBT_RAYGEN, GROUP_RAYGEN);
+    vk.sbt.add(SBT_MISS, GROUP_MISS);           // missIndex 0
+    vk.sbt.add(SBT_MISS, GROUP_SHADOW_MISS);    // missIndex 1
+
+    // Hit records are laid out in instance order so instanceShaderBindingTableRecordOffset in createTLAS() lines up.
+    for (auto& instance : sceneInstances) {
+        const bool forceOpaque = instance.flags & VK_GEOMETRY_INSTANCE_FORCE_OPAQUE_BIT_KHR;
+        for (uint i = 0; i < instance.geometryMaterials.size(); ++i) {
+            const bool alphaTested = instance.hitGroups.empty() && geometryAlphaTested[i] && !forceOpaque;
+            const ShaderGroup group = 
+                !instance.hitGroups.empty() ? instance.hitGroups[i] : 
+                alphaTested ? GROUP_HIT_ALPHA : GROUP_HIT;
+            vk.sbt.add(SBT_HIT, group, instance.geometryMaterials[i]);
+        }
+    }
+
+    vk.sbt.build(vk.pipeline);
+}
+
+// Rotates the color channels of one hit record on the GPU without rebuilding the table.
+void cycleHitRecordColor()
+{
+    static uint index = 0;
+    index = (index + 1) % vk.sbt.count(SBT_HIT);
+
+    auto material = vk.sbt.get<HitgCustomData>(SBT_HIT, index);
+    std::rotate(material.color, material.color + 1, material.color + 3);
+    vk.sbt.update(SBT_HIT, index, material);
+    std::cout << "hit record " << index << " color updated" << std::endl;
+}
+
+/*
+Records the wavefront path tracer (wavefront_src): per sample GENERATE, then per bounce TRACE
+followed by SCAN + SCATTER when rays are sorted, and one RESOLVE at the end.
+Every dispatch covers all paths; threads past the live ones return right away.
+*/
+void cmdTraceWavefront(VkCommandBuffer commandBuffer, TracePushConstants pushConstants)
+{
+    const uint32_t pathGroups = (vk.renderWidth * vk.renderHeight + 255) / 256;     // local_size 256 in wavefront_src
+    const uint sampleCount = options.progressive ? options.samplesPerFrame : 1;
+
+    auto dispatch = [&](WavefrontStage stage, uint32_t groups) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vk.wavefrontPipelines[stage]);
+        vkCmdPushConstants(
+            commandBuffer, vk.pipelineLayout, TRACE_PUSH_CONSTANT_STAGES,
+            0, sizeof(pushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer, groups, 1, 1);
+
+        VkMemoryBarrier barrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(
+            commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &barrier, 0, nullptr, 0, nullptr);
+    };
+
+    for (uint sample = 0; sample < sampleCount; ++sample) {
+        pushConstants.sampleIndex = sample;
+        dispatch(WAVEFRONT_GENERATE, pathGroups);
+
+        for (uint depth = 0; depth < options.maxDepth; ++depth) {
+            pushConstants.wavefrontDepth = depth;
+            dispatch(WAVEFRONT_TRACE, pathGroups);
+            if (options.sortRays && depth + 1 < options.maxDepth) {
+                dispatch(WAVEFRONT_SCAN, 1);
+                dispatch(WAVEFRONT_SCATTER, pathGroups);
+            }
+        }
+    }
+    dispatch(WAVEFRONT_RESOLVE, pathGroups);
+}
+
+/*
+Compacts the instances whose world bounds touch the view frustum into culledInstanceBuffer (instance_cull_src)
+and counts them in the build range in front of them. Without indirect builds the count cannot reach the build,
+so the whole buffer is cleared first: the slots behind the visible instances stay inactive (null BLAS reference).
+*/
+void cmdCullInstances(VkCommandBuffer commandBuffer)
+{
+    const VkDeviceSize clearSize = vk.indirectBuildSupported ? CULLED_INSTANCE_OFFSET : VK_WHOLE_SIZE;
+    vkCmdFillBuffer(commandBuffer, vk.culledInstanceBuffer, 0, clearSize, 0);
+
+    VkMemoryBarrier cleared{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        1, &cleared, 0, nullptr, 0, nullptr);
+
+    CullPushConstants pushConstants{
+        .instanceCount = vk.tlasInstanceCount,
+        .aspect = (float)WIDTH / HEIGHT,
+    };
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vk.cullPipeline);
+    vkCmdBindDescriptorSets(
+        commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, 
+        vk.pipelineLayout, 0, 1, &vk.descriptorSet, 1, &vk.cameraOffset);
+    vkCmdPushConstants(
+        commandBuffer, vk.pipelineLayout, TRACE_PUSH_CONSTANT_STAGES,
+        0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (vk.tlasInstanceCount + 63) / 64, 1, 1);    // local_size 64 in instance_cull_src
+
+    VkMemoryBarrier culled{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        1, &culled, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy countRegion{ .srcOffset = 0, .dstOffset = 0, .size = sizeof(uint32_t) };
+    vkCmdCopyBuffer(commandBuffer, vk.culledInstanceBuffer, vk.cullStatsBuffer, 1, &countRegion);
+}
+
+/*
+Records the denoiser (denoise_src) over the traced region: VARIANCE, options.denoiseIterations a-trous
+iterations with a doubling step width, then MODULATE into outImage.
+Expects the trace writes to be visible to compute shaders.
+*/
+void cmdDenoise(VkCommandBuffer commandBuffer, bool tonemap)
+{
+    DenoisePushConstants pushConstants{
+        .renderWidth = vk.renderWidth,
+        .renderHeight = vk.renderHeight,
+        .stepWidth = 1,
+        .tonemap = tonemap,
+        .exposure = options.exposure,
+    };
+
+    VkDescriptorSet descriptorSets[] = { vk.descriptorSet, vk.bindlessSet };
+    vkCmdBindDescriptorSets(
+        commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, 
+        vk.pipelineLayout, 0, 2, descriptorSets, 1, &vk.cameraOffset);
+
+    auto dispatch = [&](DenoisePass pass) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vk.denoisePipelines[pass]);
+        vkCmdPushConstants(
+            commandBuffer, vk.pipelineLayout, TRACE_PUSH_CONSTANT_STAGES,
+            0, sizeof(pushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer, (vk.renderWidth + 7) / 8, (vk.renderHeight + 7) / 8, 1);  // local_size 8x8 in denoise_src
+
+        VkMemoryBarrier barrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(
+            commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &barrier, 0, nullptr, 0, nullptr);
+    };
+
+    dispatch(DENOISE_VARIANCE);     // illumination A -> B
+    bool resultInA = false;
+    for (uint iteration = 0; iteration < options.denoiseIterations; ++iteration) {
+        pushConstants.stepWidth = 1u << iteration;
+        dispatch(resultInA ? DENOISE_ATROUS_A_TO_B : DENOISE_ATROUS_B_TO_A);
+        resultInA = !resultInA;
+    }
+    dispatch(resultInA ? DENOISE_MODULATE_A : DENOISE_MODULATE_B);
+}
+
+void setRenderScale(float scale)
+{
+    vk.renderScale = std::clamp(scale, MIN_RENDER_SCALE, 1.0f);
+    vk.renderWidth = std::max(8u, (uint32_t)(WIDTH * vk.renderScale + 0.5f));
+    vk.renderHeight = std::max(8u, (uint32_t)(HEIGHT * vk.renderScale + 0.5f));
+    vk.accumFrameCount = 0;     // the accumulated pixels belong to the old resolution
+}
+
+/*
+Dynamic resolution: steers the render scale so the trace takes about options.frameBudgetMs.
+The trace time is roughly proportional to the pixel count, i.e. to the scale squared.
+Changes below RENDER_SCALE_STEP are ignored so the resolution does not flicker around the budget.
+*/
+void updateRenderScale(double traceMs)
+{
+    const float RENDER_SCALE_STEP = 0.05f;
+    const uint SETTLE_FRAMES = 8;           // frames measured at one resolution before it may change again
+    static double smoothedMs = 0.0;
+    static uint frames = 0;
+
+    if (options.frameBudgetMs <= 0.0f) {
+        return;
+    }
+
+    smoothedMs = frames == 0 ? traceMs : smoothedMs * 0.9 + traceMs * 0.1;
+    if (++frames < SETTLE_FRAMES) {
+        return;
+    }
+
+    float scale = vk.renderScale * (float)std::sqrt(options.frameBudgetMs / smoothedMs);
+    scale = std::clamp(scale, MIN_RENDER_SCALE, 1.0f);
+    if (std::abs(scale - vk.renderScale) < RENDER_SCALE_STEP) {
+        return;
+    }
+
+    setRenderScale(scale);
+    printf("[scale] trace %.3f ms, budget %.3f ms -> render scale %.2f (%ux%u)\n",
+        smoothedMs, options.frameBudgetMs, vk.renderScale, vk.renderWidth, vk.renderHeight);
+    frames = 0;
+}
+
+void collectFrameStats()
+{
+    // Timings are kept per FrameVariant so the --compare-* options print a direct A/B.
+    static double traceMs[VARIANT_COUNT] = {};
+    static uint traceFrames[VARIANT_COUNT] = {};
+    static uint64_t rays[MAX_PATH_DEPTH] = {};
+    static uint64_t anyHits = 0;
+    static double buildMs = 0.0;
+    static double denoiseMs = 0.0;
+    static uint denoiseFrames = 0;
+    static double tlasMs = 0.0;
+    static uint tlasFrames = 0;
+    static uint64_t culledInstances = 0;
+    static uint culledFrames = 0;
+    static uint frames = 0;
+
+    if (vk.frameSeed == 0) {
+        return;     // nothing has been submitted yet
+    }
+
+    uint64_t timestamps[TIMESTAMP_COUNT];
+    if (vkGetQueryPoolResults(
+        vk.device, vk.timestampPool, 0, TIMESTAMP_COUNT,
+        sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    const double frameTraceMs = (timestamps[TS_TRACE_END] - timestamps[TS_TRACE_BEGIN]) * vk.timestampPeriod * 1e-6;
+    traceMs[vk.lastVariant] += frameTraceMs;
+    ++traceFrames[vk.lastVariant];
+    buildMs += (timestamps[TS_BUILD_END] - timestamps[TS_BUILD_BEGIN]) * vk.timestampPeriod * 1e-6;
+    if (vk.lastDenoised) {
+        denoiseMs += (timestamps[TS_DENOISE_END] - timestamps[TS_DENOISE_BEGIN]) * vk.timestampPeriod * 1e-6;
+        ++denoiseFrames;
+    }
+    if (vk.lastTlasBuilt) {
+        tlasMs += (timestamps[TS_TLAS_END] - timestamps[TS_TLAS_BEGIN]) * vk.timestampPeriod * 1e-6;
+        ++tlasFrames;
+    }
+    if (vk.lastCulled) {
+        culledInstances += *vk.culledInstanceCount;
+        ++culledFrames;
+    }
+    updateRenderScale(frameTraceMs);
+    if (options.stats) {
+        for (uint depth = 0; depth < MAX_PATH_DEPTH; ++depth) {
+            rays[depth] += vk.rayStats->rayCounts[depth];
+        }
+        anyHits += vk.rayStats->anyHitCount;
+    }
+
+    if (++frames < STATS_REPORT_INTERVAL) {
+        return;
+    }
+
+    double totalMs = 0.0;
+    for (uint variant = 0; variant < VARIANT_COUNT; ++variant) {
+        if (traceFrames[variant] > 0) {
+            printf("[trace] %-9s %-6s %-11s %.3f ms/frame (%u frames)\n", 
+                variant & VARIANT_WAVEFRONT ? (options.sortRays ? "wavefront" : "wf unsort") :
+                traceModeNames[variant & VARIANT_RAY_QUERY ? TRACE_RAY_QUERY : TRACE_PIPELINE], 
+                variant & VARIANT_ALPHA_TEST ? "+alpha" : "", 
+                variant & VARIANT_TESSELLATED ? "tessellated" : "procedural",
+                traceMs[variant] / traceFrames[variant], traceFrames[variant]);
+        }
+        totalMs += traceMs[variant];
+    }
+    if (options.stats) {
+        uint64_t total = 0;
+        for (uint depth = 0; depth < MAX_PATH_DEPTH && rays[depth] > 0; ++depth) {
+            // Every depth shares one dispatch, so rays/s is each depth's share of the total trace time.
+            printf("    depth %2u: %8.3f Mrays/frame, %9.1f Mrays/s\n",
+                depth, rays[depth] * 1e-6 / frames, rays[depth] * 1e-3 / totalMs);
+            total += rays[depth];
+        }
+        printf("    total   : %8.3f Mrays/frame, %9.1f Mrays/s\n", total * 1e-6 / frames, total * 1e-3 / totalMs);
+        printf("    any-hit : %8.3f M/frame\n", anyHits * 1e-6 / frames);
+    }
+
+    if (tlasFrames > 0) {
+        printf("[tlas] %s build %.3f ms/frame", vk.lastCulled ? "culled" : "full  ", tlasMs / tlasFrames);
+        if (culledFrames > 0) {
+            printf(", %.1f of %u instances visible (%s build)", 
+                (double)culledInstances / culledFrames, vk.tlasInstanceCount, vk.indirectBuildSupported ? "indirect" : "inactive padded");
+        }
+        printf("\n");
+    }
+
+    if (denoiseFrames > 0) {
+        // Compare with the trace time of more samples per frame (] key) to trade samples for filtering.
+        printf("[denoise] %u iterations %.3f ms/frame (%u frames)\n",
+            options.denoiseIterations, denoiseMs / denoiseFrames, denoiseFrames);
+    }
+
+    if (options.particleCount > 0) {
+        // Linear in the particle count for a rebuild, cheaper per particle for a refit
+        printf("[particles] %8u particles, BLAS %s %.3f ms/frame (%.2f ns/particle)\n",
+            vk.particleBlasCount, vk.lastParticleRefit ? "refit  " : "rebuild",
+            buildMs / frames, buildMs * 1e6 / frames / vk.particleBlasCount);
+        if (options.particleSweep && vk.activeParticles < options.particleCount) {
+            vk.activeParticles = std::min(vk.activeParticles * 2, options.particleCount);
+        }
+    }
 
-        *(ShaderGroupHandle*)(dst + hitgOffset + 0 * hitgStride             ) = hitgHandle;
-        *(HitgCustomData*   )(dst + hitgOffset + 0 * hitgStride + handleSize) = {0.6f, 0.1f, 0.2f}; // Deep Red Wine
-        *(ShaderGroupHandle*)(dst + hitgOffset + 1 * hitgStride             ) = hitgHandle;
-        *(HitgCustomData*   )(dst + hitgOffset + 1 * hitgStride + handleSize) = {0.1f, 0.8f, 0.4f}; // Emerald Green
-        *(ShaderGroupHandle*)(dst + hitgOffset + 2 * hitgStride             ) = hitgHandle;
-        *(HitgCustomData*   )(dst + hitgOffset + 2 * hitgStride + handleSize) = {0.9f, 0.7f, 0.1f}; // Golden Yellow
-        *(ShaderGroupHandle*)(dst + hitgOffset + 3 * hitgStride             ) = hitgHandle;
-        *(HitgCustomData*   )(dst + hitgOffset + 3 * hitgStride + handleSize) = {0.3f, 0.6f, 0.9f}; // Dawn Sky Blue
+    if (vk.generatedInstances > 0 && tlasFrames > 0) {
+        // Sizes a TLAS of exactly this many instances needs, the buffers themselves are allocated for all of them.
+        const VkAccelerationStructureBuildSizesInfoKHR sizes = tlasBuildSizes(vk.tlasInstanceCount);
+        printf("[instances] %8u instances, TLAS build %.3f ms/frame, trace %.3f ms/frame, "
+            "TLAS %.1f KB, scratch %.1f KB, instances %.1f KB\n",
+            vk.tlasInstanceCount, tlasMs / tlasFrames, totalMs / frames,
+            sizes.accelerationStructureSize / 1024.0, sizes.buildScratchSize / 1024.0,
+            sizeof(VkAccelerationStructureInstanceKHR) * vk.tlasInstanceCount / 1024.0);
+        if (options.instanceSweep && vk.generatedInstances < options.instanceCount) {
+            vk.generatedInstances = std::min(vk.generatedInstances * 4, options.instanceCount);
+            vk.tlasInstanceCount = vk.sceneInstanceCount + vk.generatedInstances;
+        }
     }
-    vkUnmapMemory(vk.device, vk.sbtBufferMem);
+
+    std::fill(std::begin(traceMs), std::end(traceMs), 0.0);
+    std::fill(std::begin(traceFrames), std::end(traceFrames), 0);
+    std::fill(std::begin(rays), std::end(rays), 0);
+    anyHits = 0;
+    buildMs = 0.0;
+    denoiseMs = 0.0;
+    denoiseFrames = 0;
+    tlasMs = 0.0;
+    tlasFrames = 0;
+    culledInstances = 0;
+    culledFrames = 0;
+    frames = 0;
 }
 
 void render()
@@ -1328,11 +5712,16 @@ void render()
         .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
         .extent = { WIDTH, HEIGHT, 1 },
     };
-    static const VkStridedDeviceAddressRegionKHR callSbt{};
-
     vkWaitForFences(vk.device, 1, &vk.fence0, VK_TRUE, UINT64_MAX);
     vkResetFences(vk.device, 1, &vk.fence0);
 
+    collectFrameStats();
+
+    if (vk.materialRequested) {
+        vk.materialRequested = false;
+        addRandomMaterial();    // uploads with vk.commandBuffer, before it is recorded below
+    }
+
     uint32_t imageIndex;
     vkAcquireNextImageKHR(vk.device, vk.swapChain, UINT64_MAX, vk.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
 
@@ -1340,55 +5729,311 @@ void render()
     if (vkBeginCommandBuffer(vk.commandBuffer, &beginInfo) != VK_SUCCESS) {
         throw std::runtime_error("failed to begin recording command buffer!");
     }
+    VkCommandBuffer commandBuffer = vk.commandBuffer;   // the one being recorded, changes when tiles are submitted
     {
-        vkCmdBindPipeline(vk.commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, vk.pipeline);
+        vkCmdResetQueryPool(vk.commandBuffer, vk.timestampPool, 0, TIMESTAMP_COUNT);
+
+        if (options.stats) {
+            vkCmdFillBuffer(vk.commandBuffer, vk.rayStatsBuffer, 0, VK_WHOLE_SIZE, 0);
+
+            VkBufferMemoryBarrier barrier{
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = vk.rayStatsBuffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+            };
+            vkCmdPipelineBarrier(
+                vk.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, 
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                0, nullptr, 1, &barrier, 0, nullptr);
+        }
+
+        if (vk.sbt.flush(vk.commandBuffer)) {
+            vk.accumFrameCount = 0;
+        }
+
+        if (options.particleCount > 0) {
+            cmdUpdateParticles(vk.commandBuffer);
+            vk.accumFrameCount = 0;     // the scene moves
+        }
+        else {
+            vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_BUILD_BEGIN);
+            vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_BUILD_END);
+        }
+
+        // The TLAS is rebuilt when the particle BLAS changed, when only the visible instances go in,
+        // once more after culling is switched off to bring the others back, and every frame for the
+        // generated instances so their build time is measured.
+        const bool rebuildTlas = options.particleCount > 0 || vk.generatedInstances > 0 || options.cull || vk.tlasCulled;
+        if (rebuildTlas) {
+            vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, vk.timestampPool, TS_TLAS_BEGIN);
+            if (options.cull) {
+                cmdCullInstances(vk.commandBuffer);
+            }
+            cmdBuildTLAS(vk.commandBuffer, options.cull);
+            vk.tlasCulled = options.cull;
+            vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, vk.timestampPool, TS_TLAS_END);
+
+            VkMemoryBarrier built{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+            };
+            vkCmdPipelineBarrier(
+                vk.commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                1, &built, 0, nullptr, 0, nullptr);
+        }
+        else {
+            vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_TLAS_BEGIN);
+            vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_TLAS_END);
+        }
+        vk.lastTlasBuilt = rebuildTlas;
+        vk.lastCulled = options.cull;
+
+        // --compare-* options interleave their variants frame by frame
+        uint variant = vk.frameSeed;
+        TraceMode traceMode = options.traceMode;
+        bool alphaTest = options.alphaTest;
+        bool tessellated = options.tessellated;
+        if (options.compareModes) {
+            traceMode = (TraceMode)(variant % TRACE_MODE_COUNT);
+            variant /= TRACE_MODE_COUNT;
+        }
+        if (options.compareAlpha) {
+            alphaTest = variant % 2;
+            variant /= 2;
+        }
+        if (options.compareProcedural) {
+            tessellated = variant % 2;
+            variant /= 2;
+        }
+        bool wavefront = options.wavefront;
+        if (options.compareWavefront) {
+            wavefront = variant % 2;
+        }
+        wavefront = wavefront && options.pathTrace;     // only paths have secondary rays
+
+        const VkPipelineBindPoint bindPoint = traceMode == TRACE_PIPELINE ? 
+            VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR : VK_PIPELINE_BIND_POINT_COMPUTE;
+
+        VkPipeline pipeline = traceMode == TRACE_PIPELINE ? vk.pipeline : vk.rayQueryPipeline;
+        vkCmdBindPipeline(vk.commandBuffer, bindPoint, pipeline);
+        VkDescriptorSet descriptorSets[] = { vk.descriptorSet, vk.bindlessSet };
         vkCmdBindDescriptorSets(
-            vk.commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, 
-            vk.pipelineLayout, 0, 1, &vk.descriptorSet, 0, 0);
+            vk.commandBuffer, bindPoint, 
+            vk.pipelineLayout, 0, 2, descriptorSets, 1, &vk.cameraOffset);
+
+        TracePushConstants pushConstants{
+            .frameIndex = vk.accumFrameCount,
+            .samplesPerFrame = options.samplesPerFrame,
+            .progressive = options.progressive,
+            .exposure = options.exposure,
+            .frameSeed = vk.frameSeed,
+            .pathTrace = options.pathTrace,
+            .maxDepth = options.maxDepth,
+            .rrStartDepth = options.rrStartDepth,
+            .collectStats = options.stats,
+            .hitRecordBase = (uint)(vk.sbt.recordDataOffset(SBT_HIT, 0) / 4),
+            .hitRecordStride = (uint)(vk.sbt.stride(SBT_HIT) / 4),
+            .alphaTest = alphaTest,
+            .shadows = options.shadows,
+            .cullMask = MASK_QUADS | MASK_PARTICLES | MASK_GENERATED | (tessellated ? MASK_TESSELLATED : MASK_PROCEDURAL),
+            .sortRays = options.sortRays,
+            .renderWidth = vk.renderWidth,
+            .renderHeight = vk.renderHeight,
+            .denoise = options.denoise,
+        };
+        vkCmdPushConstants(
+            vk.commandBuffer, vk.pipelineLayout, TRACE_PUSH_CONSTANT_STAGES,
+            0, sizeof(pushConstants), &pushConstants);
+
+        // Ends and submits the tiles recorded so far, then continues in a fresh command buffer.
+        // Only the last submit of the frame waits for the swapchain image and signals the fence.
+        uint submitCount = 0;
+        auto splitSubmit = [&]() {
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record command buffer!");
+            }
+            VkSubmitInfo submitInfo{ 
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &commandBuffer,
+            };
+            if (vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit tile command buffer!");
+            }
 
-        vk.vkCmdTraceRaysKHR(
-            vk.commandBuffer,
-            &vk.rgenSbt,
-            &vk.missSbt,
-            &vk.hitgSbt,
-            &callSbt,
-            WIDTH, HEIGHT, 1);
+            if (submitCount == vk.tileCommandBuffers.size()) {
+                VkCommandBufferAllocateInfo allocInfo{
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                    .commandPool = vk.commandPool,
+                    .commandBufferCount = 1,
+                };
+                if (vkAllocateCommandBuffers(vk.device, &allocInfo, &vk.tileCommandBuffers.emplace_back()) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate command buffers!");
+                }
+            }
+            commandBuffer = vk.tileCommandBuffers[submitCount++];
+            vkResetCommandBuffer(commandBuffer, 0);
+            if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording command buffer!");
+            }
+            vkCmdBindPipeline(commandBuffer, bindPoint, pipeline);
+            vkCmdBindDescriptorSets(
+                commandBuffer, bindPoint, 
+                vk.pipelineLayout, 0, 2, descriptorSets, 1, &vk.cameraOffset);
+        };
+
+        vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_TRACE_BEGIN);
+        if (wavefront) {
+            vkCmdBindDescriptorSets(
+                vk.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, 
+                vk.pipelineLayout, 0, 2, descriptorSets, 1, &vk.cameraOffset);
+            cmdTraceWavefront(vk.commandBuffer, pushConstants);    // not tiled, its passes already cover every path
+            vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, vk.timestampPool, TS_TRACE_END);
+        }
+        else {
+            // Tiles are disjoint, so they need no barriers between each other; the submits only 
+            // split one long trace into shorter pieces of GPU work.
+            const uint32_t tileSize = options.tileSize > 0 ? options.tileSize : std::max(WIDTH, HEIGHT);
+            uint tileCount = 0;
+            for (uint32_t y = 0; y < vk.renderHeight; y += tileSize) {
+                for (uint32_t x = 0; x < vk.renderWidth; x += tileSize) {
+                    if (tileCount > 0 && tileCount % options.tilesPerSubmit == 0) {
+                        splitSubmit();
+                    }
+                    ++tileCount;
+
+                    pushConstants.tileX = x;
+                    pushConstants.tileY = y;
+                    vkCmdPushConstants(
+                        commandBuffer, vk.pipelineLayout, TRACE_PUSH_CONSTANT_STAGES,
+                        0, sizeof(pushConstants), &pushConstants);
+
+                    const uint32_t width = std::min(tileSize, vk.renderWidth - x);
+                    const uint32_t height = std::min(tileSize, vk.renderHeight - y);
+                    if (traceMode == TRACE_PIPELINE) {
+                        VkStridedDeviceAddressRegionKHR rgenSbt = vk.sbt.region(SBT_RAYGEN);
+                        VkStridedDeviceAddressRegionKHR missSbt = vk.sbt.region(SBT_MISS);
+                        VkStridedDeviceAddressRegionKHR hitgSbt = vk.sbt.region(SBT_HIT);
+                        VkStridedDeviceAddressRegionKHR callSbt = vk.sbt.region(SBT_CALLABLE);
+                        vk.vkCmdTraceRaysKHR(
+                            commandBuffer,
+                            &rgenSbt,
+                            &missSbt,
+                            &hitgSbt,
+                            &callSbt,
+                            width, height, 1);
+                    }
+                    else {
+                        vkCmdDispatch(commandBuffer, (width + 7) / 8, (height + 7) / 8, 1);    // local_size 8x8 in trace_src
+                    }
+                }
+            }
+            vkCmdWriteTimestamp(
+                commandBuffer, 
+                traceMode == TRACE_PIPELINE ? VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+                vk.timestampPool, TS_TRACE_END);
+        }
+        vk.lastVariant = 
+            (wavefront ? VARIANT_WAVEFRONT : traceMode == TRACE_RAY_QUERY ? VARIANT_RAY_QUERY : 0) | 
+            (alphaTest ? VARIANT_ALPHA_TEST : 0) | 
+            (tessellated ? VARIANT_TESSELLATED : 0);
+
+        if (options.denoise) {
+            VkMemoryBarrier barrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            };
+            vkCmdPipelineBarrier(
+                commandBuffer, 
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                1, &barrier, 0, nullptr, 0, nullptr);
+
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_DENOISE_BEGIN);
+            cmdDenoise(commandBuffer, options.pathTrace || options.progressive);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, vk.timestampPool, TS_DENOISE_END);
+        }
+        else {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_DENOISE_BEGIN);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, TS_DENOISE_END);
+        }
+        vk.lastDenoised = options.denoise;
         
         setImageLayout(
-            vk.commandBuffer,
+            commandBuffer,
             vk.outImage,
             VK_IMAGE_LAYOUT_GENERAL,
             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
             subresourceRange);
+
+        // Below render scale 1 only the top left renderWidth x renderHeight of outImage is traced;
+        // it is stretched over upscaleImage with bilinear filtering before going to the swapchain.
+        VkImage presentedImage = vk.outImage;
+        if (vk.renderWidth < WIDTH || vk.renderHeight < HEIGHT) {
+            setImageLayout(
+                commandBuffer,
+                vk.upscaleImage,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                subresourceRange);
+
+            VkImageBlit blitRegion{
+                .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+                .srcOffsets = { { 0, 0, 0 }, { (int32_t)vk.renderWidth, (int32_t)vk.renderHeight, 1 } },
+                .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+                .dstOffsets = { { 0, 0, 0 }, { (int32_t)WIDTH, (int32_t)HEIGHT, 1 } },
+            };
+            vkCmdBlitImage(
+                commandBuffer,
+                vk.outImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                vk.upscaleImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                1, &blitRegion, VK_FILTER_LINEAR);
+
+            setImageLayout(
+                commandBuffer,
+                vk.upscaleImage,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                subresourceRange);
+            presentedImage = vk.upscaleImage;
+        }
             
         setImageLayout(
-            vk.commandBuffer,
+            commandBuffer,
             vk.swapChainImages[imageIndex],
             VK_IMAGE_LAYOUT_UNDEFINED,
             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
             subresourceRange);
         
         vkCmdCopyImage(
-            vk.commandBuffer,
-            vk.outImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            commandBuffer,
+            presentedImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
             vk.swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
             1, &copyRegion);
 
         setImageLayout(
-            vk.commandBuffer,
+            commandBuffer,
             vk.outImage,
             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
             VK_IMAGE_LAYOUT_GENERAL,
             subresourceRange);
 
         setImageLayout(
-            vk.commandBuffer,
+            commandBuffer,
             vk.swapChainImages[imageIndex],
             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
             VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
             subresourceRange);
     }
-    if (vkEndCommandBuffer(vk.commandBuffer) != VK_SUCCESS) {
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to record command buffer!");
     }
 
@@ -1405,7 +6050,7 @@ void render()
         .pWaitSemaphores = waitSemaphores,
         .pWaitDstStageMask = waitStages,
         .commandBufferCount = 1,
-        .pCommandBuffers = &vk.commandBuffer,
+        .pCommandBuffers = &commandBuffer,
     };
     
     if (vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, vk.fence0) != VK_SUCCESS) {
@@ -1420,31 +6065,164 @@ void render()
     };
     
     vkQueuePresentKHR(vk.graphicsQueue, &presentInfo);
+
+    if (options.progressive) {
+        ++vk.accumFrameCount;
+    }
+    ++vk.frameSeed;
+}
+
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS && action != GLFW_REPEAT)
+        return;
+
+    switch (key) {
+    case GLFW_KEY_P:
+        options.progressive = !options.progressive;
+        vk.accumFrameCount = 0;
+        std::cout << "progressive: " << (options.progressive ? "on" : "off") << std::endl;
+        break;
+    case GLFW_KEY_RIGHT_BRACKET:
+        options.samplesPerFrame = std::min(options.samplesPerFrame * 2, 64u);
+        std::cout << "samples per frame: " << options.samplesPerFrame << std::endl;
+        break;
+    case GLFW_KEY_LEFT_BRACKET:
+        options.samplesPerFrame = std::max(options.samplesPerFrame / 2, 1u);
+        std::cout << "samples per frame: " << options.samplesPerFrame << std::endl;
+        break;
+    case GLFW_KEY_T:
+        options.pathTrace = !options.pathTrace;
+        vk.accumFrameCount = 0;
+        std::cout << "path tracing: " << (options.pathTrace ? "on" : "off") << std::endl;
+        break;
+    case GLFW_KEY_PERIOD:
+        options.maxDepth = std::min(options.maxDepth + 1, MAX_PATH_DEPTH);
+        vk.accumFrameCount = 0;
+        std::cout << "max depth: " << options.maxDepth << std::endl;
+        break;
+    case GLFW_KEY_COMMA:
+        options.maxDepth = std::max(options.maxDepth - 1, 1u);
+        vk.accumFrameCount = 0;
+        std::cout << "max depth: " << options.maxDepth << std::endl;
+        break;
+    case GLFW_KEY_M:
+        cycleHitRecordColor();
+        break;
+    case GLFW_KEY_N:
+        vk.materialRequested = true;
+        break;
+    case GLFW_KEY_W:
+        if (vk.wavefrontPipelines[WAVEFRONT_TRACE] == VK_NULL_HANDLE) {
+            std::cout << "ray query is not supported on this device" << std::endl;
+            break;
+        }
+        options.wavefront = !options.wavefront;
+        std::cout << "wavefront: " << (options.wavefront ? "on" : "off") << 
+            (options.pathTrace ? "" : " (takes effect in path tracing mode)") << std::endl;
+        break;
+    case GLFW_KEY_O:
+        options.sortRays = !options.sortRays;
+        std::cout << "wavefront ray sorting: " << (options.sortRays ? "on" : "off") << std::endl;
+        break;
+    case GLFW_KEY_Q:
+        if (!vk.rayQuerySupported) {
+            std::cout << "ray query is not supported on this device" << std::endl;
+            break;
+        }
+        options.traceMode = options.traceMode == TRACE_PIPELINE ? TRACE_RAY_QUERY : TRACE_PIPELINE;
+        std::cout << "trace mode: " << traceModeNames[options.traceMode] << std::endl;
+        break;
+    case GLFW_KEY_A:
+        options.alphaTest = !options.alphaTest;
+        vk.accumFrameCount = 0;
+        std::cout << "alpha test: " << (options.alphaTest ? "on" : "off") << std::endl;
+        break;
+    case GLFW_KEY_S:
+        options.shadows = !options.shadows;
+        vk.accumFrameCount = 0;
+        std::cout << "shadows: " << (options.shadows ? "on" : "off") << std::endl;
+        break;
+    case GLFW_KEY_G:
+        options.tessellated = !options.tessellated;
+        vk.accumFrameCount = 0;
+        std::cout << "shapes: " << (options.tessellated ? "tessellated" : "procedural") << std::endl;
+        break;
+    case GLFW_KEY_R:
+        options.refit = !options.refit;
+        std::cout << "particle BLAS: " << (options.refit ? "refit" : "rebuild") << std::endl;
+        break;
+    case GLFW_KEY_C:
+        options.cull = !options.cull;
+        vk.accumFrameCount = 0;
+        std::cout << "instance culling: " << (options.cull ? "on" : "off") << std::endl;
+        break;
+    case GLFW_KEY_D:
+        options.denoise = !options.denoise;
+        std::cout << "denoise: " << (options.denoise ? "on" : "off") << std::endl;
+        break;
+    case GLFW_KEY_I:
+        options.denoiseIterations = (options.denoiseIterations + 1) % (MAX_DENOISE_ITERATIONS + 1);
+        std::cout << "denoise iterations: " << options.denoiseIterations << std::endl;
+        break;
+    case GLFW_KEY_MINUS:
+    case GLFW_KEY_EQUAL:
+        setRenderScale(vk.renderScale + (key == GLFW_KEY_MINUS ? -0.125f : 0.125f));
+        std::cout << "render scale: " << vk.renderScale << " (" << vk.renderWidth << "x" << vk.renderHeight << ")" <<
+            (options.frameBudgetMs > 0.0f ? ", --frame-budget keeps adjusting it" : "") << std::endl;
+        break;
+    }
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    parseOptions(argc, argv);
+
     glfwInit();
     GLFWwindow* window = createWindow();
+    glfwSetKeyCallback(window, keyCallback);
     createVkInstance(window);
     createVkDevice();
     loadDeviceExtensionFunctions(vk.device);
     createSwapChain();
     createCommandCenter();
     createSyncObjects();
+    createQueryPool();
 
     createBLAS();
+    createProceduralScene();
+    createParticles();
     createTLAS();
     createOutImage();
+    createAlphaTexture();
+    createBindlessResources();  // set 1, before the pipeline layout
     createUniformBuffer();
+    createRayStatsBuffer();
+    createWavefrontBuffers();
     createRayTracingPipeline();
-    createDescriptorSets();
+    createRayQueryPipeline();
+    createWavefrontPipelines();
+    createDenoisePipelines();
+    createCullPipeline();
+    createInstanceGenPipeline();
+    createParticlePipeline();
     createShaderBindingTable();
+    createDescriptorSets();     // binding 5 is the shader binding table buffer
+    setRenderScale(options.renderScale);
+    generateInstances();
 
-    while (!glfwWindowShouldClose(window))
+    const auto begin = std::chrono::steady_clock::now();
+    uint frames = 0;
+    while (!glfwWindowShouldClose(window) && (options.frameLimit == 0 || frames < options.frameLimit))
     {
         glfwPollEvents();
+        updateCamera(window);
         render();
+        ++frames;
+    }
+    if (options.cameraPath && frames > 0) {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printf("[camera] %u path frames in %.2f s, %.3f ms/frame\n", frames, seconds, seconds * 1e3 / frames);
     }
 
     vkDeviceWaitIdle(vk.device);
@@ -90,6 +90,7 @@ GLSLANG_STAGE_MAPPING(VK_SHADER_STAGE_RAYGEN_BIT_KHR, GLSLANG_STAGE_RAYGEN);
 GLSLANG_STAGE_MAPPING(VK_SHADER_STAGE_ANY_HIT_BIT_KHR, GLSLANG_STAGE_ANYHIT);
 GLSLANG_STAGE_MAPPING(VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, GLSLANG_STAGE_CLOSESTHIT);
 GLSLANG_STAGE_MAPPING(VK_SHADER_STAGE_MISS_BIT_KHR, GLSLANG_STAGE_MISS);
+GLSLANG_STAGE_MAPPING(VK_SHADER_STAGE_INTERSECTION_BIT_KHR, GLSLANG_STAGE_INTERSECT);
 
 
 template <VkShaderStageFlagBits VkStage>
@@ -7,12 +7,30 @@
 #include <bitset>
 #include <span>
 #include <cmath>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstddef>
 //#include "glsl2spv.h"
 
 typedef unsigned int uint;
 
 const uint32_t WIDTH = 1600;
 const uint32_t HEIGHT = 1200;
+const uint32_t UNIFORM_RING_FRAMES = 2;     // the frame the GPU may still be drawing + the one being written
+const uint32_t STATS_REPORT_INTERVAL = 120; // frames between [strategy] reports
+
+// How the per-draw ObjectUniform reaches the vertex shader
+enum DrawStrategy {
+    STRATEGY_UBO,               // a plain UBO set pinned to each object's slice, one set bind per draw
+    STRATEGY_DYNAMIC_UBO,       // one set for every object, one dynamic offset per draw
+    STRATEGY_PUSH_CONSTANTS,    // vkCmdPushConstants per draw, nothing in memory
+    STRATEGY_INSTANCED,         // per-instance vertex attributes, one vkCmdDrawIndexed for all
+    STRATEGY_INDIRECT,          // compute culling writes the draws, one vkCmdDrawIndexedIndirectCount for all
+    STRATEGY_COUNT,
+};
+const char* STRATEGY_NAMES[STRATEGY_COUNT] = { "ubo", "dynamic", "push", "instanced", "gpu" };
 
 #ifdef NDEBUG
 const bool ON_DEBUG = false;
@@ -31,6 +49,7 @@ struct Global {
 
     VkQueue graphicsQueue; // assume allowing graphics and present
     uint queueFamilyIndex;
+    bool drawIndirectCount;         // drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance enabled
 
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
@@ -41,11 +60,14 @@ struct Global {
     VkRenderPass renderPass;
     std::vector<VkFramebuffer> framebuffers;
 
-    VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    VkPipelineLayout pipelineLayouts[STRATEGY_COUNT];
+    VkPipeline graphicsPipelines[STRATEGY_COUNT];
 
     VkCommandPool commandPool;
     VkCommandBuffer commandBuffer;
+    std::vector<VkCommandPool> workerPools;             // one per recording thread
+    std::vector<VkCommandBuffer> workerCommandBuffers;  // secondary, one per worker pool
+    uint recordThreads = 0;                             // 0: draws are recorded inline into commandBuffer
 
     VkSemaphore imageAvailableSemaphore;
     VkSemaphore renderFinishedSemaphore;
@@ -55,36 +77,87 @@ struct Global {
     VkDeviceMemory vertexBufferMemory;
     VkBuffer indexBuffer;
     VkDeviceMemory indexBufferMemory;
-    VkBuffer uniformBuffer;
+    VkBuffer uniformBuffer;         // UNIFORM_RING_FRAMES x objects slices, one ObjectUniform each
     VkDeviceMemory uniformBufferMemory;
-
-    VkDescriptorSetLayout descriptorSetLayout;
+    uint8_t* uniformRing;           // persistently mapped
+    VkDeviceSize uniformSliceSize;  // ObjectUniform rounded up to minUniformBufferOffsetAlignment
+    uint uniformRingFrame = 0;
+    VkBuffer instanceBuffer;        // STRATEGY_INSTANCED: UNIFORM_RING_FRAMES x objects InstanceData, tightly packed
+    VkDeviceMemory instanceBufferMemory;
+    uint8_t* instanceRing;          // persistently mapped
+
+    VkDescriptorSetLayout descriptorSetLayout;      // binding 0 as UNIFORM_BUFFER_DYNAMIC
+    VkDescriptorSetLayout staticSetLayout;          // binding 0 as plain UNIFORM_BUFFER
     VkDescriptorPool descriptorPool;
     VkDescriptorSet descriptorSet;
+    std::vector<VkDescriptorSet> objectSets;        // STRATEGY_UBO: one per ring frame x object slice
+
+    // STRATEGY_INDIRECT
+    VkDescriptorSetLayout cullSetLayout;            // bindings 0 ~ 3 below, shared by the cull and the draw
+    VkDescriptorSet cullSet;
+    VkPipeline cullPipeline;
+    VkBuffer objectBuffer;          // 0: ObjectInstance per object, uploaded once
+    VkDeviceMemory objectBufferMemory;
+    VkBuffer transformBuffer;       // 1: ObjectUniform per object, written by the cull for the visible ones
+    VkDeviceMemory transformBufferMemory;
+    VkBuffer drawBuffer;            // 2: VkDrawIndexedIndirectCommand per visible object
+    VkDeviceMemory drawBufferMemory;
+    VkBuffer drawCountBuffer;       // 3: number of draws in drawBuffer
+    VkDeviceMemory drawCountBufferMemory;
+    VkBuffer visibleCountBuffer;    // drawCountBuffer copied back for the report
+    VkDeviceMemory visibleCountBufferMemory;
+    uint32_t* visibleCount;         // persistently mapped
+
+    VkQueryPool timestampPool;
+    float timestampPeriod;          // nanoseconds per tick
+    DrawStrategy lastStrategy;      // strategy of the frame whose timestamps are read next
+    bool timestampsPending = false;
 
     ~Global() {
+        vkDestroyQueryPool(device, timestampPool, nullptr);
+        vkDestroyPipeline(device, cullPipeline, nullptr);
+        vkDestroyBuffer(device, objectBuffer, nullptr);
+        vkFreeMemory(device, objectBufferMemory, nullptr);
+        vkDestroyBuffer(device, transformBuffer, nullptr);
+        vkFreeMemory(device, transformBufferMemory, nullptr);
+        vkDestroyBuffer(device, drawBuffer, nullptr);
+        vkFreeMemory(device, drawBufferMemory, nullptr);
+        vkDestroyBuffer(device, drawCountBuffer, nullptr);
+        vkFreeMemory(device, drawCountBufferMemory, nullptr);
+        vkDestroyBuffer(device, visibleCountBuffer, nullptr);
+        vkFreeMemory(device, visibleCountBufferMemory, nullptr);
+
         vkDestroyBuffer(device, vertexBuffer, nullptr);
         vkFreeMemory(device, vertexBufferMemory, nullptr);
         vkDestroyBuffer(device, indexBuffer, nullptr);
         vkFreeMemory(device, indexBufferMemory, nullptr);
         vkDestroyBuffer(device, uniformBuffer, nullptr);
         vkFreeMemory(device, uniformBufferMemory, nullptr);
+        vkDestroyBuffer(device, instanceBuffer, nullptr);
+        vkFreeMemory(device, instanceBufferMemory, nullptr);
 
         vkDestroyDescriptorPool(device, descriptorPool, nullptr);
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, staticSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, cullSetLayout, nullptr);
 
         vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
         vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
         vkDestroyFence(device, inFlightFence, nullptr);
 
+        for (auto pool : workerPools) {
+            vkDestroyCommandPool(device, pool, nullptr);
+        }
         vkDestroyCommandPool(device, commandPool, nullptr);
 
         for (auto framebuffer : framebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
         }
 
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
-        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        for (uint i = 0; i < STRATEGY_COUNT; ++i) {
+            vkDestroyPipeline(device, graphicsPipelines[i], nullptr);
+            vkDestroyPipelineLayout(device, pipelineLayouts[i], nullptr);
+        }
         vkDestroyRenderPass(device, renderPass, nullptr);
 
         for (auto imageView : swapChainImageViews) {
@@ -101,6 +174,103 @@ struct Global {
     }
 } vk;
 
+struct Options {
+    uint objectCount = 1;           // rectangles on a grid, each with its own uniform slice
+    DrawStrategy strategy = STRATEGY_PUSH_CONSTANTS;
+    bool compareStrategies = false; // rotate through every strategy, one per frame
+    uint recordThreads = 0;         // secondary command buffers recorded by this many threads, 0: inline
+    bool threadSweep = false;       // double the threads after every report, 1 .. recordThreads
+} options;
+
+struct StrategyStats {
+    uint frames = 0;
+    double writeMs = 0.0;           // objects copied into the uniform ring
+    double recordMs = 0.0;          // the draw loop of the command buffer
+    uint gpuFrames = 0;
+    double gpuMs = 0.0;             // the render pass, from timestamps
+    double visibleDraws = 0.0;      // STRATEGY_INDIRECT: draws the cull let through, summed over gpuFrames
+} strategyStats[STRATEGY_COUNT];
+
+void parseOptions(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--objects") {
+            options.objectCount = std::max(1, std::atoi(next()));
+        } else if (arg == "--strategy") {
+            std::string name = next();
+            auto found = std::find(STRATEGY_NAMES, STRATEGY_NAMES + STRATEGY_COUNT, name);
+            if (found == STRATEGY_NAMES + STRATEGY_COUNT) {
+                throw std::runtime_error("unknown strategy: " + name);
+            }
+            options.strategy = (DrawStrategy)(found - STRATEGY_NAMES);
+        } else if (arg == "--compare-strategies") {
+            options.compareStrategies = true;
+        } else if (arg == "--threads") {
+            options.recordThreads = std::max(0, std::atoi(next()));
+        } else if (arg == "--thread-sweep") {
+            options.threadSweep = true;
+        } else {
+            throw std::runtime_error("unknown option: " + arg);
+        }
+    }
+
+    if (options.threadSweep && options.recordThreads == 0) {
+        options.recordThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    vk.recordThreads = options.threadSweep ? 1 : options.recordThreads;
+}
+
+// std140 layout of UBO in vertex_input_ubo_vs.glsl, also pushed as is to the push_constant block of vertex_input_vs.glsl
+struct ObjectUniform {
+    float dx;
+    float dy;
+    float scale;
+    float padding;
+};
+
+std::vector<ObjectUniform> objects;     // this frame's parameters, written by updateUniformBuffer()
+
+// Per-instance attributes of vertex_input_instanced_vs.glsl, locations 2 and 3
+struct InstanceData {
+    float dx;
+    float dy;
+    float scale;
+    uint32_t color;     // RGBA8, multiplies the vertex color
+};
+
+// std430 layout of Objects in object_cull_cs.glsl
+struct ObjectInstance {
+    float dx;           // grid cell, before the animation
+    float dy;
+    float scale;
+    float radius;       // bounding circle of the scaled rectangle
+};
+
+// Where the objects sit and how they move, applied on the CPU or by object_cull_cs.glsl for STRATEGY_INDIRECT
+struct ObjectAnimation {
+    uint columns = 1;       // of the grid the objects share the window in
+    float cell = 2.0f;
+    float amplitude = 1.0f; // of the vertical bob
+    float time = 0.0f;
+    float drift = 0.0f;     // the x drift that used to be written into the vertex buffer every frame
+} animation;
+
+// push_constant block of object_cull_cs.glsl
+struct CullPushConstants {
+    float time;
+    float drift;
+    float amplitude;
+    uint32_t objectCount;
+    uint32_t indexCount;
+};
 
 struct Geometry {
     static const uint vertexBytesSize = 20;
@@ -131,6 +301,15 @@ struct Geometry {
         };
     }
 
+    // STRATEGY_INSTANCED: binding 1 advances once per instance instead of once per vertex
+    static VkVertexInputBindingDescription getInstanceBindingDescription() {
+        return {
+            .binding = 1,
+            .stride = sizeof(InstanceData),
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+        };
+    }
+
     static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
         return {
             {
@@ -146,6 +325,22 @@ struct Geometry {
             }
         };
     }
+
+    static std::vector<VkVertexInputAttributeDescription> getInstanceAttributeDescriptions() {
+        return {
+            {
+                .location = 2,
+                .binding = 1,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,   // dx, dy, scale
+                .offset = offsetof(InstanceData, dx),
+            }, {
+                .location = 3,
+                .binding = 1,
+                .format = VK_FORMAT_R8G8B8A8_UNORM,     // tint
+                .offset = offsetof(InstanceData, color),
+            }
+        };
+    }
 };
 
 
@@ -256,7 +451,7 @@ void createVkInstance(GLFWwindow* window)
     VkApplicationInfo appInfo{
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
         .pApplicationName = "Hello Triangle",
-        .apiVersion = VK_API_VERSION_1_0
+        .apiVersion = VK_API_VERSION_1_2       // vkCmdDrawIndexedIndirectCount
     };
 
     uint32_t glfwExtensionCount = 0;
@@ -342,6 +537,26 @@ void createVkDevice()
     }
     float queuePriority = 1.0f;
 
+    // STRATEGY_INDIRECT needs all three, they are enabled when present and the strategy is refused otherwise.
+    VkPhysicalDeviceVulkan12Features supported12{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+    VkPhysicalDeviceFeatures2 supported{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported12,
+    };
+    vkGetPhysicalDeviceFeatures2(vk.physicalDevice, &supported);
+    vk.drawIndirectCount = supported12.drawIndirectCount
+        && supported.features.multiDrawIndirect
+        && supported.features.drawIndirectFirstInstance;
+
+    VkPhysicalDeviceVulkan12Features features12{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .drawIndirectCount = vk.drawIndirectCount,
+    };
+    VkPhysicalDeviceFeatures features{
+        .multiDrawIndirect = vk.drawIndirectCount,
+        .drawIndirectFirstInstance = vk.drawIndirectCount,
+    };
+
     VkDeviceQueueCreateInfo queueCreateInfo{
         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
         .queueFamilyIndex = vk.queueFamilyIndex,
@@ -351,10 +566,12 @@ void createVkDevice()
 
     VkDeviceCreateInfo createInfo{
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &features12,
         .queueCreateInfoCount = 1,
         .pQueueCreateInfos = &queueCreateInfo,
         .enabledExtensionCount = (uint)extentions.size(),
         .ppEnabledExtensionNames = extentions.data(),
+        .pEnabledFeatures = &features,
     };
 
     if (vkCreateDevice(vk.physicalDevice, &createInfo, nullptr, &vk.device) != VK_SUCCESS) {
@@ -362,6 +579,10 @@ void createVkDevice()
     }
 
     vkGetDeviceQueue(vk.device, vk.queueFamilyIndex, 0, &vk.graphicsQueue);
+
+    if (!vk.drawIndirectCount && (options.strategy == STRATEGY_INDIRECT)) {
+        throw std::runtime_error("the gpu strategy needs drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance!");
+    }
 }
 
 void createSwapChain()
@@ -496,11 +717,12 @@ void createRenderPass()
 
 void createDescriptorRelated()
 {
-    // Create Descriptor Set Layout
+    // Create Descriptor Set Layouts
     {   
+        // Dynamic: the offset into the buffer is given at bind time, so one set serves every object.
         VkDescriptorSetLayoutBinding uboLayoutBinding{
             .binding = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
             .descriptorCount = 1,
             .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
         };
@@ -514,20 +736,77 @@ void createDescriptorRelated()
         if (vkCreateDescriptorSetLayout(vk.device, &layoutInfo, nullptr, &vk.descriptorSetLayout) != VK_SUCCESS) {
             throw std::runtime_error("failed to create descriptor set layout!");
         }
+
+        // Plain: the offset is baked into the set, so STRATEGY_UBO needs a set per slice.
+        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        if (vkCreateDescriptorSetLayout(vk.device, &layoutInfo, nullptr, &vk.staticSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout!");
+        }
+
+        // STRATEGY_INDIRECT: the cull reads the objects and writes the rest, the vertex shader reads the transforms.
+        VkDescriptorSetLayoutBinding cullBindings[] = {
+            {
+                .binding = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+            {
+                .binding = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+            },
+            {
+                .binding = 2,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+            {
+                .binding = 3,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            },
+        };
+
+        VkDescriptorSetLayoutCreateInfo cullLayoutInfo{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = sizeof(cullBindings) / sizeof(VkDescriptorSetLayoutBinding),
+            .pBindings = cullBindings,
+        };
+
+        if (vkCreateDescriptorSetLayout(vk.device, &cullLayoutInfo, nullptr, &vk.cullSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout!");
+        }
     }
 
+    const uint objectSetCount = UNIFORM_RING_FRAMES * options.objectCount;
+
     // Create Descriptor Pool
     {
-        VkDescriptorPoolSize poolSize{
-            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
+        VkDescriptorPoolSize poolSizes[] = {
+            {
+                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .descriptorCount = 1,
+            },
+            {
+                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .descriptorCount = objectSetCount,
+            },
+            {
+                .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 4,
+            },
         };
         
         VkDescriptorPoolCreateInfo poolInfo{
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-            .maxSets = 1,
-            .poolSizeCount = 1,
-            .pPoolSizes = &poolSize,
+            .maxSets = 2 + objectSetCount,
+            .poolSizeCount = sizeof(poolSizes) / sizeof(VkDescriptorPoolSize),
+            .pPoolSizes = poolSizes,
         };
 
         if (vkCreateDescriptorPool(vk.device, &poolInfo, nullptr, &vk.descriptorPool) != VK_SUCCESS) {
@@ -535,7 +814,7 @@ void createDescriptorRelated()
         }
     }
 
-    // Create Descriptor Set
+    // Create Descriptor Sets
     {
         VkDescriptorSetAllocateInfo allocInfo{
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
@@ -547,41 +826,93 @@ void createDescriptorRelated()
         if (vkAllocateDescriptorSets(vk.device, &allocInfo, &vk.descriptorSet) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate descriptor sets!");
         }
+
+        allocInfo.pSetLayouts = &vk.cullSetLayout;
+
+        if (vkAllocateDescriptorSets(vk.device, &allocInfo, &vk.cullSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(objectSetCount, vk.staticSetLayout);
+        vk.objectSets.resize(objectSetCount);
+        allocInfo.descriptorSetCount = objectSetCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        if (vkAllocateDescriptorSets(vk.device, &allocInfo, vk.objectSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
     }
 
-    // Create Pipeline Layout
+    // Create Pipeline Layouts
     {
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-            .setLayoutCount = 1,
-            .pSetLayouts = &vk.descriptorSetLayout,
+        // The push constant layout has no set at all: ObjectUniform is recorded into the command buffer.
+        // The instanced layout is empty, its parameters are vertex attributes.
+        // The indirect layout pushes the cull parameters and is shared by the cull and the draw.
+        VkPushConstantRange pushConstantRanges[STRATEGY_COUNT] = {
+            {},
+            {},
+            {
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                .offset = 0,
+                .size = sizeof(ObjectUniform),
+            },
+            {},
+            {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(CullPushConstants),
+            },
         };
 
-        if (vkCreatePipelineLayout(vk.device, &pipelineLayoutInfo, nullptr, &vk.pipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
+        const VkDescriptorSetLayout* setLayouts[STRATEGY_COUNT] = {
+            &vk.staticSetLayout,        // STRATEGY_UBO
+            &vk.descriptorSetLayout,    // STRATEGY_DYNAMIC_UBO
+            nullptr,                    // STRATEGY_PUSH_CONSTANTS
+            nullptr,                    // STRATEGY_INSTANCED
+            &vk.cullSetLayout,          // STRATEGY_INDIRECT
+        };
+
+        for (uint i = 0; i < STRATEGY_COUNT; ++i) {
+            const bool push = pushConstantRanges[i].size > 0;
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo{
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                .setLayoutCount = setLayouts[i] ? 1u : 0u,
+                .pSetLayouts = setLayouts[i],
+                .pushConstantRangeCount = push ? 1u : 0u,
+                .pPushConstantRanges = &pushConstantRanges[i],
+            };
+
+            if (vkCreatePipelineLayout(vk.device, &pipelineLayoutInfo, nullptr, &vk.pipelineLayouts[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create pipeline layout!");
+            }
         }
     }
 
     // vkDestroyDescriptorSetLayout(vk.device, vk.descriptorSetLayout, nullptr);
 }
 
-void createGraphicsPipeline() 
+VkShaderModule spv2shaderModule(const char* filename)
 {
-    auto spv2shaderModule = [](const char* filename) {
-        auto vsSpv = readFile(filename);
-        VkShaderModuleCreateInfo createInfo{
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = vsSpv.size(),
-            .pCode = (uint*)vsSpv.data(),
-        };
-
-        VkShaderModule shaderModule;
-        if (vkCreateShaderModule(vk.device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create shader module!");
-        }
-        return shaderModule;
+    auto spv = readFile(filename);
+    VkShaderModuleCreateInfo createInfo{
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = spv.size(),
+        .pCode = (uint*)spv.data(),
     };
-    VkShaderModule vsModule = spv2shaderModule("vertex_input_vs.spv");
+
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(vk.device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shader module!");
+    }
+    return shaderModule;
+}
+
+void createGraphicsPipeline() 
+{
+    VkShaderModule vsModule = spv2shaderModule("vertex_input_vs.spv");                  // push_constant
+    VkShaderModule uboVsModule = spv2shaderModule("vertex_input_ubo_vs.spv");           // UBO at set 0, binding 0
+    VkShaderModule indirectVsModule = spv2shaderModule("vertex_input_indirect_vs.spv"); // SSBO at set 0, binding 1
+    VkShaderModule instancedVsModule = spv2shaderModule("vertex_input_instanced_vs.spv"); // per-instance attributes
     VkShaderModule fsModule = spv2shaderModule("vertex_input_fs.spv");
 
     VkPipelineShaderStageCreateInfo vsStageInfo{
@@ -610,6 +941,23 @@ void createGraphicsPipeline()
         .pVertexAttributeDescriptions = attributeDescriptions.data(),
     };
 
+    VkVertexInputBindingDescription instancedBindingDescriptions[] = {
+        bindingDescription,
+        Geometry::getInstanceBindingDescription(),
+    };
+    auto instancedAttributeDescriptions = attributeDescriptions;
+    for (auto& attribute : Geometry::getInstanceAttributeDescriptions()) {
+        instancedAttributeDescriptions.push_back(attribute);
+    }
+
+    VkPipelineVertexInputStateCreateInfo instancedVertexInputInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 2,
+        .pVertexBindingDescriptions = instancedBindingDescriptions,
+        .vertexAttributeDescriptionCount = (uint) instancedAttributeDescriptions.size(),
+        .pVertexAttributeDescriptions = instancedAttributeDescriptions.data(),
+    };
+
     VkPipelineInputAssemblyStateCreateInfo inputAssembly{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
         .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
@@ -666,19 +1014,54 @@ void createGraphicsPipeline()
         .pMultisampleState = &multisampling,
         .pColorBlendState = &colorBlending,
         .pDynamicState = &dynamicState,
-        .layout = vk.pipelineLayout,
         .renderPass = vk.renderPass,
         .subpass = 0,
     };
 
-    if (vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &vk.graphicsPipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create graphics pipeline!");
+    // Same state for every strategy, only the vertex shader, the layout and the instanced vertex input differ.
+    for (uint i = 0; i < STRATEGY_COUNT; ++i) {
+        shaderStages[0].module =
+            i == STRATEGY_PUSH_CONSTANTS ? vsModule :
+            i == STRATEGY_INSTANCED ? instancedVsModule :
+            i == STRATEGY_INDIRECT ? indirectVsModule : uboVsModule;
+        pipelineInfo.pVertexInputState = i == STRATEGY_INSTANCED ? &instancedVertexInputInfo : &vertexInputInfo;
+        pipelineInfo.layout = vk.pipelineLayouts[i];
+
+        if (vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &vk.graphicsPipelines[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
     }
     
     vkDestroyShaderModule(vk.device, vsModule, nullptr);
+    vkDestroyShaderModule(vk.device, uboVsModule, nullptr);
+    vkDestroyShaderModule(vk.device, indirectVsModule, nullptr);
+    vkDestroyShaderModule(vk.device, instancedVsModule, nullptr);
     vkDestroyShaderModule(vk.device, fsModule, nullptr);
 }
 
+// Shares vk.pipelineLayouts[STRATEGY_INDIRECT] with the indirect graphics pipeline.
+void createCullPipeline()
+{
+    VkShaderModule csModule = spv2shaderModule("object_cull_cs.spv");
+
+    VkComputePipelineCreateInfo pipelineInfo{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = csModule,
+            .pName = "main",
+        },
+        .layout = vk.pipelineLayouts[STRATEGY_INDIRECT],
+    };
+
+    if (vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &vk.cullPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+
+    vkDestroyShaderModule(vk.device, csModule, nullptr);
+}
+
 void createCommandCenter() 
 {
     VkCommandPoolCreateInfo poolInfo{
@@ -700,6 +1083,33 @@ void createCommandCenter()
     if (vkAllocateCommandBuffers(vk.device, &allocInfo, &vk.commandBuffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate command buffers!");
     }
+
+    // A pool and the command buffers allocated from it may be used by one thread at a time, so every
+    // recording thread gets its own. They are reset as a whole each frame, hence TRANSIENT.
+    vk.workerPools.resize(options.recordThreads);
+    vk.workerCommandBuffers.resize(options.recordThreads);
+    for (uint i = 0; i < options.recordThreads; ++i) {
+        VkCommandPoolCreateInfo workerPoolInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = vk.queueFamilyIndex,
+        };
+
+        if (vkCreateCommandPool(vk.device, &workerPoolInfo, nullptr, &vk.workerPools[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+
+        VkCommandBufferAllocateInfo workerAllocInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = vk.workerPools[i],
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = 1,
+        };
+
+        if (vkAllocateCommandBuffers(vk.device, &workerAllocInfo, &vk.workerCommandBuffers[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
 }
 
 void createSyncObjects() 
@@ -720,6 +1130,23 @@ void createSyncObjects()
 
 }
 
+void createQueryPool()
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vk.physicalDevice, &props);
+    vk.timestampPeriod = props.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo ci{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2,    // render pass begin, end
+    };
+
+    if (vkCreateQueryPool(vk.device, &ci, nullptr, &vk.timestampPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
+}
+
 std::tuple<VkBuffer, VkDeviceMemory> createBuffer(
     VkDeviceSize size, 
     VkBufferUsageFlags usage, 
@@ -808,17 +1235,6 @@ void createVertexBuffer()
     vkUnmapMemory(vk.device, vk.vertexBufferMemory);
 }
 
-void updateVertexBuffer(float t)
-{
-    size_t size = std::get<1>(Geometry::getVertices());
-    uint count = (uint)size / sizeof(float);
-    void* dst;
-    vkMapMemory(vk.device, vk.vertexBufferMemory, 0, size, 0, &dst);
-    for (uint i = 0; i < count; i+=5)
-        ((float*)dst)[i] += t;
-    vkUnmapMemory(vk.device, vk.vertexBufferMemory);
-}
-
 void createIndexBuffer()
 {
     auto [data, size] = Geometry::getIndices();
@@ -844,51 +1260,475 @@ void createIndexBuffer()
     vkFreeMemory(vk.device, stagingBufferMemory, nullptr);
 }
 
-void updateUniformBuffer(float t = 0.0)
+// Grid cell of an object before it moves. A single object keeps the original full-window motion.
+ObjectUniform objectPlacement(uint object)
 {
-    static void* dst;
-    float translation[2] = { 0, std::sin(t * 100) };
-    //float translation[2] = { 0, t };
+    return {
+        .dx = -1.0f + animation.cell * (object % animation.columns + 0.5f),
+        .dy = -1.0f + animation.cell * (object / animation.columns + 0.5f),
+        .scale = 0.5f * animation.cell,
+    };
+}
 
-    if(!vk.uniformBuffer)
-    { 
-        std::tie(vk.uniformBuffer, vk.uniformBufferMemory) = createBuffer(
-            sizeof(translation),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+void createUniformBuffer()
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vk.physicalDevice, &props);
+    const VkDeviceSize alignment = props.limits.minUniformBufferOffsetAlignment;
+    vk.uniformSliceSize = (sizeof(ObjectUniform) + alignment - 1) / alignment * alignment;
+
+    std::tie(vk.uniformBuffer, vk.uniformBufferMemory) = createBuffer(
+        vk.uniformSliceSize * options.objectCount * UNIFORM_RING_FRAMES,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    // Mapped for the whole run, vkFreeMemory unmaps it.
+    vkMapMemory(vk.device, vk.uniformBufferMemory, 0, VK_WHOLE_SIZE, 0, (void**)&vk.uniformRing);
+
+    // The only descriptor write: a window of one slice, moved to each object's slice by its dynamic offset.
+    VkDescriptorBufferInfo bufferInfo{
+        .buffer = vk.uniformBuffer,
+        .offset = 0,
+        .range = sizeof(ObjectUniform),
+    };
+
+    VkWriteDescriptorSet descriptorWrite{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = vk.descriptorSet,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .pBufferInfo = &bufferInfo,
+    };
 
-        vkMapMemory(vk.device, vk.uniformBufferMemory, 0, sizeof(translation), 0, &dst);
+    vkUpdateDescriptorSets(vk.device, 1, &descriptorWrite, 0, nullptr);
 
-        VkDescriptorBufferInfo bufferInfo{
+    // STRATEGY_UBO: every plain set is pinned to one slice, in the same order as uniformOffset().
+    std::vector<VkDescriptorBufferInfo> sliceInfos(vk.objectSets.size());
+    std::vector<VkWriteDescriptorSet> sliceWrites(vk.objectSets.size());
+    for (size_t i = 0; i < vk.objectSets.size(); ++i) {
+        sliceInfos[i] = {
             .buffer = vk.uniformBuffer,
-            .range = VK_WHOLE_SIZE,
+            .offset = i * vk.uniformSliceSize,
+            .range = sizeof(ObjectUniform),
         };
-
-        VkWriteDescriptorSet descriptorWrite{
+        sliceWrites[i] = {
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = vk.descriptorSet,
+            .dstSet = vk.objectSets[i],
             .dstBinding = 0,
             .descriptorCount = 1,
             .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .pBufferInfo = &bufferInfo,
+            .pBufferInfo = &sliceInfos[i],
         };
+    }
+
+    vkUpdateDescriptorSets(vk.device, (uint)sliceWrites.size(), sliceWrites.data(), 0, nullptr);
+
+    objects.resize(options.objectCount);
+    animation.columns = (uint)std::ceil(std::sqrt((float)options.objectCount));
+    animation.cell = 2.0f / animation.columns;
+    animation.amplitude = options.objectCount == 1 ? 1.0f : 0.25f * animation.cell;
+}
+
+// STRATEGY_INSTANCED: a ring like the uniform one, but vertex attributes need no offset alignment.
+void createInstanceBuffer()
+{
+    std::tie(vk.instanceBuffer, vk.instanceBufferMemory) = createBuffer(
+        sizeof(InstanceData) * options.objectCount * UNIFORM_RING_FRAMES,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    // Mapped for the whole run, vkFreeMemory unmaps it.
+    vkMapMemory(vk.device, vk.instanceBufferMemory, 0, VK_WHOLE_SIZE, 0, (void**)&vk.instanceRing);
+}
+
+// Tint of the instanced strategy, white for a single object so it looks as in the other strategies
+uint32_t objectColor(uint object)
+{
+    if (options.objectCount == 1) {
+        return 0xffffffff;
+    }
+    return (object * 2654435761u) | 0xff000000;    // hashed r, g, b and opaque a
+}
+
+/*
+STRATEGY_INDIRECT: the objects go to the GPU once, with the bounding circle of the scaled mesh. From then on the cull
+pass animates them and writes the transforms and the draws of the visible ones, so nothing per object is left for
+the CPU to do. Skipped when the device lacks the features, the gpu strategy is refused then.
+*/
+void createIndirectBuffers()
+{
+    if (!vk.drawIndirectCount) {
+        return;
+    }
+
+    float radius = 0.0f;    // of the mesh around its origin
+    {
+        auto [vertices, size] = Geometry::getVertices();
+        for (size_t offset = 0; offset < size; offset += Geometry::vertexBytesSize) {
+            const float* position = (const float*)((const uint8_t*)vertices + offset + Geometry::vertexPositionOffset);
+            radius = std::max(radius, std::sqrt(position[0] * position[0] + position[1] * position[1]));
+        }
+    }
+
+    // Objects, through a staging buffer like the index buffer
+    {
+        const VkDeviceSize size = sizeof(ObjectInstance) * options.objectCount;
+
+        auto [stagingBuffer, stagingBufferMemory] = createBuffer(
+            size,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-        vkUpdateDescriptorSets(vk.device, 1, &descriptorWrite, 0, nullptr);
+        std::tie(vk.objectBuffer, vk.objectBufferMemory) = createBuffer(
+            size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        ObjectInstance* dst;
+        vkMapMemory(vk.device, stagingBufferMemory, 0, size, 0, (void**)&dst);
+        for (uint i = 0; i < options.objectCount; ++i) {
+            const ObjectUniform placement = objectPlacement(i);
+            dst[i] = {
+                .dx = placement.dx,
+                .dy = placement.dy,
+                .scale = placement.scale,
+                .radius = radius * placement.scale,
+            };
+        }
+        vkUnmapMemory(vk.device, stagingBufferMemory);
+
+        copyBuffer(stagingBuffer, vk.objectBuffer, size);
+
+        vkDestroyBuffer(vk.device, stagingBuffer, nullptr);
+        vkFreeMemory(vk.device, stagingBufferMemory, nullptr);
     }
 
-    memcpy(dst, translation, sizeof(translation));
+    std::tie(vk.transformBuffer, vk.transformBufferMemory) = createBuffer(
+        sizeof(ObjectUniform) * options.objectCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.drawBuffer, vk.drawBufferMemory) = createBuffer(
+        sizeof(VkDrawIndexedIndirectCommand) * options.objectCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.drawCountBuffer, vk.drawCountBufferMemory) = createBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::tie(vk.visibleCountBuffer, vk.visibleCountBufferMemory) = createBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkMapMemory(vk.device, vk.visibleCountBufferMemory, 0, sizeof(uint32_t), 0, (void**)&vk.visibleCount);
+
+    VkBuffer buffers[] = { vk.objectBuffer, vk.transformBuffer, vk.drawBuffer, vk.drawCountBuffer };
+    VkDescriptorBufferInfo bufferInfos[4];
+    VkWriteDescriptorSet descriptorWrites[4];
+    for (uint binding = 0; binding < 4; ++binding) {
+        bufferInfos[binding] = {
+            .buffer = buffers[binding],
+            .range = VK_WHOLE_SIZE,
+        };
+        descriptorWrites[binding] = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = vk.cullSet,
+            .dstBinding = binding,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &bufferInfos[binding],
+        };
+    }
+
+    vkUpdateDescriptorSets(vk.device, 4, descriptorWrites, 0, nullptr);
 }
 
-void render()
+// Dynamic offset of the object's slice in the current ring frame
+uint32_t uniformOffset(uint object)
+{
+    return (uint32_t)((vk.uniformRingFrame * options.objectCount + object) * vk.uniformSliceSize);
+}
+
+/*
+Computes every object's parameters and, unless they are pushed, writes them into the next ring frame. It runs
+before render() waits for the fence: the previous frame may still be reading the other ring frame, and the last
+reader of this one finished before the previous frame was submitted. More than one object bob out of phase.
+STRATEGY_INDIRECT only advances the animation, object_cull_cs.glsl applies it.
+*/
+void updateUniformBuffer(DrawStrategy strategy, float t = 0.0)
+{
+    animation.time = t;
+    animation.drift += t * 0.01f;
+
+    if (strategy == STRATEGY_INDIRECT) {
+        return;
+    }
+
+    vk.uniformRingFrame = (vk.uniformRingFrame + 1) % UNIFORM_RING_FRAMES;
+
+    for (uint i = 0; i < options.objectCount; ++i) {
+        const ObjectUniform placement = objectPlacement(i);
+        objects[i] = {
+            .dx = placement.dx + animation.drift,
+            .dy = placement.dy + animation.amplitude * std::sin(t * 100 + i),
+            .scale = placement.scale,
+        };
+    }
+
+    if (strategy == STRATEGY_PUSH_CONSTANTS) {
+        return;
+    }
+
+    if (strategy == STRATEGY_INSTANCED) {
+        InstanceData* instances = (InstanceData*)vk.instanceRing + vk.uniformRingFrame * options.objectCount;
+        for (uint i = 0; i < options.objectCount; ++i) {
+            instances[i] = {
+                .dx = objects[i].dx,
+                .dy = objects[i].dy,
+                .scale = objects[i].scale,
+                .color = objectColor(i),
+            };
+        }
+        return;
+    }
+
+    uint8_t* dst = vk.uniformRing + uniformOffset(0);
+    for (uint i = 0; i < options.objectCount; ++i) {
+        *(ObjectUniform*)(dst + i * vk.uniformSliceSize) = objects[i];
+    }
+}
+
+// Accumulates the GPU time of the frame the fence just released under the strategy it was recorded with.
+void readTimestamps()
+{
+    if (!vk.timestampsPending) {
+        return;     // nothing has been submitted yet
+    }
+
+    uint64_t timestamps[2];
+    if (vkGetQueryPoolResults(
+        vk.device, vk.timestampPool, 0, 2,
+        sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    StrategyStats& stats = strategyStats[vk.lastStrategy];
+    stats.gpuMs += (timestamps[1] - timestamps[0]) * vk.timestampPeriod * 1e-6;
+    ++stats.gpuFrames;
+    if (vk.lastStrategy == STRATEGY_INDIRECT) {
+        stats.visibleDraws += *vk.visibleCount;
+    }
+}
+
+/*
+STRATEGY_INDIRECT, before the render pass: resets the draw count, culls every object against the view frustum (the
+clip space square of this 2D scene) and copies the count back for the report. Fixed cost on the CPU side.
+*/
+void recordCull(VkCommandBuffer commandBuffer)
+{
+    vkCmdFillBuffer(commandBuffer, vk.drawCountBuffer, 0, sizeof(uint32_t), 0);
+
+    VkMemoryBarrier fillBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+
+    const CullPushConstants pushConstants{
+        .time = animation.time,
+        .drift = animation.drift,
+        .amplitude = animation.amplitude,
+        .objectCount = options.objectCount,
+        .indexCount = (uint32_t)(std::get<1>(Geometry::getIndices()) / sizeof(uint16_t)),
+    };
+
+    const VkPipelineLayout layout = vk.pipelineLayouts[STRATEGY_INDIRECT];
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vk.cullPipeline);
+    vkCmdBindDescriptorSets(
+        commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        layout, 0,
+        1, &vk.cullSet,
+        0, nullptr);
+    vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (options.objectCount + 63) / 64, 1, 1);    // local_size_x 64 in object_cull_cs.glsl
+
+    VkMemoryBarrier cullBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy copyRegion{ .size = sizeof(uint32_t) };
+    vkCmdCopyBuffer(commandBuffer, vk.drawCountBuffer, vk.visibleCountBuffer, 1, &copyRegion);
+
+    VkMemoryBarrier readbackBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &readbackBarrier, 0, nullptr, 0, nullptr);
+}
+
+bool singleDraw(DrawStrategy strategy)
+{
+    return strategy == STRATEGY_INSTANCED || strategy == STRATEGY_INDIRECT;
+}
+
+/*
+Records objects [first, first + count) with the strategy's per-draw parameters. A secondary command buffer inherits
+no state from the primary, so everything the draws need is bound here each time.
+*/
+void recordDraws(VkCommandBuffer commandBuffer, DrawStrategy strategy, uint first, uint count)
 {
-    const VkClearValue clearColor = { .color = {0.0f, 0.0f, 0.0f, 1.0f} };
     const VkViewport viewport{ .width = (float)WIDTH, .height = (float)HEIGHT, .maxDepth = 1.0f };
     const VkRect2D scissor{ .extent = {.width = WIDTH, .height = HEIGHT } };
+
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    VkDeviceSize offsets[] = { 0 };
+    size_t numIndices = std::get<1>(Geometry::getIndices()) / sizeof(uint16_t);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vk.vertexBuffer, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, vk.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk.graphicsPipelines[strategy]);
+
+    const VkPipelineLayout layout = vk.pipelineLayouts[strategy];
+    switch (strategy) {
+    case STRATEGY_UBO:
+        // A different set for every object, each pinned to its slice of the current ring frame.
+        for (uint i = first; i < first + count; i++) {
+            vkCmdBindDescriptorSets(
+                commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                layout, 0,
+                1, &vk.objectSets[vk.uniformRingFrame * options.objectCount + i],
+                0, nullptr);
+            vkCmdDrawIndexed(commandBuffer, (uint)numIndices, 1, 0, 0, 0);
+        }
+        break;
+    case STRATEGY_DYNAMIC_UBO:
+        // Same descriptor set for every object, only the dynamic offset changes.
+        for (uint i = first; i < first + count; i++) {
+            const uint32_t dynamicOffset = uniformOffset(i);
+            vkCmdBindDescriptorSets(
+                commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                layout, 0,
+                1, &vk.descriptorSet,
+                1, &dynamicOffset);
+            vkCmdDrawIndexed(commandBuffer, (uint)numIndices, 1, 0, 0, 0);
+        }
+        break;
+    case STRATEGY_PUSH_CONSTANTS:
+        // The parameters themselves go into the command buffer, no buffer or descriptor involved.
+        for (uint i = first; i < first + count; i++) {
+            vkCmdPushConstants(
+                commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT,
+                0, sizeof(ObjectUniform), &objects[i]);
+            vkCmdDrawIndexed(commandBuffer, (uint)numIndices, 1, 0, 0, 0);
+        }
+        break;
+    case STRATEGY_INSTANCED:
+        // One call for every object: instance i reads its attributes from the current ring frame at binding 1.
+        {
+            const VkDeviceSize instanceOffset = sizeof(InstanceData) * vk.uniformRingFrame * options.objectCount;
+            vkCmdBindVertexBuffers(commandBuffer, 1, 1, &vk.instanceBuffer, &instanceOffset);
+            vkCmdDrawIndexed(commandBuffer, (uint)numIndices, count, 0, 0, first);
+        }
+        break;
+    case STRATEGY_INDIRECT:
+        // One call whatever the object count, recordCull() decided how many draws it expands to.
+        // firstInstance of each draw is the object, the vertex shader finds its transform with gl_InstanceIndex.
+        vkCmdBindDescriptorSets(
+            commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+            layout, 0,
+            1, &vk.cullSet,
+            0, nullptr);
+        vkCmdDrawIndexedIndirectCount(
+            commandBuffer,
+            vk.drawBuffer, 0,
+            vk.drawCountBuffer, 0,
+            count, sizeof(VkDrawIndexedIndirectCommand));
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+Splits the draws into vk.recordThreads contiguous ranges, each recorded by its own thread into a secondary command
+buffer from that thread's pool, and executes them from the primary in order. The calling thread records the first
+range itself. The threads only read objects, the descriptor sets and vk, all fixed while the frame is recorded.
+*/
+void recordDrawsInParallel(DrawStrategy strategy, VkFramebuffer framebuffer)
+{
+    const uint threadCount = std::min(vk.recordThreads, options.objectCount);
+
+    auto record = [=](uint worker) {
+        VkCommandBuffer commandBuffer = vk.workerCommandBuffers[worker];
+        vkResetCommandPool(vk.device, vk.workerPools[worker], 0);
+
+        VkCommandBufferInheritanceInfo inheritanceInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+            .renderPass = vk.renderPass,
+            .subpass = 0,
+            .framebuffer = framebuffer,
+        };
+
+        VkCommandBufferBeginInfo beginInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+            .pInheritanceInfo = &inheritanceInfo,
+        };
+
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording secondary command buffer!");
+        }
+
+        const uint first = (uint)((uint64_t)options.objectCount * worker / threadCount);
+        const uint end = (uint)((uint64_t)options.objectCount * (worker + 1) / threadCount);
+        recordDraws(commandBuffer, strategy, first, end - first);
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record secondary command buffer!");
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (uint i = 1; i < threadCount; ++i) {
+        workers.emplace_back(record, i);
+    }
+    record(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    vkCmdExecuteCommands(vk.commandBuffer, threadCount, vk.workerCommandBuffers.data());
+}
+
+// Returns the milliseconds spent recording the draws.
+double render(DrawStrategy strategy)
+{
+    const VkClearValue clearColor = { .color = {0.0f, 0.0f, 0.0f, 1.0f} };
     const VkCommandBufferBeginInfo beginInfo{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
 
     vkWaitForFences(vk.device, 1, &vk.inFlightFence, VK_TRUE, UINT64_MAX);
     vkResetFences(vk.device, 1, &vk.inFlightFence);
+    readTimestamps();
 
+    double recordMs = 0.0;
     uint32_t imageIndex;
     vkAcquireNextImageKHR(vk.device, vk.swapChain, UINT64_MAX, vk.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
 
@@ -898,6 +1738,14 @@ void render()
             throw std::runtime_error("failed to begin recording command buffer!");
         }
 
+        vkCmdResetQueryPool(vk.commandBuffer, vk.timestampPool, 0, 2);
+        vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestampPool, 0);
+
+        auto begin = std::chrono::steady_clock::now();
+        if (strategy == STRATEGY_INDIRECT) {
+            recordCull(vk.commandBuffer);
+        }
+
         VkRenderPassBeginInfo renderPassInfo{
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
             .renderPass = vk.renderPass,
@@ -907,27 +1755,21 @@ void render()
             .pClearValues = &clearColor,
         };
 
-        vkCmdBeginRenderPass(vk.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        // With worker threads the render pass may only contain vkCmdExecuteCommands.
+        // The strategies with a single draw always record it inline.
+        const bool secondary = vk.recordThreads > 0 && !singleDraw(strategy);
+        const VkSubpassContents contents = secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+        vkCmdBeginRenderPass(vk.commandBuffer, &renderPassInfo, contents);
         {
-            vkCmdSetViewport(vk.commandBuffer, 0, 1, &viewport);
-            vkCmdSetScissor(vk.commandBuffer, 0, 1, &scissor);
-
-            VkDeviceSize offsets[] = { 0 };
-            size_t numIndices = std::get<1>(Geometry::getIndices()) / sizeof(uint16_t);
-            vkCmdBindVertexBuffers(vk.commandBuffer, 0, 1, &vk.vertexBuffer, offsets);
-            vkCmdBindIndexBuffer(vk.commandBuffer, vk.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-            vkCmdBindDescriptorSets(
-                vk.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                vk.pipelineLayout, 0,
-                1, &vk.descriptorSet,
-                0, nullptr);
-
-            vkCmdBindPipeline(vk.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk.graphicsPipeline);
-            //for(uint i=0; i<200000; i++)
-            vkCmdDrawIndexed(vk.commandBuffer, (uint)numIndices, 1, 0, 0, 0);
-
+            if (secondary) {
+                recordDrawsInParallel(strategy, vk.framebuffers[imageIndex]);
+            } else {
+                recordDraws(vk.commandBuffer, strategy, 0, options.objectCount);
+            }
+            recordMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
         }
         vkCmdEndRenderPass(vk.commandBuffer);
+        vkCmdWriteTimestamp(vk.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestampPool, 1);
 
         if (vkEndCommandBuffer(vk.commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer!");
@@ -953,6 +1795,8 @@ void render()
     if (vkQueueSubmit(vk.graphicsQueue, 1, &submitInfo, vk.inFlightFence) != VK_SUCCESS) {
         throw std::runtime_error("failed to submit draw command buffer!");
     }
+    vk.lastStrategy = strategy;
+    vk.timestampsPending = true;
 
     VkPresentInfoKHR presentInfo{
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -964,10 +1808,46 @@ void render()
     };
 
     vkQueuePresentKHR(vk.graphicsQueue, &presentInfo);
+    return recordMs;
 }
 
-int main() 
+void reportStrategies()
 {
+    static uint frames = 0;
+    if (++frames < STATS_REPORT_INTERVAL) {
+        return;
+    }
+
+    const std::string threads = vk.recordThreads ? std::to_string(vk.recordThreads) + " threads" : "inline";
+    for (uint i = 0; i < STRATEGY_COUNT; ++i) {
+        StrategyStats& stats = strategyStats[i];
+        if (stats.frames == 0) {
+            continue;
+        }
+
+        const double recordMs = stats.recordMs / stats.frames;
+        const double gpuMs = stats.gpuFrames ? stats.gpuMs / stats.gpuFrames : 0.0;
+        const std::string visible = i == STRATEGY_INDIRECT && stats.gpuFrames
+            ? ", " + std::to_string((uint)(stats.visibleDraws / stats.gpuFrames)) + " visible" : "";
+        printf("[strategy] %-7s %u draws, %s, write %.3f ms, record %.3f ms (%.2f M draws/s), gpu %.3f ms (%.2f M draws/s)%s\n",
+            STRATEGY_NAMES[i], options.objectCount, singleDraw((DrawStrategy)i) ? "inline" : threads.c_str(),
+            stats.writeMs / stats.frames,
+            recordMs, options.objectCount / (recordMs * 1e3),
+            gpuMs, gpuMs > 0.0 ? options.objectCount / (gpuMs * 1e3) : 0.0, visible.c_str());
+        stats = {};
+    }
+    frames = 0;
+
+    if (options.threadSweep) {
+        // The next report measures twice the threads, back to one after options.recordThreads.
+        vk.recordThreads = vk.recordThreads == options.recordThreads ? 1 : std::min(vk.recordThreads * 2, options.recordThreads);
+    }
+}
+
+int main(int argc, char* argv[]) 
+{
+    parseOptions(argc, argv);
+
     glfwInit();
     GLFWwindow* window = createWindow();
     createVkInstance(window);
@@ -976,18 +1856,33 @@ int main()
     createRenderPass();
     createDescriptorRelated();
     createGraphicsPipeline();
+    createCullPipeline();
     createCommandCenter();
     createSyncObjects();
+    createQueryPool();
     createVertexBuffer();
     createIndexBuffer();
+    createUniformBuffer();
+    createInstanceBuffer();
+    createIndirectBuffers();
 
     float t = 0.f;
-    while (!glfwWindowShouldClose(window)) 
+    for (uint frame = 0; !glfwWindowShouldClose(window); ++frame) 
     {
         glfwPollEvents();
-        updateVertexBuffer(t * 0.01f);
-        updateUniformBuffer(t);
-        render();
+        const uint strategies = vk.drawIndirectCount ? STRATEGY_COUNT : STRATEGY_INDIRECT;
+        const DrawStrategy strategy = options.compareStrategies ? (DrawStrategy)(frame % strategies) : options.strategy;
+
+        auto begin = std::chrono::steady_clock::now();
+        updateUniformBuffer(strategy, t);
+        auto written = std::chrono::steady_clock::now();
+        const double recordMs = render(strategy);
+
+        StrategyStats& stats = strategyStats[strategy];
+        stats.writeMs += std::chrono::duration<double, std::milli>(written - begin).count();
+        stats.recordMs += recordMs;
+        ++stats.frames;
+        reportStrategies();
         t += 0.001f;
     }
     
@@ -0,0 +1,71 @@
+#version 450
+
+struct ObjectInstance {
+    float dx;
+    float dy;
+    float scale;
+    float radius;
+};
+
+struct ObjectTransform {
+    float dx;
+    float dy;
+    float scale;
+    float padding;
+};
+
+struct DrawIndexedIndirectCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Objects {
+    ObjectInstance objects[];
+};
+
+layout(std430, set = 0, binding = 1) writeonly buffer Transforms {
+    ObjectTransform transforms[];
+};
+
+layout(std430, set = 0, binding = 2) writeonly buffer Draws {
+    DrawIndexedIndirectCommand draws[];
+};
+
+layout(std430, set = 0, binding = 3) buffer DrawCount {
+    uint drawCount;
+};
+
+layout(push_constant) uniform CullParams {
+    float time;
+    float drift;
+    float amplitude;
+    uint objectCount;
+    uint indexCount;
+} params;
+
+layout(local_size_x = 64) in;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= params.objectCount) {
+        return;
+    }
+
+    // Same motion as updateUniformBuffer() on the CPU
+    ObjectInstance object = objects[i];
+    vec2 center = vec2(
+        object.dx + params.drift,
+        object.dy + params.amplitude * sin(params.time * 100.0 + float(i)));
+
+    // The frustum of this 2D scene is the clip space square
+    if (any(greaterThan(abs(center), vec2(1.0 + object.radius)))) {
+        return;
+    }
+
+    transforms[i] = ObjectTransform(center.x, center.y, object.scale, 0.0);
+    draws[atomicAdd(drawCount, 1)] = DrawIndexedIndirectCommand(params.indexCount, 1, 0, 0, i);
+}
@@ -0,0 +1,24 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+
+struct ObjectTransform {
+    float dx;
+    float dy;
+    float scale;
+    float padding;
+};
+
+// Written by object_cull_cs.glsl, indexed by the firstInstance of each indirect draw
+layout(std430, set = 0, binding = 1) readonly buffer Transforms {
+    ObjectTransform transforms[];
+};
+
+void main() {
+    ObjectTransform g = transforms[gl_InstanceIndex];
+    gl_Position = vec4(inPosition.x * g.scale + g.dx, inPosition.y * g.scale + g.dy, 0.0, 1.0);
+    fragColor = inColor;
+}
@@ -0,0 +1,15 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// Binding 1, advanced once per instance
+layout(location = 2) in vec3 inTransform;   // dx, dy, scale
+layout(location = 3) in vec4 inTint;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = vec4(inPosition * inTransform.z + inTransform.xy, 0.0, 1.0);
+    fragColor = inColor * inTint.rgb;
+}
@@ -5,12 +5,13 @@ layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
 
-layout(set = 0, binding = 0) uniform UBO {
+layout(push_constant) uniform PushConstants {
     float dx;
     float dy;
+    float scale;
 } g;
 
 void main() {
-    gl_Position = vec4(inPosition.x + g.dx, inPosition.y + g.dy, 0.0, 1.0);
+    gl_Position = vec4(inPosition.x * g.scale + g.dx, inPosition.y * g.scale + g.dy, 0.0, 1.0);
     fragColor = inColor;
 }
\ No newline at end of file